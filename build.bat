@@ -42,6 +42,30 @@ if %errorlevel% equ 0 (
 echo Project SSL support: %ssl_support%
 copy %vcpkg_file% vcpkg.json
 
+echo %* | find /i "with_simdjson" > nul
+if %errorlevel% equ 0 (
+    set "simdjson_support=ON"
+) else (
+    set "simdjson_support=OFF"
+)
+echo Project simdjson support: %simdjson_support%
+
+echo %* | find /i "with_coroutines" > nul
+if %errorlevel% equ 0 (
+    set "coroutine_support=ON"
+) else (
+    set "coroutine_support=OFF"
+)
+echo Project coroutine support: %coroutine_support%
+
+echo %* | find /i "with_pmr" > nul
+if %errorlevel% equ 0 (
+    set "pmr_support=ON"
+) else (
+    set "pmr_support=OFF"
+)
+echo Project memory resource support: %pmr_support%
+
 echo %* | find /i "without_tests" > nul
 if %errorlevel% equ 0 (
     set "build_tests=OFF"
@@ -66,7 +90,7 @@ if %errorlevel% equ 0 (
 )
 echo Project build examples: %build_examples%
 
-cmake -B "%build_dir%" -S . -DWT_BUILD_TESTS=%build_tests% -DWT_SKIP_TESTS=%skip_tests% -DWT_BUILD_EXAMPLES=%build_examples% -DWT_WITH_SSL=%ssl_support% -DCMAKE_BUILD_TYPE=%build_type% -DCMAKE_TOOLCHAIN_FILE="%toolchain_file%" -DVCPKG_TARGET_TRIPLET="%vcpkg_triplet%" -G "Visual Studio 18 2026" -A "%build_arch%"
+cmake -B "%build_dir%" -S . -DWT_BUILD_TESTS=%build_tests% -DWT_SKIP_TESTS=%skip_tests% -DWT_BUILD_EXAMPLES=%build_examples% -DWT_WITH_SSL=%ssl_support% -DWT_USE_SIMDJSON=%simdjson_support% -DWT_WITH_COROUTINES=%coroutine_support% -DWT_WITH_PMR=%pmr_support% -DCMAKE_BUILD_TYPE=%build_type% -DCMAKE_TOOLCHAIN_FILE="%toolchain_file%" -DVCPKG_TARGET_TRIPLET="%vcpkg_triplet%" -G "Visual Studio 18 2026" -A "%build_arch%"
 cmake --build "%build_dir%" --config "%build_type%" --parallel %NUMBER_OF_PROCESSORS%
 
 ctest --test-dir "%build_dir%\test"
\ No newline at end of file
@@ -36,6 +36,30 @@ fi
 echo "project SSL support: $ssl_support"
 cp $vcpkg_file vcpkg.json
 
+if [[ "${@#with_simdjson}" = "$@" ]]
+then
+    simdjson_support="OFF"
+else
+    simdjson_support="ON"
+fi
+echo "project simdjson support: $simdjson_support"
+
+if [[ "${@#with_coroutines}" = "$@" ]]
+then
+    coroutine_support="OFF"
+else
+    coroutine_support="ON"
+fi
+echo "project coroutine support: $coroutine_support"
+
+if [[ "${@#with_pmr}" = "$@" ]]
+then
+    pmr_support="OFF"
+else
+    pmr_support="ON"
+fi
+echo "project memory resource support: $pmr_support"
+
 if [[ "${@#without_tests}" = "$@" ]]
 then
     build_tests="ON"
@@ -60,7 +84,7 @@ else
 fi
 echo "project build examples: $build_examples"
 
-cmake -B build -S . -D"WT_BUILD_TESTS=$build_tests" -D"WT_SKIP_TESTS=$skip_tests" -D"WT_BUILD_EXAMPLES=$build_examples" -D"WT_WITH_SSL=$ssl_support" -D"CMAKE_BUILD_TYPE=$build_type" -D"WT_ENABLE_COVERAGE=$code_coverage" -D"CMAKE_TOOLCHAIN_FILE=$toolchain_file" -D"CMAKE_MAKE_PROGRAM:PATH=make" -D"CMAKE_CXX_COMPILER=g++"
+cmake -B build -S . -D"WT_BUILD_TESTS=$build_tests" -D"WT_SKIP_TESTS=$skip_tests" -D"WT_BUILD_EXAMPLES=$build_examples" -D"WT_WITH_SSL=$ssl_support" -D"WT_USE_SIMDJSON=$simdjson_support" -D"WT_WITH_COROUTINES=$coroutine_support" -D"WT_WITH_PMR=$pmr_support" -D"CMAKE_BUILD_TYPE=$build_type" -D"WT_ENABLE_COVERAGE=$code_coverage" -D"CMAKE_TOOLCHAIN_FILE=$toolchain_file" -D"CMAKE_MAKE_PROGRAM:PATH=make" -D"CMAKE_CXX_COMPILER=g++"
 cmake --build build --parallel $(nproc)
 
 ctest --test-dir build/test/
\ No newline at end of file
@@ -223,9 +223,10 @@ int main()
 
     auto web = server.get_web_server();
     
-    // register additional html page
+    // register additional html page, compressed only once for all clients
+    PrecompressedContent gui_page(gui_html);
     web->get("/gui", [&](auto res, auto req){
-        WebThingServer::Response(req, res).html(gui_html).end();
+        WebThingServer::Response(req, res).html(gui_page).end();
     });
 
     // register additional static file
@@ -142,29 +142,24 @@ struct FakeGpioHumiditySensor : public Thing
             {"maximum", 100},
             {"unit", "percent"},
             {"readOnly", true}});
+    }
 
-        // Start a thread that polls the sensor reading every 3 seconds
-        runner = std::thread([this]{
-            while(read_from_sensor)
-            {
-                std::this_thread::sleep_for(std::chrono::seconds(3));
-                if(!read_from_sensor)
-                    return;
-
-                // Update the underlying value, which in turn notifies
-                // all listeners
-                double new_level = read_from_gpio();
-                logger::info("setting new humidity level: " + std::to_string(new_level));
-                level->notify_of_external_update(new_level);
-            }
+    // Poll the sensor reading every 3 seconds on the server loop
+    void start(Scheduler& scheduler)
+    {
+        sampling = scheduler.schedule_periodic(std::chrono::seconds(3), [this]{
+            // Update the underlying value, which in turn notifies
+            // all listeners
+            double new_level = read_from_gpio();
+            logger::info("setting new humidity level: " + std::to_string(new_level));
+            level->notify_of_external_update(new_level);
         });
     }
 
-    void cancel()
+    void cancel(Scheduler& scheduler)
     {
         logger::info("canceling the sensor");
-        read_from_sensor = false;
-        runner.join();
+        scheduler.cancel(sampling);
     }
 
     // Mimic an actual sensor updating its reading every couple seconds.
@@ -177,8 +172,7 @@ struct FakeGpioHumiditySensor : public Thing
     }
 
     std::shared_ptr<Value<double>> level;
-    std::thread runner;
-    bool read_from_sensor = true;
+    Scheduler::TimerId sampling = 0;
 };
 
 void run_server()
@@ -196,11 +190,12 @@ void run_server()
         // If adding more than one thing, use MultipleThings() with a name.
         // In the single thing case, the thing's name will be broadcast.
         static auto server = WebThingServer::host(multiple_things).port(8888).build();
+        sensor.start(server.get_scheduler());
 
         std::signal(SIGINT, [](int signal) {
             if (signal == SIGINT)
             {
-                sensor.cancel();
+                sensor.cancel(server.get_scheduler());
                 server.stop();
             }
         });
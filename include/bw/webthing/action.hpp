@@ -4,8 +4,16 @@
 
 #pragma once
 
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <string_view>
+#include <vector>
 #include <bw/webthing/json.hpp>
+#include <bw/webthing/scheduler.hpp>
+#include <bw/webthing/storage.hpp>
 #include <bw/webthing/utils.hpp>
 
 namespace bw::webthing {
@@ -21,6 +29,12 @@ struct ActionBehavior
     std::function<void ()> perform_action;
     std::function<void ()> cancel_action;
     std::function<void* ()> get_thing;
+    // performs the action without blocking, calls done once it completed,
+    // with the exception it failed with or nullptr
+    std::function<void (std::function<void (std::exception_ptr)> /*done*/)> perform_action_async;
+    // persists the changed status of an action owned by a shared_ptr, before
+    // the thing is notified, e.g. in the action journal of the thing
+    std::function<void (const std::shared_ptr<Action>& /*action*/)> journal_status;
 };
 
 
@@ -28,12 +42,13 @@ template<class T> ActionBehavior make_action_behavior(T* thing,
     std::function<void ()> perform_action = nullptr,
     std::function<void ()> cancel_action = nullptr)
 {
-    return { 
-        [thing](auto action_status){ thing->action_notify(action_status); },
-        std::move(perform_action),
-        std::move(cancel_action),
-        [thing]{ return thing; }
-    };
+    ActionBehavior behavior;
+    behavior.notify_thing = [thing](auto action_status){ thing->action_notify(action_status); };
+    behavior.perform_action = std::move(perform_action);
+    behavior.cancel_action = std::move(cancel_action);
+    behavior.get_thing = [thing]{ return thing; };
+    behavior.journal_status = [thing](const std::shared_ptr<Action>& action){ thing->journal_action_status(action); };
+    return behavior;
 }
 
 template <typename T, typename = void>
@@ -64,14 +79,79 @@ execute_cancel_action(T& action_impl)
 
 template<class T, class A> ActionBehavior make_action_behavior(T* thing, A* action_impl)
 {
-    return {
-        [thing](auto action_status){ thing->action_notify(action_status); },
-        [action_impl]{ action_impl->perform_action(); },
-        [action_impl]{ execute_cancel_action(*action_impl); },
-        [thing]{ return thing; }
-    };
+    ActionBehavior behavior;
+    behavior.notify_thing = [thing](auto action_status){ thing->action_notify(action_status); };
+    behavior.cancel_action = [action_impl]{ execute_cancel_action(*action_impl); };
+    behavior.get_thing = [thing]{ return thing; };
+    behavior.journal_status = [thing](const std::shared_ptr<Action>& action){ thing->journal_action_status(action); };
+
+    if constexpr(std::is_void_v<decltype(action_impl->perform_action())>)
+    {
+        behavior.perform_action = [action_impl]{ action_impl->perform_action(); };
+    }
+    else
+    {
+        // perform_action returns a task, e.g. an ActionTask coroutine, that is
+        // started with a callback receiving the exception it failed with
+        behavior.perform_action_async = [action_impl](std::function<void (std::exception_ptr)> done)
+        {
+            action_impl->perform_action().start(std::move(done));
+        };
+    }
+
+    return behavior;
 }
 
+// Tells an action implementation that it should stop performing, e.g.
+// because the action was cancelled or timed out. Copies share their state.
+class CancellationToken
+{
+public:
+    bool is_cancelled() const
+    {
+        std::scoped_lock<std::mutex> lock(state->mutex);
+        return state->cancelled;
+    }
+
+    // Call callback once cancelled, immediately if already cancelled
+    void on_cancel(std::function<void ()> callback)
+    {
+        {
+            std::scoped_lock<std::mutex> lock(state->mutex);
+            if(!state->cancelled)
+            {
+                state->callbacks.push_back(std::move(callback));
+                return;
+            }
+        }
+        callback();
+    }
+
+    void cancel()
+    {
+        std::vector<std::function<void ()>> callbacks;
+        {
+            std::scoped_lock<std::mutex> lock(state->mutex);
+            if(state->cancelled)
+                return;
+            state->cancelled = true;
+            callbacks.swap(state->callbacks);
+        }
+        for(auto& callback : callbacks)
+            callback();
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        bool cancelled = false;
+        std::vector<std::function<void ()>> callbacks;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+
 //An Action represents an individual action on a thing.
 class Action : public std::enable_shared_from_this<Action> 
 {
@@ -98,6 +178,8 @@ public:
         json description;
         description[name]["href"] = href_prefix + href;
         description[name]["timeRequested"] = time_requested;
+
+        std::scoped_lock<std::mutex> lock(status_mutex);
         description[name]["status"] = status;
 
         if(input)
@@ -106,6 +188,9 @@ public:
         if(time_completed)
             description[name]["timeCompleted"] = *time_completed;
 
+        if(error)
+            description[name]["error"] = *error;
+
         return description;
     }
 
@@ -132,6 +217,7 @@ public:
 
     std::string get_status() const
     {  
+        std::scoped_lock<std::mutex> lock(status_mutex);
         return status;
     }
 
@@ -142,6 +228,7 @@ public:
 
     std::optional<std::string> get_time_completed() const
     {
+        std::scoped_lock<std::mutex> lock(status_mutex);
         return time_completed;
     }
 
@@ -157,21 +244,117 @@ public:
         return nullptr;
     }
 
-    // Start performing the action.
+    // Token cancelled once the action was cancelled or timed out, long
+    // running implementations should check it and stop performing
+    CancellationToken get_cancellation_token() const
+    {
+        return cancellation_token;
+    }
+
+    bool is_cancelled() const
+    {
+        return cancellation_token.is_cancelled();
+    }
+
+    // Time after which a started action times out, if it did not finish before
+    std::optional<std::chrono::milliseconds> get_timeout() const
+    {
+        return timeout;
+    }
+
+    // Let the action time out once timeout expired after it was created.
+    // The deadline is scheduled on scheduler, e.g. the one of the server loop,
+    // and canceled once the action completed before. Only actions owned by a
+    // shared_ptr are timed out by the scheduler.
+    void set_timeout(std::optional<std::chrono::milliseconds> timeout, Scheduler* scheduler = nullptr)
+    {
+        this->timeout = timeout;
+        std::weak_ptr<Action> weak_action = weak_from_this();
+        if(!timeout || !scheduler || weak_action.expired())
+            return;
+
+        auto timer = scheduler->schedule(*timeout, [weak_action]{
+            if(auto timed_out = weak_action.lock())
+                timed_out->time_out();
+        });
+
+        std::scoped_lock<std::mutex> lock(status_mutex);
+        timeout_scheduler = scheduler->weak_from_this();
+        timeout_timer = timer;
+    }
+
+    // Start performing the action. Actions performed asynchronously
+    // are finished once completed, start() does not wait for them.
+    // Actions cancelled before they were started are not performed.
     void start()
     {
-        status = "pending";
+        {
+            std::scoped_lock<std::mutex> lock(status_mutex);
+            if(status != "created")
+                return;
+            status = "pending";
+        }
         notify_thing();
-        perform_action();
+
+        if(action_behavior.perform_action_async)
+        {
+            // keep the action alive until completed
+            auto self = weak_from_this().lock();
+            action_behavior.perform_action_async([this, self](std::exception_ptr error){
+                error ? fail(error) : finish();
+            });
+            return;
+        }
+
+        try
+        {
+            perform_action();
+        }
+        catch(...)
+        {
+            fail(std::current_exception());
+            return;
+        }
         finish();
     }
 
-    // Finish performing the action.
+    // Whether the action is performed without blocking the thread starting it
+    bool performs_async() const
+    {
+        return action_behavior.perform_action_async != nullptr;
+    }
+
+    // Finish performing the action, unless it was cancelled or timed out before.
     void finish()
     {
-        status = "completed";
-        time_completed = timestamp();
-        notify_thing();
+        complete("completed");
+    }
+
+    // Finish performing the action as it failed with error, unless it was
+    // cancelled or timed out before
+    void fail(std::exception_ptr error)
+    {
+        std::string message = "unknown error";
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch(std::exception& ex)
+        {
+            message = ex.what();
+        }
+        catch(...)
+        {}
+
+        logger::error("action '" + name + "' failed: " + message);
+        complete("failed", message);
+    }
+
+    // Message of the error the action failed with
+    std::optional<std::string> get_error() const
+    {
+        std::scoped_lock<std::mutex> lock(status_mutex);
+        return error;
     }
 
     void perform_action()
@@ -180,28 +363,76 @@ public:
             action_behavior.perform_action();
     }
 
+    // Cancel the action, unless it already completed
     void cancel()
     {
+        stop("cancelled");
+    }
+
+    // Stop the action as its timeout expired, unless it already completed
+    void time_out()
+    {
+        stop("timedout");
+    }
+
+    // Restore the state of an action requested before, e.g. replayed from a
+    // journal. Restored actions are not performed, those that did not complete
+    // before are restored as cancelled.
+    void restore(std::string restored_status, std::string restored_time_requested,
+        std::optional<std::string> restored_time_completed, std::optional<std::string> restored_error = std::nullopt)
+    {
+        std::scoped_lock<std::mutex> lock(status_mutex);
+        time_requested = restored_time_requested;
+        if(restored_status == "created" || restored_status == "pending")
+        {
+            status = "cancelled";
+            time_completed = timestamp();
+        }
+        else
+        {
+            status = restored_status;
+            time_completed = restored_time_completed;
+            error = restored_error;
+        }
+    }
+
+private:
+    bool complete(const std::string& final_status, std::optional<std::string> final_error = std::nullopt)
+    {
+        {
+            std::scoped_lock<std::mutex> lock(status_mutex);
+            if(status != "created" && status != "pending")
+                return false;
+            status = final_status;
+            error = std::move(final_error);
+            time_completed = timestamp();
+            if(auto scheduler = timeout_scheduler.lock())
+                scheduler->cancel(timeout_timer);
+        }
+        notify_thing();
+        return true;
+    }
+
+    void stop(const std::string& final_status)
+    {
+        if(!complete(final_status))
+            return;
+
+        cancellation_token.cancel();
         if(action_behavior.cancel_action)
             action_behavior.cancel_action();
     }
 
-private:
     void notify_thing()
     {
+        // Pass this as shared_ptr to ensure Action remains alive during callback execution
+        // this might be necessary, as an Action is interacted with from different threads.
+        auto self = weak_from_this().lock();
+        if(self && action_behavior.journal_status)
+            action_behavior.journal_status(self);
+
         if(action_behavior.notify_thing)
-        {
-            try
-            {
-                // Pass this as shared_ptr to ensure Action remains alive during callback execution
-                // this might be necessary, as an Action is interacted with from different threads.
-                action_behavior.notify_thing(action_status_message(shared_from_this()));
-            }
-            catch(std::bad_weak_ptr&)
-            {
-                action_behavior.notify_thing(action_status_message(*this));
-            }
-        }
+            action_behavior.notify_thing(self ? action_status_message(self) : action_status_message(*this));
     }
 
     std::string id;
@@ -211,8 +442,14 @@ private:
     std::string href_prefix;
     std::string href;
     std::string status;
+    mutable std::mutex status_mutex;
+    CancellationToken cancellation_token;
+    std::optional<std::chrono::milliseconds> timeout;
+    std::weak_ptr<Scheduler> timeout_scheduler;
+    Scheduler::TimerId timeout_timer = 0;
     std::string time_requested;
     std::optional<std::string> time_completed;
+    std::optional<std::string> error;
 };
 
 inline json action_status_message(const Action& action)
@@ -229,4 +466,64 @@ inline json action_status_message(std::shared_ptr<Action> action)
     return action_status_message(*action);
 }
 
+// Accounted size of an action, see StorageConfig::max_bytes
+inline size_t storage_size(const std::shared_ptr<Action>& action)
+{
+    auto input = action->get_input();
+    return sizeof(Action) + action->get_id().size() + action->get_name().size() +
+        action->get_href().size() + (input ? json_storage_size(*input) : 0);
+}
+
+// Persist the actions of thing in a journal, see FlexibleRingBuffer::attach_journal
+template<class T> JournalCodec<std::shared_ptr<Action>> make_action_journal_codec(T* thing)
+{
+    return {
+        [](const std::shared_ptr<Action>& action)
+        {
+            json record = {
+                {"id", action->get_id()},
+                {"name", action->get_name()},
+                {"status", action->get_status()},
+                {"timeRequested", action->get_time_requested()}
+            };
+            if(auto input = action->get_input())
+                record["input"] = *input;
+            if(auto time_completed = action->get_time_completed())
+                record["timeCompleted"] = *time_completed;
+            if(auto error = action->get_error())
+                record["error"] = *error;
+            return record.dump();
+        },
+        [thing](std::string_view payload) -> std::optional<std::shared_ptr<Action>>
+        {
+            json record = json::parse(payload, nullptr, false);
+            if(!record.is_object())
+                return std::nullopt;
+            for(auto member : {"id", "name", "status", "timeRequested"})
+                if(!record.value(member, json()).is_string())
+                    return std::nullopt;
+
+            std::optional<json> input;
+            if(record.contains("input"))
+                input = record["input"];
+            std::optional<std::string> time_completed;
+            if(record.value("timeCompleted", json()).is_string())
+                time_completed = record["timeCompleted"].get<std::string>();
+            std::optional<std::string> error;
+            if(record.value("error", json()).is_string())
+                error = record["error"].get<std::string>();
+
+            auto action = thing->template make_record<Action>(record["id"].get<std::string>(),
+                make_action_behavior(thing), record["name"].get<std::string>(), input);
+            action->restore(record["status"].get<std::string>(),
+                record["timeRequested"].get<std::string>(), time_completed, error);
+            return action;
+        },
+        [](const std::shared_ptr<Action>& action)
+        {
+            return action->get_id();
+        }
+    };
+}
+
 } // bw::webthing
\ No newline at end of file
@@ -0,0 +1,148 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace bw::webthing {
+
+// A bump allocator for memory needed while handling a request, e.g. the
+// encoded body and the headers of a response. Allocations are not freed
+// one by one but all at once by reset(), which keeps the memory to be
+// reused by the next request, up to max_retained bytes.
+class Arena
+{
+public:
+    Arena(size_t block_size = 16 * 1024, size_t max_retained = 1024 * 1024)
+        : block_size(block_size)
+        , max_retained(max_retained)
+    {}
+
+    Arena(const Arena& other) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        while(true)
+        {
+            if(current < blocks.size())
+            {
+                auto& block = blocks[current];
+                size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+                if(aligned + size <= block.size)
+                {
+                    offset = aligned + size;
+                    return block.data.get() + aligned;
+                }
+                if(current + 1 < blocks.size())
+                {
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+
+            // blocks are aligned for any type
+            blocks.push_back({std::make_unique<char[]>(std::max(block_size, size)), std::max(block_size, size)});
+            current = blocks.size() - 1;
+            offset = 0;
+        }
+    }
+
+    // Copy str into the arena, e.g. a header value of a temporary string
+    std::string_view copy(std::string_view str)
+    {
+        if(str.empty())
+            return {};
+
+        auto data = static_cast<char*>(allocate(str.size(), 1));
+        std::memcpy(data, str.data(), str.size());
+        return {data, str.size()};
+    }
+
+    // Release all allocations. If they did not fit into a single block, the
+    // blocks are merged, so the next request allocates from one block. Memory
+    // exceeding max_retained is released, e.g. after an exceptionally large
+    // response, so a single request does not keep its memory forever.
+    void reset()
+    {
+        size_t size = capacity();
+        if(blocks.size() > 1 || size > max_retained)
+        {
+            size = std::min(size, max_retained);
+            blocks.clear();
+            if(size > 0)
+                blocks.push_back({std::make_unique<char[]>(size), size});
+        }
+        current = 0;
+        offset = 0;
+    }
+
+    // Number of bytes allocated from the heap
+    size_t capacity() const
+    {
+        size_t size = 0;
+        for(auto& block : blocks)
+            size += block.size;
+        return size;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t block_size;
+    size_t max_retained;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+};
+
+// Allocator of standard containers allocating from an arena, e.g.
+//
+//   std::vector<char, ArenaAllocator<char>> buffer(ArenaAllocator<char>(arena));
+//
+// Deallocation is a no-op, the memory is released by Arena::reset().
+template<class T> struct ArenaAllocator
+{
+    typedef T value_type;
+
+    ArenaAllocator(Arena& arena)
+        : arena(&arena)
+    {}
+
+    template<class U> ArenaAllocator(const ArenaAllocator<U>& other)
+        : arena(other.arena)
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t)
+    {}
+
+    template<class U> bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return arena == other.arena;
+    }
+
+    template<class U> bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return arena != other.arena;
+    }
+
+    Arena* arena;
+};
+
+} // bw::webthing
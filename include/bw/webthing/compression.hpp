@@ -0,0 +1,140 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+#include <bw/webthing/utils.hpp>
+
+namespace bw::webthing {
+
+// Smaller http response bodies are not worth to be compressed
+const size_t HTTP_COMPRESSION_MIN_SIZE = 1024;
+
+enum class ContentEncoding
+{
+    identity,
+    gzip,
+    deflate
+};
+
+inline std::string_view content_encoding_name(ContentEncoding encoding)
+{
+    switch(encoding)
+    {
+        case ContentEncoding::gzip: return "gzip";
+        case ContentEncoding::deflate: return "deflate";
+        default: return "identity";
+    }
+}
+
+// Select the encoding of a response based on the accept-encoding header
+// of the request, e.g. "gzip, deflate;q=0.5". gzip is preferred over
+// deflate of the same quality, identity is used if neither is accepted.
+inline ContentEncoding negotiate_content_encoding(std::string_view accept_encoding)
+{
+    ContentEncoding best_encoding = ContentEncoding::identity;
+    double best_quality = 0.0;
+
+    for_each_weighted_value(accept_encoding, [&](std::string_view coding, double quality)
+    {
+        ContentEncoding encoding;
+        if(iequals(coding, "gzip") || iequals(coding, "x-gzip") || coding == "*")
+            encoding = ContentEncoding::gzip;
+        else if(iequals(coding, "deflate"))
+            encoding = ContentEncoding::deflate;
+        else
+            return;
+
+        if(quality > best_quality)
+        {
+            best_encoding = encoding;
+            best_quality = quality;
+        }
+    });
+
+    return best_encoding;
+}
+
+// Compress data in gzip or deflate (zlib) format.
+// throws std::runtime_error if data could not be compressed
+inline std::string compress(std::string_view data, ContentEncoding encoding)
+{
+    if(encoding == ContentEncoding::identity)
+        return std::string(data);
+
+    z_stream stream = {};
+    int window_bits = encoding == ContentEncoding::gzip ? MAX_WBITS + 16 : MAX_WBITS;
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("Initialization of compression failed");
+
+    std::string compressed(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if(result != Z_STREAM_END)
+        throw std::runtime_error("Compression failed");
+
+    compressed.resize(stream.total_out);
+    return compressed;
+}
+
+// A response body that is compressed at most once per encoding, e.g. the
+// html of a static ui page or a thing description that rarely changes.
+class PrecompressedContent
+{
+public:
+    PrecompressedContent(std::string content = "")
+        : content(std::move(content))
+    {}
+
+    PrecompressedContent(const PrecompressedContent& other)
+        : content(other.content)
+    {}
+
+    PrecompressedContent& operator=(const PrecompressedContent& other)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        content = other.content;
+        gzip_content = std::nullopt;
+        deflate_content = std::nullopt;
+        return *this;
+    }
+
+    const std::string& get() const
+    {
+        return content;
+    }
+
+    // Get the content compressed in encoding, compresses it on first use.
+    const std::string& get(ContentEncoding encoding)
+    {
+        if(encoding == ContentEncoding::identity)
+            return content;
+
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto& compressed = encoding == ContentEncoding::gzip ? gzip_content : deflate_content;
+        if(!compressed)
+            compressed = compress(content, encoding);
+        return *compressed;
+    }
+
+private:
+    std::string content;
+    std::optional<std::string> gzip_content;
+    std::optional<std::string> deflate_content;
+    std::mutex mutex;
+};
+
+} // bw::webthing
@@ -0,0 +1,147 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bw/webthing/json.hpp>
+#include <bw/webthing/utils.hpp>
+
+namespace bw::webthing {
+
+// Encodings a thing's json documents and messages can be exchanged in
+enum class ContentFormat
+{
+    json,
+    cbor,
+    msgpack
+};
+
+const ContentFormat CONTENT_FORMATS[] = {ContentFormat::json, ContentFormat::cbor, ContentFormat::msgpack};
+
+inline std::string_view content_type(ContentFormat format)
+{
+    switch(format)
+    {
+        case ContentFormat::cbor: return "application/cbor";
+        case ContentFormat::msgpack: return "application/msgpack";
+        default: return "application/json";
+    }
+}
+
+// Name of the websocket subprotocol a client can request to exchange messages in format
+inline std::string_view websocket_protocol(ContentFormat format)
+{
+    switch(format)
+    {
+        case ContentFormat::cbor: return "webthing.cbor";
+        case ContentFormat::msgpack: return "webthing.msgpack";
+        default: return "webthing";
+    }
+}
+
+inline bool is_binary(ContentFormat format)
+{
+    return format != ContentFormat::json;
+}
+
+// Select the format of a response based on the accept header of the request,
+// e.g. "application/cbor, application/json;q=0.5". Media types are weighted by
+// their quality values, json is used when no supported media type is accepted.
+inline ContentFormat negotiate_content_format(std::string_view accept)
+{
+    ContentFormat best_format = ContentFormat::json;
+    double best_quality = 0.0;
+
+    for_each_weighted_value(accept, [&](std::string_view media_type, double quality)
+    {
+        ContentFormat format;
+        if(iequals(media_type, "application/cbor"))
+            format = ContentFormat::cbor;
+        else if(iequals(media_type, "application/msgpack") || iequals(media_type, "application/x-msgpack"))
+            format = ContentFormat::msgpack;
+        else if(iequals(media_type, "application/json") || media_type == "*/*" || iequals(media_type, "application/*"))
+            format = ContentFormat::json;
+        else
+            return;
+
+        // json is preferred over binary formats of the same quality
+        if(quality > best_quality || (quality == best_quality && format == ContentFormat::json))
+        {
+            best_format = format;
+            best_quality = quality;
+        }
+    });
+
+    return best_format;
+}
+
+// Select the format of a websocket based on the subprotocols the client
+// requested, e.g. "webthing.cbor, webthing". Returns json if no binary
+// subprotocol was requested.
+inline ContentFormat negotiate_websocket_format(std::string_view protocols)
+{
+    while(!protocols.empty())
+    {
+        size_t end = protocols.find(',');
+        std::string_view protocol = trim(protocols.substr(0, end));
+        protocols = end == std::string_view::npos ? std::string_view() : protocols.substr(end + 1);
+
+        for(auto format : CONTENT_FORMATS)
+            if(is_binary(format) && protocol == websocket_protocol(format))
+                return format;
+    }
+    return ContentFormat::json;
+}
+
+inline std::string encode(const json& j, ContentFormat format)
+{
+    std::string encoded;
+    switch(format)
+    {
+        case ContentFormat::cbor:
+            json::to_cbor(j, encoded);
+            break;
+        case ContentFormat::msgpack:
+            json::to_msgpack(j, encoded);
+            break;
+        default:
+            encoded = j.dump();
+    }
+    return encoded;
+}
+
+// Like encode(j, format), but appends to out, e.g. a buffer allocated from an Arena
+template<class Allocator> void encode(const json& j, ContentFormat format, std::vector<char, Allocator>& out)
+{
+    switch(format)
+    {
+        case ContentFormat::cbor:
+            json::to_cbor(j, nlohmann::detail::output_adapter<char>(out));
+            break;
+        case ContentFormat::msgpack:
+            json::to_msgpack(j, nlohmann::detail::output_adapter<char>(out));
+            break;
+        default:
+            nlohmann::detail::serializer<json>(nlohmann::detail::output_adapter<char>(out), ' ').dump(j, false, false, 0);
+    }
+}
+
+// throws json::parse_error when data is not valid in format
+inline json decode(std::string_view data, ContentFormat format)
+{
+    switch(format)
+    {
+        case ContentFormat::cbor:
+            return json::from_cbor(data);
+        case ContentFormat::msgpack:
+            return json::from_msgpack(data);
+        default:
+            return json::parse(data);
+    }
+}
+
+} // bw::webthing
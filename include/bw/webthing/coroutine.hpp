@@ -0,0 +1,245 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#ifdef WT_WITH_COROUTINES
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <bw/webthing/scheduler.hpp>
+#include <bw/webthing/value.hpp>
+
+namespace bw::webthing {
+
+// Coroutine performing an action without holding a thread while it waits,
+// returned by the perform_action() of an action implementation, e.g.
+//
+//   ActionTask perform_action()
+//   {
+//       co_await sleep_for(std::chrono::seconds(1));
+//       get_thing<Thing>()->set_property("brightness", 100);
+//   }
+//
+// The coroutine is run until its first suspension by start() and owns
+// itself from then on until it completed.
+class ActionTask
+{
+public:
+    struct promise_type
+    {
+        std::function<void (std::exception_ptr)> done;
+        std::exception_ptr error;
+
+        ActionTask get_return_object()
+        {
+            return ActionTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+            struct Completion
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    auto done = std::move(handle.promise().done);
+                    auto error = handle.promise().error;
+                    handle.destroy();
+                    if(done)
+                        done(error);
+                }
+
+                void await_resume() noexcept
+                {}
+            };
+            return Completion{};
+        }
+
+        void return_void()
+        {}
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+    };
+
+    ActionTask(ActionTask&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {}
+
+    ActionTask(const ActionTask& other) = delete;
+
+    ~ActionTask()
+    {
+        if(handle)
+            handle.destroy();
+    }
+
+    // Run the coroutine until its first suspension, done is called with
+    // the exception it failed with, or nullptr, once it completed
+    void start(std::function<void (std::exception_ptr)> done)
+    {
+        if(!handle)
+            throw std::logic_error("ActionTask already started");
+
+        auto started = std::exchange(handle, nullptr);
+        started.promise().done = std::move(done);
+        started.resume();
+    }
+
+    // Await completion of another task, e.g. a ramp reused by several
+    // actions, rethrows the exception it failed with
+    auto operator co_await() &&
+    {
+        struct Awaiter
+        {
+            ActionTask task;
+            std::exception_ptr error;
+
+            bool await_ready()
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> awaiting)
+            {
+                task.start([this, awaiting](std::exception_ptr e)
+                {
+                    error = e;
+                    awaiting.resume();
+                });
+            }
+
+            void await_resume()
+            {
+                if(error)
+                    std::rethrow_exception(error);
+            }
+        };
+        return Awaiter{std::move(*this), nullptr};
+    }
+
+private:
+    explicit ActionTask(std::coroutine_handle<promise_type> handle)
+        : handle(handle)
+    {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Suspend until delay expired, resumed by the thread advancing scheduler
+inline auto sleep_for(Scheduler& scheduler, std::chrono::milliseconds delay)
+{
+    struct Awaiter
+    {
+        Scheduler& scheduler;
+        std::chrono::milliseconds delay;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            scheduler.schedule(delay, [handle]{ handle.resume(); });
+        }
+
+        void await_resume()
+        {}
+    };
+    return Awaiter{scheduler, delay};
+}
+
+// Suspend until delay expired using the scheduler advanced by the calling
+// thread, e.g. the scheduler of the server that started the action.
+// throws std::logic_error if the calling thread does not advance a scheduler
+inline auto sleep_for(std::chrono::milliseconds delay)
+{
+    auto scheduler = Scheduler::current();
+    if(!scheduler)
+        throw std::logic_error("No scheduler is advanced by the calling thread");
+    return sleep_for(*scheduler, delay);
+}
+
+// Resume on the thread advancing scheduler, e.g. to return to the
+// server loop after blocking work was done on a thread pool
+inline auto resume_on(Scheduler& scheduler)
+{
+    return sleep_for(scheduler, std::chrono::milliseconds(0));
+}
+
+// Resume on a thread of executor, e.g. a pool for blocking device access
+inline auto resume_on(Executor executor)
+{
+    struct Awaiter
+    {
+        Executor executor;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            executor([handle]{ handle.resume(); });
+        }
+
+        void await_resume()
+        {}
+    };
+    return Awaiter{std::move(executor)};
+}
+
+// Suspend until value changed and get the new value, resumed by the
+// thread changing it
+template<class T> auto next_change(Value<T>& value)
+{
+    struct Awaiter
+    {
+        Value<T>& value;
+        std::optional<T> changed;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            value.observe_next_change([this, handle](const T& v)
+            {
+                changed = v;
+                handle.resume();
+            });
+        }
+
+        T await_resume()
+        {
+            return *changed;
+        }
+    };
+    return Awaiter{value, std::nullopt};
+}
+
+} // bw::webthing
+
+#endif // WT_WITH_COROUTINES
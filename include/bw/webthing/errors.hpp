@@ -32,6 +32,18 @@ public:
     {}  
 };
 
+class ForwardTimeoutError : public std::runtime_error
+{
+public:
+    ForwardTimeoutError()
+        : std::runtime_error("Forwarding value timed out")
+    {}
+
+    ForwardTimeoutError(std::string message)
+        : std::runtime_error(message)
+    {}  
+};
+
 class ActionError : public std::runtime_error
 {
 public:
@@ -6,7 +6,9 @@
 
 #include <memory>
 #include <optional>
+#include <string_view>
 #include <bw/webthing/json.hpp>
+#include <bw/webthing/storage.hpp>
 #include <bw/webthing/utils.hpp>
 
 namespace bw::webthing {
@@ -25,6 +27,14 @@ public:
         , time(bw::webthing::timestamp())
     {}
 
+    // Restore an event that occurred at time, e.g. replayed from a journal
+    Event(Thing* thing, std::string name, std::optional<json> data, std::string time)
+        : thing(thing)
+        , name(name)
+        , data(data)
+        , time(time)
+    {}
+
     // Get the event description of the event as a json object.
     json as_event_description() const
     {
@@ -64,6 +74,43 @@ private:
     std::string time;
 };
 
+// Accounted size of an event, see StorageConfig::max_bytes
+inline size_t storage_size(const std::shared_ptr<Event>& event)
+{
+    auto data = event->get_data();
+    return sizeof(Event) + event->get_name().size() + event->get_time().size() +
+        (data ? json_storage_size(*data) : 0);
+}
+
+// Persist the events of thing in a journal, see SimpleRingBuffer::attach_journal
+template<class T> JournalCodec<std::shared_ptr<Event>> make_event_journal_codec(T* thing)
+{
+    return {
+        [](const std::shared_ptr<Event>& event)
+        {
+            json record = {{"name", event->get_name()}, {"time", event->get_time()}};
+            if(auto data = event->get_data())
+                record["data"] = *data;
+            return record.dump();
+        },
+        [thing](std::string_view payload) -> std::optional<std::shared_ptr<Event>>
+        {
+            json record = json::parse(payload, nullptr, false);
+            if(!record.is_object() || !record.value("name", json()).is_string() ||
+                !record.value("time", json()).is_string())
+                return std::nullopt;
+
+            std::optional<json> data;
+            if(record.contains("data"))
+                data = record["data"];
+            return thing->template make_record<Event>(thing, record["name"].get<std::string>(),
+                data, record["time"].get<std::string>());
+        },
+        // events are neither updated nor removed, so they need no key
+        nullptr
+    };
+}
+
 inline json event_message(const Event& event)
 {
     json description = event.as_event_description();
@@ -0,0 +1,312 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bw/webthing/mapped_file.hpp>
+#include <bw/webthing/utils.hpp>
+
+namespace bw::webthing {
+
+struct JournalConfig
+{
+    // segments are stored in files named <path>.<number>.journal
+    std::string path;
+    // size segment files are preallocated with, larger records get a segment of their own
+    size_t segment_size = 4 * 1024 * 1024;
+    // number of records appended until they are synced to disk, 0 leaves writing
+    // back to the operating system, which survives restarts of the process but not
+    // a power loss
+    size_t sync_batch = 0;
+};
+
+// A segmented, memory mapped, append-only log of records, e.g. to persist
+// the elements of a storage across restarts. Every record starts with a
+// fixed size header containing a checksum, records of a torn write are
+// detected and skipped on replay. Segments are deleted once none of their
+// records is retained anymore, which happens oldest first.
+class Journal
+{
+public:
+    // Identifies a segment, 0 is never used as id
+    typedef uint32_t SegmentId;
+
+    enum class RecordType : uint16_t
+    {
+        // payload is an element
+        entry = 1,
+        // payload is the key of an element removed before
+        removal = 2
+    };
+
+    struct Record
+    {
+        RecordType type;
+        // milliseconds since epoch the record was appended at
+        int64_t time;
+        std::string_view payload;
+        SegmentId segment;
+    };
+
+    // Open the journal and the segments written before
+    // throws std::runtime_error if the journal directory is not accessible
+    Journal(JournalConfig journal_config)
+        : config(std::move(journal_config))
+    {
+        namespace fs = std::filesystem;
+        fs::path base(config.path);
+        auto directory = base.has_parent_path() ? base.parent_path() : fs::path(".");
+        prefix = base.filename().string() + ".";
+
+        std::error_code ec;
+        fs::create_directories(directory, ec);
+        if(!fs::is_directory(directory, ec))
+            throw std::runtime_error("Journal directory not accessible: " + directory.string());
+
+        for(auto& entry : fs::directory_iterator(directory))
+        {
+            auto name = entry.path().filename().string();
+            if(name.size() <= prefix.size() + SUFFIX.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+                name.compare(name.size() - SUFFIX.size(), SUFFIX.size(), SUFFIX) != 0)
+                continue;
+
+            auto number = name.substr(prefix.size(), name.size() - prefix.size() - SUFFIX.size());
+            if(number.find_first_not_of("0123456789") != std::string::npos || number.size() > 9)
+                continue;
+
+            segments.push_back({static_cast<SegmentId>(std::stoul(number))});
+        }
+        std::sort(segments.begin(), segments.end(), [](auto& a, auto& b){ return a.id < b.id; });
+        next_segment = segments.empty() ? 1 : segments.back().id + 1;
+    }
+
+    Journal(const Journal& other) = delete;
+
+    ~Journal()
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        sync_active();
+    }
+
+    // Pass the records of all segments written before the journal was opened
+    // to callback, in the order they were appended, in a single sequential pass.
+    // Segments are not deleted until the records were replayed.
+    void replay(const std::function<void (const Record&)>& callback)
+    {
+        std::vector<SegmentId> replayed;
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            for(auto& segment : segments)
+                if(segment.id < first_appended)
+                    replayed.push_back(segment.id);
+        }
+
+        for(auto id : replayed)
+        {
+            MappedFile file(segment_file(id));
+            size_t offset = 0;
+            while(offset + HEADER_SIZE <= file.size())
+            {
+                auto header = file.data() + offset;
+                uint32_t magic, checksum, size;
+                Record record;
+                std::memcpy(&magic, header, 4);
+                std::memcpy(&record.type, header + 4, 2);
+                std::memcpy(&size, header + 8, 4);
+                std::memcpy(&checksum, header + 12, 4);
+                std::memcpy(&record.time, header + 16, 8);
+
+                if(magic != MAGIC)
+                    break;
+
+                if(size > file.size() - offset - HEADER_SIZE ||
+                    checksum != record_checksum(header, header + HEADER_SIZE, size))
+                {
+                    logger::warn("journal::replay : skipped torn record in " + segment_file(id));
+                    break;
+                }
+
+                record.payload = std::string_view(header + HEADER_SIZE, size);
+                record.segment = id;
+                callback(record);
+                offset += aligned(HEADER_SIZE + size);
+            }
+        }
+
+        std::scoped_lock<std::mutex> lock(mutex);
+        replayed_all = true;
+        collect();
+    }
+
+    // Append a record, returns the segment it was appended to
+    SegmentId append(RecordType type, std::string_view payload, int64_t time = now())
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        size_t size = aligned(HEADER_SIZE + payload.size());
+        if(!active || active_offset + size > active->size())
+            rotate(size);
+
+        auto header = active->data() + active_offset;
+        uint32_t magic = MAGIC, payload_size = static_cast<uint32_t>(payload.size());
+        std::memcpy(header + 16, &time, 8);
+        std::memcpy(header + HEADER_SIZE, payload.data(), payload.size());
+        std::memcpy(header + 4, &type, 2);
+        std::memset(header + 6, 0, 2);
+        std::memcpy(header + 8, &payload_size, 4);
+        uint32_t checksum = record_checksum(header, header + HEADER_SIZE, payload.size());
+        std::memcpy(header + 12, &checksum, 4);
+        std::memcpy(header, &magic, 4);
+        active_offset += size;
+
+        if(config.sync_batch > 0 && ++unsynced >= config.sync_batch)
+            sync_active();
+
+        return segments.back().id;
+    }
+
+    // Mark a record appended to segment as retained, e.g. while the element
+    // it contains is stored. Segments with retained records are not deleted.
+    void retain(SegmentId segment)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        if(auto s = find_segment(segment))
+            s->retained++;
+    }
+
+    // Release a record retained before, deletes the oldest segments once
+    // none of their records are retained anymore
+    void release(SegmentId segment)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        if(auto s = find_segment(segment); s && s->retained > 0)
+            s->retained--;
+        collect();
+    }
+
+    // Write appended records back to disk and wait until they were written
+    void sync()
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        sync_active();
+    }
+
+    // Number of segment files of the journal
+    size_t segment_count() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return segments.size();
+    }
+
+    // milliseconds since epoch, the time of records appended by default
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    // magic (4), type (2), reserved (2), payload size (4), checksum (4), time (8)
+    static constexpr size_t HEADER_SIZE = 24;
+    static constexpr uint32_t MAGIC = 0x524A5457; // "WTJR"
+    inline static const std::string SUFFIX = ".journal";
+
+    struct Segment
+    {
+        SegmentId id;
+        size_t retained = 0;
+    };
+
+    JournalConfig config;
+    std::string prefix;
+    mutable std::mutex mutex;
+    std::vector<Segment> segments;
+    SegmentId next_segment = 1;
+    SegmentId first_appended = std::numeric_limits<SegmentId>::max();
+    bool replayed_all = false;
+    std::unique_ptr<MappedFile> active;
+    size_t active_offset = 0;
+    size_t synced_offset = 0;
+    size_t unsynced = 0;
+
+    static size_t aligned(size_t size)
+    {
+        return (size + 7) & ~size_t(7);
+    }
+
+    // checksum of the type, size and time in the header and the payload
+    static uint32_t record_checksum(const char* header, const char* payload, size_t size)
+    {
+        uint32_t crc = crc32(0, header + 4, 8);
+        crc = crc32(crc, header + 16, 8);
+        return crc32(crc, payload, size);
+    }
+
+    std::string segment_file(SegmentId id) const
+    {
+        auto number = std::to_string(id);
+        return config.path + "." + std::string(number.size() < 8 ? 8 - number.size() : 0, '0') + number + SUFFIX;
+    }
+
+    Segment* find_segment(SegmentId id)
+    {
+        auto it = std::lower_bound(segments.begin(), segments.end(), id,
+            [](const Segment& s, SegmentId id){ return s.id < id; });
+        return it != segments.end() && it->id == id ? &*it : nullptr;
+    }
+
+    // Continue in a new segment with space for at least size bytes
+    void rotate(size_t size)
+    {
+        sync_active();
+        active.reset();
+
+        auto id = next_segment++;
+        active = std::make_unique<MappedFile>(segment_file(id), std::max(config.segment_size, size));
+        segments.push_back({id});
+        first_appended = std::min(first_appended, id);
+        active_offset = 0;
+        synced_offset = 0;
+        collect();
+    }
+
+    void sync_active()
+    {
+        if(active)
+            active->sync(synced_offset, active_offset - synced_offset);
+        synced_offset = active_offset;
+        unsynced = 0;
+    }
+
+    // Delete the oldest segments without retained records, except the active one
+    void collect()
+    {
+        if(!replayed_all)
+            return;
+
+        size_t deleted = 0;
+        while(deleted < segments.size() && segments[deleted].retained == 0 &&
+            !(active && segments[deleted].id == segments.back().id))
+        {
+            std::error_code ec;
+            std::filesystem::remove(segment_file(segments[deleted].id), ec);
+            deleted++;
+        }
+        segments.erase(segments.begin(), segments.begin() + deleted);
+    }
+};
+
+} // bw::webthing
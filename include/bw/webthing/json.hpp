@@ -14,4 +14,30 @@ namespace bw::webthing {
     typedef nlohmann::ordered_json json;
 #endif
 
+// Approximate number of bytes a json value occupies in memory
+inline size_t json_storage_size(const json& j)
+{
+    size_t size = sizeof(json);
+    switch(j.type())
+    {
+        case json::value_t::string:
+            size += j.get_ref<const json::string_t&>().size();
+            break;
+        case json::value_t::binary:
+            size += j.get_binary().size();
+            break;
+        case json::value_t::array:
+            for(const auto& element : j)
+                size += json_storage_size(element);
+            break;
+        case json::value_t::object:
+            for(auto it = j.begin(); it != j.end(); ++it)
+                size += it.key().size() + json_storage_size(it.value());
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
 } // bw::webthing
\ No newline at end of file
@@ -0,0 +1,133 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <bw/webthing/json.hpp>
+
+#ifdef WT_USE_SIMDJSON
+#include <simdjson.h>
+#endif
+
+namespace bw::webthing {
+
+// Members of a json object in order of appearance
+typedef std::vector<std::pair<std::string, json>> JsonObjectMembers;
+
+#ifdef WT_USE_SIMDJSON
+
+// Get the simdjson on-demand document of payload. The parser and the padded
+// input buffer are reused per thread, so the document is only valid until
+// the next call of this function on the same thread.
+inline simdjson::ondemand::document& simdjson_iterate(std::string_view payload)
+{
+    thread_local simdjson::ondemand::parser parser;
+    thread_local std::string buffer;
+    thread_local simdjson::ondemand::document document;
+
+    buffer.reserve(payload.size() + simdjson::SIMDJSON_PADDING);
+    buffer.assign(payload);
+    document = parser.iterate(buffer.data(), buffer.size(), buffer.capacity());
+    return document;
+}
+
+// Convert a simdjson on-demand value into json.
+// Numbers are classified the same way nlohmann::json::parse does.
+template<class Value>
+json simdjson_to_json(Value&& value)
+{
+    switch(value.type())
+    {
+        case simdjson::ondemand::json_type::object:
+        {
+            json object = json::object();
+            for(simdjson::ondemand::field field : value.get_object())
+                object[std::string(std::string_view(field.unescaped_key()))] = simdjson_to_json(field.value());
+            return object;
+        }
+        case simdjson::ondemand::json_type::array:
+        {
+            json array = json::array();
+            for(simdjson::ondemand::value element : value.get_array())
+                array.push_back(simdjson_to_json(element));
+            return array;
+        }
+        case simdjson::ondemand::json_type::number:
+            switch(value.get_number_type())
+            {
+                case simdjson::ondemand::number_type::signed_integer:
+                {
+                    int64_t number = value.get_int64();
+                    if(number >= 0)
+                        return json(static_cast<uint64_t>(number));
+                    return json(number);
+                }
+                case simdjson::ondemand::number_type::unsigned_integer:
+                    return json(uint64_t(value.get_uint64()));
+                case simdjson::ondemand::number_type::floating_point_number:
+                    return json(double(value.get_double()));
+                default:
+                    // integers exceeding 64 bit are represented as floating point numbers
+                    return json::parse(std::string_view(value.raw_json_token()));
+            }
+        case simdjson::ondemand::json_type::string:
+            return std::string(std::string_view(value.get_string()));
+        case simdjson::ondemand::json_type::boolean:
+            return bool(value.get_bool());
+        case simdjson::ondemand::json_type::null:
+            // the literal is only validated when queried
+            if(!value.is_null())
+                throw simdjson::simdjson_error(simdjson::INCORRECT_TYPE);
+            return nullptr;
+        default:
+            throw simdjson::simdjson_error(simdjson::INCORRECT_TYPE);
+    }
+}
+
+// Throw if the document contains anything after the consumed json value
+inline void simdjson_require_end(simdjson::ondemand::document& document)
+{
+    if(!document.at_end())
+        throw simdjson::simdjson_error(simdjson::TRAILING_CONTENT);
+}
+
+#endif
+
+// Parse the members of the serialized json object payload.
+// Returns std::nullopt if payload is valid json, but no object.
+// Throws a std::exception if payload is no valid json.
+inline std::optional<JsonObjectMembers> parse_json_object_members(std::string_view payload)
+{
+    JsonObjectMembers members;
+
+#ifdef WT_USE_SIMDJSON
+    auto& document = simdjson_iterate(payload);
+    if(document.type() != simdjson::ondemand::json_type::object)
+    {
+        simdjson_to_json(document);
+        simdjson_require_end(document);
+        return std::nullopt;
+    }
+
+    for(simdjson::ondemand::field field : document.get_object())
+        members.emplace_back(std::string_view(field.unescaped_key()), simdjson_to_json(field.value()));
+    simdjson_require_end(document);
+#else
+    json j = json::parse(payload);
+    if(!j.is_object())
+        return std::nullopt;
+
+    for(auto& member : j.items())
+        members.emplace_back(member.key(), std::move(member.value()));
+#endif
+
+    return members;
+}
+
+} // bw::webthing
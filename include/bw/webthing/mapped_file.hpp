@@ -0,0 +1,203 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bw::webthing {
+
+// CRC-32 (IEEE 802.3) of data, continuing the checksum crc
+inline uint32_t crc32(uint32_t crc, const void* data, size_t size)
+{
+    static const auto table = []{
+        std::array<uint32_t, 256> table;
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    auto bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++)
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// A file mapped into memory, either writable with a fixed size or read-only
+class MappedFile
+{
+public:
+    // Map file read-only, an empty or missing file is mapped with size 0
+    explicit MappedFile(const std::string& file)
+    {
+        open(file, 0, false);
+    }
+
+    // Create file with size bytes and map it writable
+    MappedFile(const std::string& file, size_t size)
+    {
+        open(file, size, true);
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    char* data()
+    {
+        return memory;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    // Write the mapped range back to disk and wait until it was written
+    void sync(size_t offset, size_t count)
+    {
+        if(!memory || count == 0)
+            return;
+
+        #ifdef _WIN32
+        FlushViewOfFile(memory + offset, count);
+        FlushFileBuffers(file_handle);
+        #else
+        static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t start = offset - offset % page_size;
+        msync(memory + start, offset + count - start, MS_SYNC);
+        #endif
+    }
+
+private:
+    char* memory = nullptr;
+    size_t length = 0;
+
+    #ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+
+    void open(const std::string& file, size_t size, bool writable)
+    {
+        file_handle = CreateFileA(file.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file_handle == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Could not open journal file: " + file);
+
+        if(!writable)
+        {
+            LARGE_INTEGER file_size;
+            if(!GetFileSizeEx(file_handle, &file_size))
+            {
+                close();
+                throw std::runtime_error("Could not read size of journal file: " + file);
+            }
+            size = static_cast<size_t>(file_size.QuadPart);
+        }
+        if(size == 0)
+            return;
+
+        uint64_t mapping_size = size;
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+            static_cast<DWORD>(mapping_size >> 32), static_cast<DWORD>(mapping_size & 0xffffffff), nullptr);
+        if(!mapping_handle)
+        {
+            close();
+            throw std::runtime_error("Could not map journal file: " + file);
+        }
+
+        memory = static_cast<char*>(MapViewOfFile(mapping_handle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+        if(!memory)
+        {
+            close();
+            throw std::runtime_error("Could not map journal file: " + file);
+        }
+        length = size;
+    }
+
+    void close()
+    {
+        if(memory)
+            UnmapViewOfFile(memory);
+        if(mapping_handle)
+            CloseHandle(mapping_handle);
+        if(file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+        memory = nullptr;
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+    #else
+    int fd = -1;
+
+    void open(const std::string& file, size_t size, bool writable)
+    {
+        fd = ::open(file.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+        if(fd < 0)
+            throw std::runtime_error("Could not open journal file: " + file);
+
+        if(writable && ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            close();
+            throw std::runtime_error("Could not allocate journal file: " + file);
+        }
+
+        if(!writable)
+        {
+            struct stat file_stat;
+            if(fstat(fd, &file_stat) != 0)
+            {
+                close();
+                throw std::runtime_error("Could not read size of journal file: " + file);
+            }
+            size = static_cast<size_t>(file_stat.st_size);
+        }
+        if(size == 0)
+            return;
+
+        void* mapped = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if(mapped == MAP_FAILED)
+        {
+            close();
+            throw std::runtime_error("Could not map journal file: " + file);
+        }
+        memory = static_cast<char*>(mapped);
+        length = size;
+    }
+
+    void close()
+    {
+        if(memory)
+            munmap(memory, length);
+        if(fd >= 0)
+            ::close(fd);
+        memory = nullptr;
+        fd = -1;
+    }
+    #endif
+};
+
+} // bw::webthing
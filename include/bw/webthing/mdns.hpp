@@ -10,6 +10,15 @@
 // Link with Iphlpapi.lib
 #pragma comment(lib, "IPHLPAPI.lib")
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <mdns.h>
 #include <bw/webthing/utils.hpp>
 
@@ -19,6 +28,8 @@
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <netdb.h>
+#include <poll.h>
+#include <cerrno>
 #endif
 
 namespace bw::webthing
@@ -31,21 +42,6 @@ static void mdns_log(std::string msg)
 
 const static int MAX_HOST_SIZE = 1025;
 
-static char addrbuffer[64];
-static char entrybuffer[256];
-static char namebuffer[256];
-static char sendbuffer[1024];
-static mdns_record_txt_t txtbuffer[128];
-
-static struct sockaddr_in service_address_ipv4;
-static struct sockaddr_in6 service_address_ipv6;
-
-static int has_ipv4;
-static int has_ipv6;
-
-static int is_tls_server;
-
-
 static mdns_string_t ipv4_address_to_string(char* buffer, size_t capacity, const struct sockaddr_in* addr,
                     size_t addrlen) {
     char host[MAX_HOST_SIZE] = {0};
@@ -196,30 +192,376 @@ static std::vector<std::string> get_addresses()
     return ips;
 }
 
+// Answers DNS-SD and mDNS queries for any number of service instances from
+// a single socket set. Queries are answered on a responder thread, which
+// sleeps until a query arrives or the responder is destroyed. The records
+// are indexed by name, so each query is answered with a single lookup.
+class MdnsResponder
+{
+public:
+    typedef uint64_t InstanceId;
+
+    // The responder shared by all services of the process, created on first
+    // use and destroyed once the last service released it
+    static std::shared_ptr<MdnsResponder> get_shared()
+    {
+        static std::mutex shared_mutex;
+        static std::weak_ptr<MdnsResponder> shared;
 
+        std::scoped_lock<std::mutex> lock(shared_mutex);
+        auto responder = shared.lock();
+        if(!responder)
+        {
+            responder = std::make_shared<MdnsResponder>();
+            shared = responder;
+        }
+        return responder;
+    }
+
+    // Open the sockets and start answering queries
+    MdnsResponder()
+    {
+        num_sockets = open_service_sockets(sockets, MAX_SOCKETS, address_ipv4, address_ipv6);
+        if(num_sockets <= 0)
+        {
+            mdns_log("Failed to open any client sockets");
+            return;
+        }
+        mdns_log("Opened " + std::to_string(num_sockets) + " socket" + std::string(num_sockets ? "s" : "") + " for mDNS service");
+
+        wakeup_socket = open_wakeup_socket(wakeup_address);
+        if(wakeup_socket < 0)
+        {
+            mdns_log("Failed to open wakeup socket");
+            close_sockets();
+            return;
+        }
+
+        run_requested = true;
+        responder = std::thread([this]{ respond(); });
+    }
+
+    MdnsResponder(const MdnsResponder& other) = delete;
+
+    // Say goodbye for the remaining instances and close the sockets
+    ~MdnsResponder()
+    {
+        if(responder.joinable())
+        {
+            run_requested = false;
+            const char signal = 1;
+            sendto(wakeup_socket, &signal, 1, 0, reinterpret_cast<const struct sockaddr*>(&wakeup_address),
+                sizeof(wakeup_address));
+            responder.join();
+        }
+
+        for(auto& entry : instances)
+            send_goodbye(*entry.second);
+        close_sockets();
+    }
+
+    // Advertise a service instance "<name>.<service>" at "<hostname>.local." and
+    // announce it, the name is made unique among the instances of the responder
+    InstanceId add_instance(std::string name, std::string service, std::string hostname, int port,
+        std::string path, bool tls)
+    {
+        if(service.empty())
+            throw std::invalid_argument("Invalid service name");
+        if(service.back() != '.')
+            service += '.';
+
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto instance = std::make_unique<Instance>();
+        instance->service = std::move(service);
+        instance->instance = name + "." + instance->service;
+        for(int n = 2; index.count(instance->instance); n++)
+            instance->instance = name + "-" + std::to_string(n) + "." + instance->service;
+        instance->hostname_qualified = hostname + ".local.";
+        instance->path = std::move(path);
+        instance->port = port;
+        instance->tls = tls;
+
+        auto& host = acquire(hosts, instance->hostname_qualified);
+        auto& service_type = acquire(service_types, instance->service);
+        if(host.references == 1)
+            build_host_answers(host);
+        if(service_type.references == 1)
+            build_service_type_answer(service_type);
+        build_instance_answers(*instance, host);
+
+        index_answer(instance->ptr_answer);
+        index_answer(instance->srv_answer);
+
+        mdns_log("Service mDNS: " + instance->instance + ":" + std::to_string(instance->port));
+        mdns_log("Sending announce");
+        for(int isock = 0; isock < num_sockets; ++isock)
+            mdns_announce_multicast(sockets[isock], buffer, sizeof(buffer), instance->ptr_answer.record, 0, 0,
+                instance->ptr_answer.additional, instance->ptr_answer.additional_count);
+
+        auto id = next_instance_id++;
+        instances[id] = std::move(instance);
+        return id;
+    }
+
+    // Say goodbye for a service instance and stop answering queries about it
+    void remove_instance(InstanceId id)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto it = instances.find(id);
+        if(it == instances.end())
+            return;
+
+        auto& instance = *it->second;
+        send_goodbye(instance);
+        unindex_answer(instance.ptr_answer);
+        unindex_answer(instance.srv_answer);
+        release(hosts, instance.hostname_qualified, [this](Host& host){
+            unindex_answer(host.a_answer);
+            unindex_answer(host.aaaa_answer);
+        });
+        release(service_types, instance.service, [this](ServiceType& service_type){
+            unindex_answer(service_type.dns_sd_answer);
+        });
+        instances.erase(it);
+    }
+
+    // Name of the instance, e.g. "<name>-2._webthing._tcp.local." if the name was taken
+    std::string get_instance_name(InstanceId id) const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto it = instances.find(id);
+        return it != instances.end() ? it->second->instance : "";
+    }
+
+    size_t instance_count() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return instances.size();
+    }
+
+    bool is_running() const
+    {
+        return responder.joinable();
+    }
+
+private:
+    const static int MAX_SOCKETS = 32;
+    inline static const std::string DNS_SD = "_services._dns-sd._udp.local.";
+
+    // An answer record with its additional records, built once when added
+    struct Answer
+    {
+        mdns_record_t record;
+        mdns_record_t additional[5] = {};
+        size_t additional_count = 0;
+
+        void add(const mdns_record_t& r)
+        {
+            additional[additional_count++] = r;
+        }
+    };
+
+    // The records only refer to the strings of the structures below, which
+    // stay unchanged while they are indexed
+
+    struct Instance
+    {
+        std::string service;
+        std::string instance;
+        std::string hostname_qualified;
+        std::string path;
+        int port = 0;
+        bool tls = false;
+        // PTR "<service>" -> "<instance>" with SRV, A/AAAA and TXT records
+        Answer ptr_answer;
+        // SRV "<instance>" -> "<hostname>.local." with A/AAAA and TXT records
+        Answer srv_answer;
+    };
+
+    struct Host
+    {
+        std::string name;
+        size_t references = 0;
+        Answer a_answer;
+        Answer aaaa_answer;
+    };
+
+    struct ServiceType
+    {
+        std::string name;
+        size_t references = 0;
+        // PTR "_services._dns-sd._udp.local." -> "<service>"
+        Answer dns_sd_answer;
+    };
+
+    std::atomic<bool> run_requested = false;
+    std::thread responder;
+
+    int sockets[MAX_SOCKETS];
+    int num_sockets = 0;
+    int wakeup_socket = -1;
+    struct sockaddr_in wakeup_address;
+    struct sockaddr_in address_ipv4;
+    struct sockaddr_in6 address_ipv6;
+
+    // guards the records, the index and the buffers
+    mutable std::mutex mutex;
+    char buffer[2048];
+    char name_buffer[256];
+    std::string query_name;
+
+    InstanceId next_instance_id = 1;
+    std::unordered_map<InstanceId, std::unique_ptr<Instance>> instances;
+    std::unordered_map<std::string, std::unique_ptr<Host>> hosts;
+    std::unordered_map<std::string, std::unique_ptr<ServiceType>> service_types;
+    // answers by the name of their record
+    std::unordered_map<std::string, std::vector<const Answer*>> index;
+
+    template<class T> static T& acquire(std::unordered_map<std::string, std::unique_ptr<T>>& shared, const std::string& name)
+    {
+        auto& entry = shared[name];
+        if(!entry)
+        {
+            entry = std::make_unique<T>();
+            entry->name = name;
+        }
+        entry->references++;
+        return *entry;
+    }
+
+    template<class T, class F> static void release(std::unordered_map<std::string, std::unique_ptr<T>>& shared,
+        const std::string& name, F&& on_unused)
+    {
+        auto it = shared.find(name);
+        if(it == shared.end() || --it->second->references > 0)
+            return;
+        on_unused(*it->second);
+        shared.erase(it);
+    }
+
+    void index_answer(const Answer& answer)
+    {
+        index[std::string(answer.record.name.str, answer.record.name.length)].push_back(&answer);
+    }
+
+    void unindex_answer(const Answer& answer)
+    {
+        auto it = index.find(std::string(answer.record.name.str, answer.record.name.length));
+        if(it == index.end())
+            return;
+        auto& answers = it->second;
+        answers.erase(std::remove(answers.begin(), answers.end(), &answer), answers.end());
+        if(answers.empty())
+            index.erase(it);
+    }
+
+    static mdns_string_t to_mdns_string(const std::string& str)
+    {
+        return mdns_string_t{str.c_str(), str.size()};
+    }
+
+    static mdns_record_t make_record(const std::string& name, mdns_record_type_t type, mdns_record_t::mdns_record_data data)
+    {
+        mdns_record_t record;
+        record.name = to_mdns_string(name);
+        record.type = type;
+        record.data = data;
+        record.rclass = 0;
+        record.ttl = 0;
+        return record;
+    }
+
+    bool has_ipv4() const
+    {
+        return address_ipv4.sin_family == AF_INET;
+    }
+
+    bool has_ipv6() const
+    {
+        return address_ipv6.sin6_family == AF_INET6;
+    }
+
+    // A/AAAA records mapping "<hostname>.local." to IPv4/IPv6 addresses
+    void build_host_answers(Host& host)
+    {
+        mdns_record_t::mdns_record_data rd_a;
+        rd_a.a = {address_ipv4};
+        mdns_record_t::mdns_record_data rd_aaaa;
+        rd_aaaa.aaaa = {address_ipv6};
+
+        host.a_answer = {make_record(host.name, MDNS_RECORDTYPE_A, rd_a)};
+        host.aaaa_answer = {make_record(host.name, MDNS_RECORDTYPE_AAAA, rd_aaaa)};
+        if(has_ipv4() && has_ipv6())
+        {
+            host.a_answer.add(host.aaaa_answer.record);
+            host.aaaa_answer.add(host.a_answer.record);
+        }
+        if(has_ipv4())
+            index_answer(host.a_answer);
+        if(has_ipv6())
+            index_answer(host.aaaa_answer);
+    }
+
+    // PTR record reverse mapping "_services._dns-sd._udp.local." to "<_service-name>._tcp.local."
+    void build_service_type_answer(ServiceType& service_type)
+    {
+        mdns_record_t::mdns_record_data rd_ptr;
+        rd_ptr.ptr = {to_mdns_string(service_type.name)};
+        service_type.dns_sd_answer = {make_record(DNS_SD, MDNS_RECORDTYPE_PTR, rd_ptr)};
+        index_answer(service_type.dns_sd_answer);
+    }
+
+    void build_instance_answers(Instance& instance, const Host& host)
+    {
+        // PTR record reverse mapping "<_service-name>._tcp.local." to
+        // "<hostname>.<_service-name>._tcp.local."
+        mdns_record_t::mdns_record_data rd_ptr;
+        rd_ptr.ptr = {to_mdns_string(instance.instance)};
+        mdns_record_t ptr_rec = make_record(instance.service, MDNS_RECORDTYPE_PTR, rd_ptr);
+
+        // SRV record mapping "<hostname>.<_service-name>._tcp.local." to
+        // "<hostname>.local." with port. Set weight & priority to 0.
+        mdns_record_t::mdns_record_data rd_srv;
+        rd_srv.srv = {0, 0, static_cast<uint16_t>(instance.port), to_mdns_string(host.name)};
+        mdns_record_t srv_rec = make_record(instance.instance, MDNS_RECORDTYPE_SRV, rd_srv);
+
+        // TXT records for our service instance name, will be coalesced into
+        // one record with both key-value pair strings by the library
+        mdns_record_t::mdns_record_data rd_path;
+        rd_path.txt = {{MDNS_STRING_CONST("path")}, to_mdns_string(instance.path)};
+        mdns_record_t path_rec = make_record(instance.instance, MDNS_RECORDTYPE_TXT, rd_path);
+
+        mdns_record_t::mdns_record_data rd_tls;
+        rd_tls.txt = {{MDNS_STRING_CONST("tls")}, {MDNS_STRING_CONST("1")}};
+        mdns_record_t tls_rec = make_record(instance.instance, MDNS_RECORDTYPE_TXT, rd_tls);
+
+        auto add_host_and_txt = [&](Answer& answer)
+        {
+            if(has_ipv4())
+                answer.add(host.a_answer.record);
+            if(has_ipv6())
+                answer.add(host.aaaa_answer.record);
+            answer.add(path_rec);
+            if(instance.tls)
+                answer.add(tls_rec);
+        };
+
+        instance.ptr_answer = {ptr_rec};
+        instance.ptr_answer.add(srv_rec);
+        add_host_and_txt(instance.ptr_answer);
+
+        instance.srv_answer = {srv_rec};
+        add_host_and_txt(instance.srv_answer);
+    }
+
+    void send_goodbye(const Instance& instance)
+    {
+        mdns_log("Sending goodbye for " + instance.instance);
+        for(int isock = 0; isock < num_sockets; ++isock)
+            mdns_goodbye_multicast(sockets[isock], buffer, sizeof(buffer), instance.ptr_answer.record, 0, 0,
+                instance.ptr_answer.additional, instance.ptr_answer.additional_count);
+    }
 
-struct MdnsService
-{
-    volatile bool run_requested = false;
-    volatile bool running = false;
-    
-    // Data for our service including the mDNS records
-    typedef struct {
-        mdns_string_t service;
-        mdns_string_t hostname;
-        mdns_string_t service_instance;
-        mdns_string_t hostname_qualified;
-        struct sockaddr_in address_ipv4;
-        struct sockaddr_in6 address_ipv6;
-        int port;
-        mdns_record_t record_ptr;
-        mdns_record_t record_srv;
-        mdns_record_t record_a;
-        mdns_record_t record_aaaa;
-        mdns_record_t txt_record[2];
-    } service_t;
-    
-   
     // Callback handling questions incoming on service sockets
     static int service_callback(int sock, const struct sockaddr* from, size_t addrlen, mdns_entry_type_t entry,
                     uint16_t query_id, uint16_t ui16_rtype, uint16_t rclass, uint32_t ttl, const void* data,
@@ -229,233 +571,43 @@ struct MdnsService
         if (entry != MDNS_ENTRYTYPE_QUESTION)
             return 0;
 
+        auto self = static_cast<MdnsResponder*>(user_data);
         mdns_record_type rtype = static_cast<mdns_record_type>(ui16_rtype);
 
-        const char dns_sd[] = "_services._dns-sd._udp.local.";
-        const service_t* service = (const service_t*)user_data;
-
-        mdns_string_t fromaddrstr = ip_address_to_string(addrbuffer, sizeof(addrbuffer), from, addrlen);
-
         size_t offset = name_offset;
-        mdns_string_t name = mdns_string_extract(data, size, &offset, namebuffer, sizeof(namebuffer));
-
-        const char* record_name = 0;
-        if (rtype == MDNS_RECORDTYPE_PTR)
-            record_name = "PTR";
-        else if (rtype == MDNS_RECORDTYPE_SRV)
-            record_name = "SRV";
-        else if (rtype == MDNS_RECORDTYPE_A)
-            record_name = "A";
-        else if (rtype == MDNS_RECORDTYPE_AAAA)
-            record_name = "AAAA";
-        else if (rtype == MDNS_RECORDTYPE_TXT)
-            record_name = "TXT";
-        else if (rtype == MDNS_RECORDTYPE_ANY)
-            record_name = "ANY";
-        else
+        mdns_string_t name = mdns_string_extract(data, size, &offset, self->name_buffer, sizeof(self->name_buffer));
+
+        // the query name is reused, so the lookup does not allocate
+        self->query_name.assign(name.str, name.length);
+        auto it = self->index.find(self->query_name);
+        if(it == self->index.end())
             return 0;
-        mdns_log("Query " + std::string(record_name) + " " +  std::string(name.str));
-
-        if ((name.length == (sizeof(dns_sd) - 1)) &&
-            (strncmp(name.str, dns_sd, sizeof(dns_sd) - 1) == 0)) {
-            if ((rtype == MDNS_RECORDTYPE_PTR) || (rtype == MDNS_RECORDTYPE_ANY)) {
-                // The PTR query was for the DNS-SD domain, send answer with a PTR record for the
-                // service name we advertise, typically on the "<_service-name>._tcp.local." format
-
-                // Answer PTR record reverse mapping "<_service-name>._tcp.local." to
-                // "<hostname>.<_service-name>._tcp.local."
-                mdns_record_t answer = {
-                    name, MDNS_RECORDTYPE_PTR, {service->service}};
-
-                // Send the answer, unicast or multicast depending on flag in query
-                uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
-                mdns_log("  --> answer " + std::string(answer.data.ptr.name.str) + " " + 
-                    std::string(unicast ? "unicast" : "multicast"));
-
-                if (unicast) {
-                    mdns_query_answer_unicast(sock, from, addrlen, sendbuffer, sizeof(sendbuffer),
-                                            query_id, rtype, name.str, name.length, answer, 0, 0, 0,
-                                            0);
-                } else {
-                    mdns_query_answer_multicast(sock, sendbuffer, sizeof(sendbuffer), answer, 0, 0, 0,
-                                                0);
-                }
-            }
-        } else if ((name.length == service->service.length) &&
-                (strncmp(name.str, service->service.str, name.length) == 0)) {
-            if ((rtype == MDNS_RECORDTYPE_PTR) || (rtype == MDNS_RECORDTYPE_ANY)) {
-                // The PTR query was for our service (usually "<_service-name._tcp.local"), answer a PTR
-                // record reverse mapping the queried service name to our service instance name
-                // (typically on the "<hostname>.<_service-name>._tcp.local." format), and add
-                // additional records containing the SRV record mapping the service instance name to our
-                // qualified hostname (typically "<hostname>.local.") and port, as well as any IPv4/IPv6
-                // address for the hostname as A/AAAA records, and two test TXT records
-
-                // Answer PTR record reverse mapping "<_service-name>._tcp.local." to
-                // "<hostname>.<_service-name>._tcp.local."
-                mdns_record_t answer = service->record_ptr;
-
-                mdns_record_t additional[5] = {0};
-                size_t additional_count = 0;
-
-                // SRV record mapping "<hostname>.<_service-name>._tcp.local." to
-                // "<hostname>.local." with port. Set weight & priority to 0.
-                additional[additional_count++] = service->record_srv;
-
-                // A/AAAA records mapping "<hostname>.local." to IPv4/IPv6 addresses
-                if (service->address_ipv4.sin_family == AF_INET)
-                    additional[additional_count++] = service->record_a;
-                if (service->address_ipv6.sin6_family == AF_INET6)
-                    additional[additional_count++] = service->record_aaaa;
-
-                // Add two test TXT records for our service instance name, will be coalesced into
-                // one record with both key-value pair strings by the library
-                additional[additional_count++] = service->txt_record[0];
-                if(is_tls_server)
-                    additional[additional_count++] = service->txt_record[1];
-
-                // Send the answer, unicast or multicast depending on flag in query
-                uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
-                mdns_log("  --> answer " + std::string(service->record_ptr.data.ptr.name.str) + 
-                    " (" + std::string(unicast ? "unicast" : "multicast") + ")");
-
-                if (unicast) {
-                    mdns_query_answer_unicast(sock, from, addrlen, sendbuffer, sizeof(sendbuffer),
-                                            query_id, rtype, name.str, name.length, answer, 0, 0,
-                                            additional, additional_count);
-                } else {
-                    mdns_query_answer_multicast(sock, sendbuffer, sizeof(sendbuffer), answer, 0, 0,
-                                                additional, additional_count);
-                }
-            }
-        } else if ((name.length == service->service_instance.length) &&
-                (strncmp(name.str, service->service_instance.str, name.length) == 0)) {
-            if ((rtype == MDNS_RECORDTYPE_SRV) || (rtype == MDNS_RECORDTYPE_ANY)) {
-                // The SRV query was for our service instance (usually
-                // "<hostname>.<_service-name._tcp.local"), answer a SRV record mapping the service
-                // instance name to our qualified hostname (typically "<hostname>.local.") and port, as
-                // well as any IPv4/IPv6 address for the hostname as A/AAAA records, and two test TXT
-                // records
-
-                // Answer PTR record reverse mapping "<_service-name>._tcp.local." to
-                // "<hostname>.<_service-name>._tcp.local."
-                mdns_record_t answer = service->record_srv;
-
-                mdns_record_t additional[5] = {0};
-                size_t additional_count = 0;
-
-                // A/AAAA records mapping "<hostname>.local." to IPv4/IPv6 addresses
-                if (service->address_ipv4.sin_family == AF_INET)
-                    additional[additional_count++] = service->record_a;
-                if (service->address_ipv6.sin6_family == AF_INET6)
-                    additional[additional_count++] = service->record_aaaa;
-
-                // Add two test TXT records for our service instance name, will be coalesced into
-                // one record with both key-value pair strings by the library
-                additional[additional_count++] = service->txt_record[0];
-                if(is_tls_server)
-                    additional[additional_count++] = service->txt_record[1];
-
-                // Send the answer, unicast or multicast depending on flag in query
-                uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
-                mdns_log("  --> answer " + std::string(service->record_srv.data.srv.name.str) + 
-                    " port " + std::to_string(service->port) + " (" + (unicast ? "unicast" : "multicast") + ")");
-
-                if (unicast) {
-                    mdns_query_answer_unicast(sock, from, addrlen, sendbuffer, sizeof(sendbuffer),
-                                            query_id, rtype, name.str, name.length, answer, 0, 0,
-                                            additional, additional_count);
-                } else {
-                    mdns_query_answer_multicast(sock, sendbuffer, sizeof(sendbuffer), answer, 0, 0,
-                                                additional, additional_count);
-                }
-            }
-        } else if ((name.length == service->hostname_qualified.length) &&
-                (strncmp(name.str, service->hostname_qualified.str, name.length) == 0)) {
-            if (((rtype == MDNS_RECORDTYPE_A) || (rtype == MDNS_RECORDTYPE_ANY)) &&
-                (service->address_ipv4.sin_family == AF_INET)) {
-                // The A query was for our qualified hostname (typically "<hostname>.local.") and we
-                // have an IPv4 address, answer with an A record mappiing the hostname to an IPv4
-                // address, as well as any IPv6 address for the hostname, and two test TXT records
-
-                // Answer A records mapping "<hostname>.local." to IPv4 address
-                mdns_record_t answer = service->record_a;
-
-                mdns_record_t additional[5] = {0};
-                size_t additional_count = 0;
-
-                // AAAA record mapping "<hostname>.local." to IPv6 addresses
-                if (service->address_ipv6.sin6_family == AF_INET6)
-                    additional[additional_count++] = service->record_aaaa;
-
-                // Add two test TXT records for our service instance name, will be coalesced into
-                // one record with both key-value pair strings by the library
-                additional[additional_count++] = service->txt_record[0];
-                if(is_tls_server)
-                    additional[additional_count++] = service->txt_record[1];
-
-                // Send the answer, unicast or multicast depending on flag in query
-                uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
-                mdns_string_t addrstr = ip_address_to_string(
-                    addrbuffer, sizeof(addrbuffer), (struct sockaddr*)&service->record_a.data.a.addr,
-                    sizeof(service->record_a.data.a.addr));
-                mdns_log("  --> answer " + std::string(service->record_a.name.str) + 
-                    " IPv4 " + std::string(addrstr.str) + " (" + std::string(unicast ? "unicast" : "multicast") + ")");
-
-                if (unicast) {
-                    mdns_query_answer_unicast(sock, from, addrlen, sendbuffer, sizeof(sendbuffer),
-                                            query_id, rtype, name.str, name.length, answer, 0, 0,
-                                            additional, additional_count);
-                } else {
-                    mdns_query_answer_multicast(sock, sendbuffer, sizeof(sendbuffer), answer, 0, 0,
-                                                additional, additional_count);
-                }
-            } else if (((rtype == MDNS_RECORDTYPE_AAAA) || (rtype == MDNS_RECORDTYPE_ANY)) &&
-                    (service->address_ipv6.sin6_family == AF_INET6)) {
-                // The AAAA query was for our qualified hostname (typically "<hostname>.local.") and we
-                // have an IPv6 address, answer with an AAAA record mappiing the hostname to an IPv6
-                // address, as well as any IPv4 address for the hostname, and two test TXT records
-
-                // Answer AAAA records mapping "<hostname>.local." to IPv6 address
-                mdns_record_t answer = service->record_aaaa;
-
-                mdns_record_t additional[5] = {0};
-                size_t additional_count = 0;
-
-                // A record mapping "<hostname>.local." to IPv4 addresses
-                if (service->address_ipv4.sin_family == AF_INET)
-                    additional[additional_count++] = service->record_a;
-
-                // Add two test TXT records for our service instance name, will be coalesced into
-                // one record with both key-value pair strings by the library
-                additional[additional_count++] = service->txt_record[0];
-                if(is_tls_server)
-                    additional[additional_count++] = service->txt_record[1];
-
-                // Send the answer, unicast or multicast depending on flag in query
-                uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
-                mdns_string_t addrstr =
-                    ip_address_to_string(addrbuffer, sizeof(addrbuffer),
-                                        (struct sockaddr*)&service->record_aaaa.data.aaaa.addr,
-                                        sizeof(service->record_aaaa.data.aaaa.addr));
-                mdns_log("  --> answer " + std::string(service->record_aaaa.name.str) + 
-                    " IPv6 " + std::string(addrstr.str) + " (" + std::string(unicast ? "unicast" : "multicast") + ")");
-
-                if (unicast) {
-                    mdns_query_answer_unicast(sock, from, addrlen, sendbuffer, sizeof(sendbuffer),
-                                            query_id, rtype, name.str, name.length, answer, 0, 0,
-                                            additional, additional_count);
-                } else {
-                    mdns_query_answer_multicast(sock, sendbuffer, sizeof(sendbuffer), answer, 0, 0,
-                                                additional, additional_count);
-                }
+
+        // Send the answers, unicast or multicast depending on flag in query
+        uint16_t unicast = (rclass & MDNS_UNICAST_RESPONSE);
+        for(auto answer : it->second)
+        {
+            if(rtype != MDNS_RECORDTYPE_ANY && rtype != answer->record.type)
+                continue;
+
+            mdns_log("Query " + std::to_string(ui16_rtype) + " " + self->query_name +
+                " --> answer (" + std::string(unicast ? "unicast" : "multicast") + ")");
+
+            if (unicast) {
+                mdns_query_answer_unicast(sock, from, addrlen, self->buffer, sizeof(self->buffer),
+                                        query_id, rtype, name.str, name.length, answer->record, 0, 0,
+                                        answer->additional, answer->additional_count);
+            } else {
+                mdns_query_answer_multicast(sock, self->buffer, sizeof(self->buffer), answer->record, 0, 0,
+                                            answer->additional, answer->additional_count);
             }
         }
         return 0;
     }
 
     // Open sockets for sending one-shot multicast queries from an ephemeral port
-    static int open_client_sockets(int* sockets, int max_sockets, int port) {
+    static int open_client_sockets(int* sockets, int max_sockets, int port, struct sockaddr_in& address_ipv4,
+                                   struct sockaddr_in6& address_ipv6) {
         // When sending, each socket can only send to one network interface
         // Thus we need to open one socket for each interface and address family
         int num_sockets = 0;
@@ -503,11 +655,10 @@ struct MdnsService
                         (saddr->sin_addr.S_un.S_un_b.s_b4 != 1)) {
                         int log_addr = 0;
                         if (first_ipv4) {
-                            service_address_ipv4 = *saddr;
+                            address_ipv4 = *saddr;
                             first_ipv4 = 0;
                             log_addr = 1;
                         }
-                        has_ipv4 = 1;
                         if (num_sockets < max_sockets) {
                             saddr->sin_port = htons((unsigned short)port);
                             int sock = mdns_socket_open_ipv4(saddr);
@@ -539,11 +690,10 @@ struct MdnsService
                         memcmp(saddr->sin6_addr.s6_addr, localhost_mapped, 16)) {
                         int log_addr = 0;
                         if (first_ipv6) {
-                            service_address_ipv6 = *saddr;
+                            address_ipv6 = *saddr;
                             first_ipv6 = 0;
                             log_addr = 1;
                         }
-                        has_ipv6 = 1;
                         if (num_sockets < max_sockets) {
                             saddr->sin6_port = htons((unsigned short)port);
                             int sock = mdns_socket_open_ipv6(saddr);
@@ -590,11 +740,10 @@ struct MdnsService
                 if (saddr->sin_addr.s_addr != htonl(INADDR_LOOPBACK)) {
                     int log_addr = 0;
                     if (first_ipv4) {
-                        service_address_ipv4 = *saddr;
+                        address_ipv4 = *saddr;
                         first_ipv4 = 0;
                         log_addr = 1;
                     }
-                    has_ipv4 = 1;
                     if (num_sockets < max_sockets) {
                         saddr->sin_port = htons(port);
                         int sock = mdns_socket_open_ipv4(saddr);
@@ -625,11 +774,10 @@ struct MdnsService
                     memcmp(saddr->sin6_addr.s6_addr, localhost_mapped, 16)) {
                     int log_addr = 0;
                     if (first_ipv6) {
-                        service_address_ipv6 = *saddr;
+                        address_ipv6 = *saddr;
                         first_ipv6 = 0;
                         log_addr = 1;
                     }
-                    has_ipv6 = 1;
                     if (num_sockets < max_sockets) {
                         saddr->sin6_port = htons(port);
                         int sock = mdns_socket_open_ipv6(saddr);
@@ -658,14 +806,17 @@ struct MdnsService
     }
 
     // Open sockets to listen to incoming mDNS queries on port 5353
-    static int open_service_sockets(int* sockets, int max_sockets) {
+    static int open_service_sockets(int* sockets, int max_sockets, struct sockaddr_in& address_ipv4,
+                                    struct sockaddr_in6& address_ipv6) {
         // When recieving, each socket can recieve data from all network interfaces
         // Thus we only need to open one socket for each address family
         int num_sockets = 0;
 
         // Call the client socket function to enumerate and get local addresses,
         // but not open the actual sockets
-        open_client_sockets(0, 0, 0);
+        memset(&address_ipv4, 0, sizeof(struct sockaddr_in));
+        memset(&address_ipv6, 0, sizeof(struct sockaddr_in6));
+        open_client_sockets(0, 0, 0, address_ipv4, address_ipv6);
 
         if (num_sockets < max_sockets) {
             struct sockaddr_in sock_addr;
@@ -702,243 +853,120 @@ struct MdnsService
         return num_sockets;
     }
 
-
-
-    // Provide a mDNS service, answering incoming DNS-SD and mDNS queries
-    int service_mdns(const char* hostname, const char* service_name, int service_port, const char* path, bool tls)
+    // Open a loopback socket the responder is woken up with on destruction
+    static int open_wakeup_socket(struct sockaddr_in& address)
     {
-        running = true;
-
-        int sockets[32];
-        int num_sockets = open_service_sockets(sockets, sizeof(sockets) / sizeof(sockets[0]));
-        if (num_sockets <= 0) {
-            mdns_log("Failed to open any client sockets");
+        int sock = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(sock < 0)
             return -1;
-        }
-        mdns_log("Opened " + std::to_string(num_sockets) + " socket" + std::string(num_sockets ? "s" : "") + " for mDNS service");
 
-        size_t service_name_length = strlen(service_name);
-        if (!service_name_length) {
-            mdns_log("Invalid service name");
+        memset(&address, 0, sizeof(struct sockaddr_in));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+    #ifdef __APPLE__
+        address.sin_len = sizeof(struct sockaddr_in);
+    #endif
+        socklen_t length = sizeof(struct sockaddr_in);
+        if(bind(sock, (struct sockaddr*)&address, length) < 0 ||
+            getsockname(sock, (struct sockaddr*)&address, &length) < 0)
+        {
+            mdns_socket_close(sock);
             return -1;
         }
+        return sock;
+    }
 
-        char* service_name_buffer = (char*)malloc(service_name_length + 2);
-        memcpy(service_name_buffer, service_name, service_name_length);
-        if (service_name_buffer[service_name_length - 1] != '.')
-            service_name_buffer[service_name_length++] = '.';
-        service_name_buffer[service_name_length] = 0;
-        service_name = service_name_buffer;
-
-        mdns_log("Service mDNS: " + std::string(service_name) + ":" + std::to_string(service_port));
-        mdns_log("Hostname: " + std::string(hostname));
-
-        size_t capacity = 2048;
-        void* buffer = malloc(capacity);
-
-        mdns_string_t service_string = mdns_string_t{service_name, strlen(service_name)};
-        mdns_string_t hostname_string = mdns_string_t{hostname, strlen(hostname)};
-
-        // Build the service instance "<hostname>.<_service-name>._tcp.local." string
-        char service_instance_buffer[256] = {0};
-        snprintf(service_instance_buffer, sizeof(service_instance_buffer) - 1, "%.*s.%.*s",
-                MDNS_STRING_FORMAT(hostname_string), MDNS_STRING_FORMAT(service_string));
-        mdns_string_t service_instance_string =
-            mdns_string_t{service_instance_buffer, strlen(service_instance_buffer)};
-
-        // Build the "<hostname>.local." string
-        char qualified_hostname_buffer[256] = {0};
-        snprintf(qualified_hostname_buffer, sizeof(qualified_hostname_buffer) - 1, "%.*s.local.",
-                MDNS_STRING_FORMAT(hostname_string));
-        mdns_string_t hostname_qualified_string =
-            mdns_string_t{qualified_hostname_buffer, strlen(qualified_hostname_buffer)};
-
-        service_t service = {0};
-        service.service = service_string;
-        service.hostname = hostname_string;
-        service.service_instance = service_instance_string;
-        service.hostname_qualified = hostname_qualified_string;
-        service.address_ipv4 = service_address_ipv4;
-        service.address_ipv6 = service_address_ipv6;
-        service.port = service_port;
-
-        // Setup our mDNS records
-
-        // PTR record reverse mapping "<_service-name>._tcp.local." to
-        // "<hostname>.<_service-name>._tcp.local."
-        mdns_record_t::mdns_record_data rd_ptr;
-        rd_ptr.ptr = { service.service_instance };
-
-        mdns_record_t ptr_rec;
-        ptr_rec.name = service.service;
-        ptr_rec.type = MDNS_RECORDTYPE_PTR;
-        ptr_rec.data = rd_ptr;
-        ptr_rec.rclass = 0;
-        ptr_rec.ttl = 0;
-
-        service.record_ptr = ptr_rec;
-
-        // SRV record mapping "<hostname>.<_service-name>._tcp.local." to
-        // "<hostname>.local." with port. Set weight & priority to 0.
-        uint16_t p = service.port;
-        mdns_record_t::mdns_record_data rd_srv;
-        rd_srv.srv = { 0, 0, p, service.hostname_qualified};
-
-        mdns_record_t srv_rec;
-        srv_rec.name = service.service_instance;
-        srv_rec.type = MDNS_RECORDTYPE_SRV;
-        srv_rec.data = rd_srv;
-        srv_rec.rclass = 0;
-        srv_rec.ttl = 0;
-
-        service.record_srv = srv_rec;
-
-        // A/AAAA records mapping "<hostname>.local." to IPv4/IPv6 addresses
-        mdns_record_t::mdns_record_data rd_a;
-        rd_a.a = {service.address_ipv4};
-
-        mdns_record_t a_rec;
-        a_rec.name = service.hostname_qualified;
-        a_rec.type = MDNS_RECORDTYPE_A;
-        a_rec.data = rd_a;
-        a_rec.rclass = 0;
-        a_rec.ttl = 0;
-
-        service.record_a = a_rec;
-
-
-        mdns_record_t::mdns_record_data rd_aaaa;
-        rd_aaaa.aaaa = {service.address_ipv6};
-
-        mdns_record_t aaaa_rec;
-        aaaa_rec.name = service.hostname_qualified;
-        aaaa_rec.type = MDNS_RECORDTYPE_AAAA;
-        aaaa_rec.data = rd_aaaa;
-        aaaa_rec.rclass = 0;
-        aaaa_rec.ttl = 0;
-
-        service.record_aaaa = aaaa_rec;
-
-        // Add two test TXT records for our service instance name, will be coalesced into
-        // one record with both key-value pair strings by the library
-        mdns_record_t::mdns_record_data rd_path;
-        rd_path.txt = {{MDNS_STRING_CONST("path")},{path, std::strlen(path)}};
-
-        mdns_record_t path_rec;
-        path_rec.name = service.service_instance;
-        path_rec.type = MDNS_RECORDTYPE_TXT;
-        path_rec.data = rd_path;
-        path_rec.rclass = 0;
-        path_rec.ttl = 0;
-
-        service.txt_record[0] = path_rec;
-        
-        mdns_record_t::mdns_record_data rd_tls;
-        rd_tls.txt = {{MDNS_STRING_CONST("tls")},{MDNS_STRING_CONST(tls ? "1" : "0")}};
-        
-        mdns_record_t tls_rec;
-        tls_rec.name = service.service_instance;
-        tls_rec.type = MDNS_RECORDTYPE_TXT;
-        tls_rec.data = rd_tls;
-        tls_rec.rclass = 0;
-        tls_rec.ttl = 0;
+    void close_sockets()
+    {
+        for (int isock = 0; isock < num_sockets; ++isock)
+            mdns_socket_close(sockets[isock]);
+        num_sockets = 0;
 
-        service.txt_record[1] = tls_rec;
+        if(wakeup_socket >= 0)
+            mdns_socket_close(wakeup_socket);
+        wakeup_socket = -1;
+        mdns_log("Closed sockets");
+    }
 
-        // Send an announcement on startup of service
-        {
-            mdns_log("Sending announce");
-            mdns_record_t additional[5] = {0};
-            size_t additional_count = 0;
-            additional[additional_count++] = service.record_srv;
-            if (service.address_ipv4.sin_family == AF_INET)
-                additional[additional_count++] = service.record_a;
-            if (service.address_ipv6.sin6_family == AF_INET6)
-                additional[additional_count++] = service.record_aaaa;
-            additional[additional_count++] = service.txt_record[0];
-            if(is_tls_server)
-                additional[additional_count++] = service.txt_record[1];
-
-            for (int isock = 0; isock < num_sockets; ++isock)
-                mdns_announce_multicast(sockets[isock], buffer, capacity, service.record_ptr, 0, 0,
-                                        additional, additional_count);
-        }
+    // Wait without timeout until a query or the wakeup arrives
+    void respond()
+    {
+    #ifdef _WIN32
+        WSAPOLLFD fds[MAX_SOCKETS + 1];
+    #else
+        struct pollfd fds[MAX_SOCKETS + 1];
+    #endif
+        for (int isock = 0; isock < num_sockets; ++isock)
+            fds[isock] = {static_cast<decltype(fds[isock].fd)>(sockets[isock]), POLLIN, 0};
+        fds[num_sockets] = {static_cast<decltype(fds[num_sockets].fd)>(wakeup_socket), POLLIN, 0};
 
-        // This is a crude implementation that checks for incoming queries
         while (run_requested) {
-            int nfds = 0;
-            fd_set readfs;
-            FD_ZERO(&readfs);
+    #ifdef _WIN32
+            int ready = WSAPoll(fds, num_sockets + 1, -1);
+    #else
+            int ready = poll(fds, num_sockets + 1, -1);
+            if (ready < 0 && errno == EINTR)
+                continue;
+    #endif
+            if (ready < 0)
+                break;
+
+            std::scoped_lock<std::mutex> lock(mutex);
             for (int isock = 0; isock < num_sockets; ++isock) {
-                if (sockets[isock] >= nfds)
-                    nfds = sockets[isock] + 1;
-                FD_SET(sockets[isock], &readfs);
+                if (fds[isock].revents & POLLIN)
+                    mdns_socket_listen(sockets[isock], buffer, sizeof(buffer), service_callback, this);
             }
 
-            struct timeval timeout;
-            timeout.tv_sec = 0;
-            timeout.tv_usec = 100000;
-
-            if (select(nfds, &readfs, 0, 0, &timeout) >= 0) {
-                for (int isock = 0; isock < num_sockets; ++isock) {
-                    if (FD_ISSET(sockets[isock], &readfs)) {
-                        mdns_socket_listen(sockets[isock], buffer, capacity, service_callback,
-                                        &service);
-                    }
-                    FD_SET(sockets[isock], &readfs);
-                }
-            } else {
-                break;
+            if (fds[num_sockets].revents & POLLIN) {
+                char drain[16];
+                recv(wakeup_socket, drain, sizeof(drain), 0);
             }
         }
+    }
+};
 
-        // Send a goodbye on end of service
-        {
-            mdns_log("Sending goodbye");
-            mdns_record_t additional[5] = {0};
-            size_t additional_count = 0;
-            additional[additional_count++] = service.record_srv;
-            if (service.address_ipv4.sin_family == AF_INET)
-                additional[additional_count++] = service.record_a;
-            if (service.address_ipv6.sin6_family == AF_INET6)
-                additional[additional_count++] = service.record_aaaa;
-            additional[additional_count++] = service.txt_record[0];
-            if(is_tls_server)
-                additional[additional_count++] = service.txt_record[1];
-
-            for (int isock = 0; isock < num_sockets; ++isock)
-                mdns_goodbye_multicast(sockets[isock], buffer, capacity, service.record_ptr, 0, 0,
-                                        additional, additional_count);
-        }
-
-        free(buffer);
-        free(service_name_buffer);
+// Advertises a service instance, e.g. of a WebThingServer, via the
+// responder shared by all services of the process
+class MdnsService
+{
+public:
+    MdnsService() = default;
 
-        for (int isock = 0; isock < num_sockets; ++isock)
-            mdns_socket_close(sockets[isock]);
-        mdns_log("Closed socket" + std::string(num_sockets ? "s" : ""));
+    MdnsService(const MdnsService& other) = delete;
 
-        return 0;
+    ~MdnsService()
+    {
+        stop_service();
     }
 
-
     void start_service(std::string hostname, std::string service, int port, std::string path, bool tls)
     {
-        is_tls_server = tls;
-        run_requested = true;
-        service_mdns(hostname.c_str(), service.c_str(), port, path.c_str(), tls);
-        running = false;
+        if(responder)
+            return;
+
+        responder = MdnsResponder::get_shared();
+        instance = responder->add_instance(hostname, std::move(service), hostname, port, std::move(path), tls);
     }
 
+    // Say goodbye, the responder is closed with the last service of the process
     void stop_service()
     {
-        run_requested = false;
+        if(!responder)
+            return;
+
+        responder->remove_instance(instance);
+        responder.reset();
     }
 
-    bool is_running()
+    bool is_running() const
     {
-        return running;
+        return responder && responder->is_running();
     }
+
+private:
+    std::shared_ptr<MdnsResponder> responder;
+    MdnsResponder::InstanceId instance = 0;
 };
 
 } // bw::webthing
\ No newline at end of file
@@ -0,0 +1,184 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bw/webthing/content_format.hpp>
+#include <bw/webthing/json.hpp>
+#include <bw/webthing/storage.hpp>
+
+namespace bw::webthing {
+
+// A bounded log of the latest messages a thing published. Every message gets
+// a sequence number assigned, which enables clients to detect and request
+// messages they have missed, e.g. while reconnecting.
+class MessageLog
+{
+public:
+    typedef std::vector<std::string> Topics;
+    typedef std::function<void (const Topics& /*topics*/, const std::string& /*message*/)> MessageConsumer;
+
+    struct Entry
+    {
+        uint64_t sequence;
+        Topics topics;
+        std::string message;
+    };
+
+    MessageLog(size_t max_size = 1000)
+        : entries(max_size)
+    {}
+
+    // Assign the next sequence number to the serialized json object message
+    // and store it in the log. The sequenced message is passed to publish while
+    // the log is locked, so the publish order always matches the sequence order.
+    uint64_t add(Topics topics, std::string message, const MessageConsumer& publish = nullptr)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+
+        ++sequence;
+        if(!message.empty() && message.back() == '}')
+        {
+            message.pop_back();
+            message += (message.size() > 1 ? ",\"sequence\":" : "\"sequence\":") + std::to_string(sequence) + "}";
+        }
+
+        if(publish)
+            publish(topics, message);
+
+        entries.add({sequence, std::move(topics), std::move(message)});
+
+        return sequence;
+    }
+
+    // Pass all messages with a sequence number greater than since to the consumer.
+    // Returns false without calling the consumer when some of these messages
+    // are not retained any longer or since is unknown to this log.
+    bool replay(uint64_t since, const MessageConsumer& consumer) const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+
+        if(since > sequence)
+            return false;
+
+        uint64_t oldest_retained = entries.size() > 0 ? entries.get(0).sequence : sequence + 1;
+        if(since + 1 < oldest_retained)
+            return false;
+
+        for(const auto& entry : entries)
+            if(entry.sequence > since)
+                consumer(entry.topics, entry.message);
+
+        return true;
+    }
+
+    // Execute callback with the current sequence number while no new
+    // messages can be added, e.g. to create a consistent snapshot.
+    void with_current_sequence(const std::function<void (uint64_t)>& callback) const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        callback(sequence);
+    }
+
+    uint64_t get_sequence() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return sequence;
+    }
+
+    // Drop all retained messages, e.g. of a removed thing. Sequence numbers
+    // continue, clients requesting dropped messages get a snapshot instead.
+    void clear()
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        entries.remove_if([](const Entry&){ return true; });
+    }
+
+private:
+    uint64_t sequence = 0;
+    FlexibleRingBuffer<Entry> entries;
+    mutable std::mutex mutex;
+};
+
+// Collects the latest value of each property from property status messages
+// that could not be delivered, to send them as one combined message later on.
+class PropertyStatusConflation
+{
+public:
+    // Conflate a serialized message.
+    // Returns false if the message is no property status message.
+    bool add(std::string_view message, ContentFormat format = ContentFormat::json)
+    {
+        json j;
+        try
+        {
+            j = decode(message, format);
+        }
+        catch(json::exception&)
+        {
+            return false;
+        }
+
+        if(!j.is_object() || j.value("messageType", "") != "propertyStatus" ||
+            !j.contains("data") || !j["data"].is_object())
+            return false;
+
+        for(auto& property_entry : j["data"].items())
+            data[property_entry.key()] = std::move(property_entry.value());
+
+        if(j.contains("sequence"))
+            sequence = j["sequence"];
+
+        return true;
+    }
+
+    // Forget the conflated values of properties contained in a property status
+    // message that was delivered after them, as they are outdated now.
+    void discard(const json& message)
+    {
+        if(message.value("messageType", "") != "propertyStatus" ||
+            !message.contains("data") || !message["data"].is_object())
+            return;
+
+        for(auto& property_entry : message["data"].items())
+            data.erase(property_entry.key());
+
+        // the remaining values are taken after the delivered message
+        if(data.empty())
+            sequence = std::nullopt;
+        else if(message.contains("sequence"))
+            sequence = message["sequence"];
+    }
+
+    bool empty() const
+    {
+        return data.empty();
+    }
+
+    // Get a property status message containing the latest values
+    // of all conflated properties and reset the conflation.
+    std::string take(ContentFormat format = ContentFormat::json)
+    {
+        json message = {{"messageType", "propertyStatus"}, {"data", std::move(data)}};
+        if(sequence)
+            message["sequence"] = *sequence;
+
+        data = json::object();
+        sequence = std::nullopt;
+        return encode(message, format);
+    }
+
+private:
+    json data = json::object();
+    std::optional<json> sequence;
+};
+
+} // bw::webthing
@@ -0,0 +1,157 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace bw::webthing {
+
+// A map of names to values, e.g. the properties of a thing, iterated in the
+// order of the names like a std::map, but looked up by hash. The entries are
+// stored contiguously and found by probing an open addressing table of their
+// indices and hashes, so only names with a matching hash are compared.
+// Inserting and erasing rebuild the table, they are meant for setting up a
+// thing rather than for every request. Names must not be modified through
+// iterators.
+template<class T> class NameMap
+{
+public:
+    typedef std::pair<std::string, T> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    iterator begin()
+    {
+        return entries.begin();
+    }
+
+    iterator end()
+    {
+        return entries.end();
+    }
+
+    const_iterator begin() const
+    {
+        return entries.begin();
+    }
+
+    const_iterator end() const
+    {
+        return entries.end();
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    bool empty() const
+    {
+        return entries.empty();
+    }
+
+    // Find the entry of name, end() if there is none
+    iterator find(std::string_view name)
+    {
+        return entries.begin() + index_of(name);
+    }
+
+    const_iterator find(std::string_view name) const
+    {
+        return entries.begin() + index_of(name);
+    }
+
+    size_t count(std::string_view name) const
+    {
+        return index_of(name) < entries.size() ? 1 : 0;
+    }
+
+    // Get the value of name, a default constructed value is inserted if there is none
+    T& operator[](std::string_view name)
+    {
+        auto index = index_of(name);
+        if(index < entries.size())
+            return entries[index].second;
+
+        auto it = std::lower_bound(entries.begin(), entries.end(), name,
+            [](const value_type& entry, std::string_view name){ return entry.first < name; });
+        index = it - entries.begin();
+        entries.emplace(it, std::string(name), T());
+        hashes.insert(hashes.begin() + index, hash(name));
+        rebuild_table();
+        return entries[index].second;
+    }
+
+    // Remove the entry of name, returns the number of removed entries
+    size_t erase(std::string_view name)
+    {
+        auto index = index_of(name);
+        if(index == entries.size())
+            return 0;
+
+        entries.erase(entries.begin() + index);
+        hashes.erase(hashes.begin() + index);
+        rebuild_table();
+        return 1;
+    }
+
+private:
+    struct Slot
+    {
+        // lower bits of the hash, compared before the name
+        uint32_t hash;
+        // index of the entry + 1, 0 marks an empty slot
+        uint32_t entry;
+    };
+
+    std::vector<value_type> entries;
+    std::vector<size_t> hashes;
+    std::vector<Slot> table;
+
+    static size_t hash(std::string_view name)
+    {
+        return std::hash<std::string_view>()(name);
+    }
+
+    size_t index_of(std::string_view name) const
+    {
+        if(table.empty())
+            return entries.size();
+
+        auto h = hash(name);
+        auto mask = table.size() - 1;
+        for(auto i = h & mask; table[i].entry != 0; i = (i + 1) & mask)
+            if(table[i].hash == static_cast<uint32_t>(h) && entries[table[i].entry - 1].first == name)
+                return table[i].entry - 1;
+
+        return entries.size();
+    }
+
+    // The table has at least twice as many slots as there are entries,
+    // which keeps the probe sequences short
+    void rebuild_table()
+    {
+        size_t slots = 8;
+        while(slots < 2 * entries.size())
+            slots *= 2;
+
+        table.assign(slots, {0, 0});
+        for(size_t e = 0; e < entries.size(); e++)
+        {
+            auto i = hashes[e] & (slots - 1);
+            while(table[i].entry != 0)
+                i = (i + 1) & (slots - 1);
+            table[i] = {static_cast<uint32_t>(hashes[e]), static_cast<uint32_t>(e + 1)};
+        }
+    }
+};
+
+} // bw::webthing
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <string>
 #include <bw/webthing/errors.hpp>
 #include <bw/webthing/json_validator.hpp>
@@ -47,6 +49,11 @@ public:
 
     virtual ~PropertyBase() = default;
     virtual json get_property_value_object() const = 0;
+    virtual bool forwards_async() const = 0;
+    virtual std::chrono::milliseconds get_forward_timeout() const = 0;
+    virtual void refresh_async(ForwardCallback done, const Executor& executor) = 0;
+    // Call observer with the property value object on every change of the value
+    virtual void add_value_observer(std::function<void (json)> observer) = 0;
 
     json as_property_description() const
     {
@@ -86,13 +93,79 @@ public:
     }
 
     template<class T> void set_value(T value)
+    {
+        visit_typed_property(std::move(value), [](auto& property, auto v){
+            property.set_value(std::move(v));
+        });
+    }
+
+    // Validate a json value as received via the web api, without setting it.
+    // throws PropertyError if value is invalid
+    void validate_json_value(const json& value) const
+    {
+        const_cast<PropertyBase*>(this)->visit_json_value(value, [](auto& property, auto v){
+            property.validate_value(v);
+        });
+    }
+
+    // Set a json value as received via the web api. The property type is
+    // selected by the json type, e.g. bool, std::string, int or double.
+    // validate -- false if value was already checked with validate_json_value
+    // throws PropertyError if value could not be set
+    void set_json_value(const json& value, bool validate = true)
+    {
+        visit_json_value(value, [validate](auto& property, auto v){
+            property.set_value(std::move(v), validate);
+        });
+    }
+
+    // Forward a json value without setting it, the value is expected to be
+    // checked with validate_json_value before. See Value::forward_async.
+    // throws PropertyError if types are not matching
+    void forward_json_value_async(const json& value, ForwardCallback done)
+    {
+        visit_json_value(value, [&done](auto& property, auto v){
+            property.forward_value_async(v, std::move(done));
+        });
+    }
+
+    // Set a json value without forwarding it, e.g. once it was forwarded
+    // throws PropertyError if types are not matching
+    void update_json_value(const json& value)
+    {
+        visit_json_value(value, [](auto& property, auto v){
+            property.update_value(std::move(v));
+        });
+    }
+
+protected:
+    template<class Function>
+    void visit_json_value(const json& value, Function&& function)
+    {
+        if(value.is_boolean())
+            visit_typed_property(value.get<bool>(), function);
+        else if(value.is_string())
+            visit_typed_property(value.get<std::string>(), function);
+        else if(value.is_number_integer())
+            visit_typed_property(value.get<int>(), function);
+        else if(value.is_number_float())
+            visit_typed_property(value.get<double>(), function);
+        else
+            visit_typed_property(value, function);
+    }
+
+    // Call function with this as Property<T> and value, values of properties
+    // wrapping a double are converted to double first.
+    // throws PropertyError if types are not matching
+    template<class T, class Function>
+    void visit_typed_property(T value, Function&& function)
     {
         try{
-           if(wraps_double && !std::is_same_v<T, double>)
-               return set_value(try_static_cast<double>(value));
+            if constexpr(!std::is_same_v<T, double>)
+                if(wraps_double)
+                    return visit_typed_property(try_static_cast<double>(value), function);
 
-            auto property = dynamic_cast<Property<T>&>(*this);
-            property.set_value(value);
+            function(dynamic_cast<Property<T>&>(*this), std::move(value));
         }
         catch(std::bad_cast&)
         {
@@ -100,7 +173,6 @@ public:
         }
     }
 
-protected:
     std::string name;
     std::string href_prefix;
     std::string href;
@@ -150,6 +222,27 @@ public:
         return property_value_object(*this);
     }
 
+    bool forwards_async() const
+    {
+        return value->forwards_async();
+    }
+
+    std::chrono::milliseconds get_forward_timeout() const
+    {
+        return value->get_forward_timeout();
+    }
+
+    // Fetch an outdated value from the device, see LazyValue
+    void refresh_async(ForwardCallback done, const Executor& executor)
+    {
+        value->refresh_async(std::move(done), executor);
+    }
+
+    void add_value_observer(std::function<void (json)> observer)
+    {
+        value->add_observer([this, observer](auto&){ observer(get_property_value_object()); });
+    }
+
     // Get the current property value.
     std::optional<T> get_value() const
     {
@@ -157,13 +250,27 @@ public:
     }
 
     // Set the current value of the property.
+    // validate -- false if value was already checked with validate_value
     // throws PropertyError If value could not be set.
-    void set_value(T value)
+    void set_value(T value, bool validate = true)
     {
-        this->validate_value(value);
+        if(validate)
+            this->validate_value(value);
         this->value->set(value);
     }
 
+    // Forward the value without setting it, see Value::forward_async
+    void forward_value_async(const T& value, ForwardCallback done)
+    {
+        this->value->forward_async(value, std::move(done));
+    }
+
+    // Set the value without forwarding it
+    void update_value(T value)
+    {
+        this->value->notify_of_external_update(value);
+    }
+
 private:
     std::shared_ptr<Value<T>> value;
     PropertyChangedCallback property_change_callback;
@@ -0,0 +1,396 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <bw/webthing/utils.hpp>
+
+namespace bw::webthing {
+
+// Default tick length of a scheduler, timers expire at most one tick late
+const std::chrono::milliseconds DEFAULT_SCHEDULER_RESOLUTION = std::chrono::milliseconds(10);
+
+// Hierarchical timing wheel scheduling one-shot and periodic tasks, e.g.
+// sensor sampling or timeouts. Scheduling and canceling take constant time
+// independent of the number of pending timers. Tasks are run by the thread
+// calling advance(), e.g. by the server loop or by a thread started with start().
+// Schedulers owned by a shared_ptr let timers be canceled after they may be gone.
+class Scheduler : public std::enable_shared_from_this<Scheduler>
+{
+public:
+    // Identifies a scheduled timer, 0 is never used as id
+    typedef uint64_t TimerId;
+    typedef std::function<void()> Task;
+    typedef std::chrono::steady_clock Clock;
+
+    Scheduler(std::chrono::milliseconds resolution = DEFAULT_SCHEDULER_RESOLUTION)
+        : resolution(std::max(resolution, std::chrono::milliseconds(1)))
+        , start_time(Clock::now())
+    {
+        heads.fill(NIL);
+    }
+
+    // disable copy and move, timers are referenced by their scheduler
+    Scheduler(const Scheduler& other) = delete;
+
+    ~Scheduler()
+    {
+        stop();
+    }
+
+    // Run task once after delay expired
+    TimerId schedule(std::chrono::milliseconds delay, Task task)
+    {
+        return add_timer(delay, std::chrono::milliseconds(0), std::move(task));
+    }
+
+    // Run task every interval, the first time after interval expired
+    TimerId schedule_periodic(std::chrono::milliseconds interval, Task task)
+    {
+        return add_timer(interval, std::max(interval, std::chrono::milliseconds(1)), std::move(task));
+    }
+
+    // Cancel a pending timer, returns false if it already expired or was canceled.
+    // A periodic timer may be canceled from within its own task.
+    bool cancel(TimerId id)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        uint32_t index = static_cast<uint32_t>(id & 0xffffffff);
+        if(index >= timers.size() || timers[index].generation != (id >> 32) || timers[index].slot == NIL)
+            return false;
+
+        unlink(index);
+        release(index);
+        return true;
+    }
+
+    // Number of pending timers
+    size_t size() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return pending;
+    }
+
+    // Point in time the scheduler has to be advanced at next, std::nullopt if
+    // no timer is pending. This is when the next timer expires, or earlier when
+    // timers further in the future have to be moved down the wheel first. Lets
+    // the thread advancing the scheduler sleep until then instead of every tick.
+    std::optional<Clock::time_point> next_expiry() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        if(pending == 0)
+            return std::nullopt;
+
+        uint64_t next = std::numeric_limits<uint64_t>::max();
+        for(size_t level = 0; level < LEVELS; level++)
+        {
+            // the slots of higher levels are reached when the lower level wrapped
+            size_t shift = level * SLOT_BITS;
+            for(uint64_t distance = 1; distance <= SLOTS; distance++)
+            {
+                uint64_t tick = ((current_tick >> shift) + distance) << shift;
+                if(heads[level * SLOTS + ((tick >> shift) & (SLOTS - 1))] != NIL)
+                {
+                    next = std::min(next, tick);
+                    break;
+                }
+            }
+        }
+
+        if(next == std::numeric_limits<uint64_t>::max())
+            next = current_tick + 1;
+        return start_time + resolution * static_cast<Clock::rep>(next);
+    }
+
+    // Call observer whenever a timer was scheduled, e.g. to wake up the thread
+    // advancing the scheduler at its next expiry. It is called on the thread
+    // scheduling the timer, without the scheduler being locked.
+    void set_schedule_observer(std::function<void()> observer)
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        schedule_observer = std::move(observer);
+    }
+
+    // Scheduler advanced by the calling thread, e.g. within its tasks
+    // or on the loop of a running server, nullptr if there is none
+    static Scheduler* current()
+    {
+        return current_scheduler;
+    }
+
+    static void set_current(Scheduler* scheduler)
+    {
+        current_scheduler = scheduler;
+    }
+
+    std::chrono::milliseconds get_resolution() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(resolution);
+    }
+
+    // Run all tasks of timers expired until now, returns the number of tasks run.
+    // Tasks may schedule and cancel timers, exceptions thrown by them are logged.
+    size_t advance(Clock::time_point now = Clock::now())
+    {
+        std::vector<std::shared_ptr<Task>> due;
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            uint64_t target_tick = to_tick(now);
+            if(pending == 0 && target_tick > current_tick)
+                current_tick = target_tick;
+
+            while(current_tick < target_tick)
+            {
+                current_tick++;
+                cascade();
+                expire(due, target_tick);
+            }
+        }
+
+        Scheduler* previous = current_scheduler;
+        current_scheduler = this;
+        for(auto& task : due)
+        {
+            try
+            {
+                (*task)();
+            }
+            catch(std::exception& ex)
+            {
+                logger::error(std::string("scheduled task failed: ") + ex.what());
+            }
+        }
+        current_scheduler = previous;
+        return due.size();
+    }
+
+    // Advance the scheduler on a dedicated thread once per tick
+    void start()
+    {
+        std::scoped_lock<std::mutex> lock(thread_mutex);
+        if(runner.joinable())
+            return;
+
+        running = true;
+        runner = std::thread([this]{
+            std::unique_lock<std::mutex> lock(thread_mutex);
+            auto next = Clock::now() + resolution;
+            while(running)
+            {
+                if(thread_stopped.wait_until(lock, next, [this]{ return !running; }))
+                    break;
+
+                lock.unlock();
+                advance();
+                lock.lock();
+                next = std::max(next + resolution, Clock::now());
+            }
+        });
+    }
+
+    // Stop the thread started by start(), must not be called from a task
+    void stop()
+    {
+        std::thread stopped;
+        {
+            std::scoped_lock<std::mutex> lock(thread_mutex);
+            running = false;
+            stopped = std::move(runner);
+        }
+        thread_stopped.notify_all();
+        if(stopped.joinable())
+            stopped.join();
+    }
+
+private:
+    static constexpr uint32_t NIL = std::numeric_limits<uint32_t>::max();
+    static constexpr size_t SLOT_BITS = 8;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;
+    // timers further in the future are placed in the last level and
+    // moved down by cascading until they are within reach
+    static constexpr uint64_t MAX_DELTA = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+    struct Timer
+    {
+        uint64_t expires = 0; // tick
+        uint64_t interval = 0; // ticks, 0 for one-shot timers
+        std::shared_ptr<Task> task;
+        uint32_t generation = 1;
+        uint32_t slot = NIL;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+    };
+
+    TimerId add_timer(std::chrono::milliseconds delay, std::chrono::milliseconds interval, Task task)
+    {
+        auto task_ptr = std::make_shared<Task>(std::move(task));
+        auto expires_at = Clock::now() + delay;
+
+        TimerId id;
+        std::function<void()> observer;
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            uint32_t index;
+            if(free_head != NIL)
+            {
+                index = free_head;
+                free_head = timers[index].next;
+            }
+            else
+            {
+                index = static_cast<uint32_t>(timers.size());
+                timers.emplace_back();
+            }
+
+            auto& timer = timers[index];
+            timer.expires = std::max(to_tick_ceil(expires_at), current_tick + 1);
+            timer.interval = interval.count() > 0 ? to_ticks_ceil(interval) : 0;
+            timer.task = std::move(task_ptr);
+            link(index);
+            pending++;
+            id = (static_cast<TimerId>(timer.generation) << 32) | index;
+            observer = schedule_observer;
+        }
+
+        if(observer)
+            observer();
+        return id;
+    }
+
+    uint64_t to_tick(Clock::time_point time) const
+    {
+        return time <= start_time ? 0 : (time - start_time) / resolution;
+    }
+
+    uint64_t to_tick_ceil(Clock::time_point time) const
+    {
+        return time <= start_time ? 0 : to_ticks_ceil(time - start_time);
+    }
+
+    uint64_t to_ticks_ceil(Clock::duration duration) const
+    {
+        return std::max<uint64_t>((duration + resolution - Clock::duration(1)) / resolution, 1);
+    }
+
+    // Place a timer in the slot of the lowest level covering its expiration
+    void link(uint32_t index)
+    {
+        auto& timer = timers[index];
+        uint64_t delta = timer.expires > current_tick ? timer.expires - current_tick : 0;
+        uint64_t expires = current_tick + std::min(delta, MAX_DELTA);
+
+        size_t level = 0;
+        while(level < LEVELS - 1 && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS)))
+            level++;
+
+        timer.slot = static_cast<uint32_t>(level * SLOTS + ((expires >> (level * SLOT_BITS)) & (SLOTS - 1)));
+        timer.prev = NIL;
+        timer.next = heads[timer.slot];
+        if(timer.next != NIL)
+            timers[timer.next].prev = index;
+        heads[timer.slot] = index;
+    }
+
+    void unlink(uint32_t index)
+    {
+        auto& timer = timers[index];
+        if(timer.prev != NIL)
+            timers[timer.prev].next = timer.next;
+        else
+            heads[timer.slot] = timer.next;
+        if(timer.next != NIL)
+            timers[timer.next].prev = timer.prev;
+        timer.slot = NIL;
+    }
+
+    void release(uint32_t index)
+    {
+        auto& timer = timers[index];
+        timer.task.reset();
+        timer.generation++;
+        timer.next = free_head;
+        free_head = index;
+        pending--;
+    }
+
+    // Move the timers of the next slot of each higher level down, whenever
+    // the lower level completed a revolution
+    void cascade()
+    {
+        for(size_t level = 1; level < LEVELS; level++)
+        {
+            if((current_tick >> ((level - 1) * SLOT_BITS)) & (SLOTS - 1))
+                return;
+
+            auto slot = level * SLOTS + ((current_tick >> (level * SLOT_BITS)) & (SLOTS - 1));
+            uint32_t index = heads[slot];
+            heads[slot] = NIL;
+            while(index != NIL)
+            {
+                uint32_t next = timers[index].next;
+                link(index);
+                index = next;
+            }
+        }
+    }
+
+    void expire(std::vector<std::shared_ptr<Task>>& due, uint64_t target_tick)
+    {
+        auto slot = current_tick & (SLOTS - 1);
+        uint32_t index = heads[slot];
+        heads[slot] = NIL;
+        while(index != NIL)
+        {
+            auto& timer = timers[index];
+            uint32_t next = timer.next;
+            timer.slot = NIL;
+            due.push_back(timer.task);
+
+            if(timer.interval)
+            {
+                // skip runs missed while the scheduler was not advanced
+                timer.expires += timer.interval;
+                if(timer.expires <= target_tick)
+                    timer.expires += ((target_tick - timer.expires) / timer.interval + 1) * timer.interval;
+                link(index);
+            }
+            else
+            {
+                release(index);
+            }
+            index = next;
+        }
+    }
+
+    const Clock::duration resolution;
+    const Clock::time_point start_time;
+
+    mutable std::mutex mutex;
+    uint64_t current_tick = 0;
+    size_t pending = 0;
+    std::vector<Timer> timers;
+    uint32_t free_head = NIL;
+    std::array<uint32_t, SLOTS * LEVELS> heads;
+    std::function<void()> schedule_observer;
+    inline static thread_local Scheduler* current_scheduler = nullptr;
+
+    std::mutex thread_mutex;
+    std::condition_variable thread_stopped;
+    std::thread runner;
+    bool running = false;
+};
+
+} // bw::webthing
@@ -4,12 +4,31 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
+#include <bw/webthing/arena.hpp>
+#include <bw/webthing/compression.hpp>
+#include <bw/webthing/content_format.hpp>
+#include <bw/webthing/json_parser.hpp>
 #include <bw/webthing/mdns.hpp>
+#include <bw/webthing/message_log.hpp>
+#include <bw/webthing/scheduler.hpp>
+#include <bw/webthing/snapshot_file.hpp>
 #include <bw/webthing/thing.hpp>
 #include <bw/webthing/version.hpp>
+#include <bw/webthing/websocket_message.hpp>
 #include <uwebsockets/App.h>
 
 namespace bw::webthing {
@@ -33,15 +52,69 @@ constexpr bool is_ssl_enabled()
 
 typedef uWS::HttpResponse<is_ssl_enabled()> uwsHttpResponse;
 
+// Largest request body accepted, larger ones are answered with 413 Payload Too Large
+const size_t HTTP_MAX_REQUEST_BODY_SIZE = 64 * 1024;
+
+// Interval in which records exceeding the max_age of their storage are evicted
+const std::chrono::milliseconds STORAGE_EVICTION_INTERVAL = std::chrono::seconds(1);
+
+// Handling of websockets that do not consume their messages fast enough
+enum class SlowConsumerPolicy
+{
+    DropConnection,    // close the websocket
+    DropMessages,      // drop messages until the websocket caught up
+    ConflateProperties // drop messages, but deliver the latest value of each property once caught up
+};
+
+struct BackpressureConfig
+{
+    // number of bytes buffered per websocket before the policy applies
+    unsigned int max_backpressure = 64 * 1024;
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DropMessages;
+};
+
+struct WebSocketOptions
+{
+    // number of latest messages per thing that are retained
+    // to be replayed to reconnecting websocket clients
+    size_t message_log_size = 1000;
+    // permessage-deflate compression, e.g. uWS::SHARED_COMPRESSOR or uWS::DEDICATED_COMPRESSOR
+    uWS::CompressOptions compression = uWS::DISABLED;
+    BackpressureConfig backpressure;
+    // backpressure configuration per thing id, overrides the default
+    std::map<std::string, BackpressureConfig> thing_backpressure;
+};
+
+struct PropertyPersistenceOptions
+{
+    // file the property values of all things are written to, values are not persisted if empty
+    std::string path;
+    // values are written at most once per interval, if any of them changed
+    std::chrono::milliseconds interval = std::chrono::seconds(1);
+};
 
 enum class ThingType { SingleThing, MultipleThings };
 
 struct ThingContainer
 {
     ThingContainer(std::vector<Thing*> things, std::string name, ThingType type)
-        : things(things)
-        , name(name)
+        : name(name)
         , type(type)
+    {
+        auto initial = std::make_shared<Slots>();
+        for(auto thing : things)
+        {
+            initial->things.push_back(thing);
+            initial->ids.push_back(thing->get_id());
+        }
+        initial->index_ids();
+        slots.store(std::move(initial));
+    }
+
+    ThingContainer(const ThingContainer& other)
+        : slots(other.slots)
+        , name(other.name)
+        , type(other.type)
     {}
 
     std::string get_name() const
@@ -54,26 +127,142 @@ struct ThingContainer
         return type;
     } 
 
-    std::optional<Thing*> get_thing(int index)
+    std::optional<Thing*> get_thing(int index) const
     {
-        if(index >= things.size())
+        return get_thing(*slots.load(), index);
+    }
+
+    // Get the thing addressed by its index or its id, e.g. in the url of a
+    // request. Numbers are taken as index, even if a thing has a numeric id.
+    std::optional<Thing*> find_thing(std::string_view index_or_id) const
+    {
+        auto current = slots.load();
+        int index;
+        auto end = index_or_id.data() + index_or_id.size();
+        auto [parsed_end, ec] = std::from_chars(index_or_id.data(), end, index);
+        if(ec == std::errc() && parsed_end == end)
+            return get_thing(*current, index);
+
+        auto it = current->indices.find(index_or_id);
+        if(it == current->indices.end())
             return std::nullopt;
+        return get_thing(*current, it->second);
+    }
 
+    std::vector<Thing*> get_things() const
+    {
+        auto current = slots.load();
+        std::vector<Thing*> hosted;
+        std::copy_if(current->things.begin(), current->things.end(), std::back_inserter(hosted),
+            [](Thing* thing){ return thing != nullptr; });
+        return hosted;
+    }
+
+    // Index a thing with thing_id is addressed by, while hosted and after it was
+    // removed, so it gets the same index when it is added again
+    std::optional<int> get_index(std::string_view thing_id) const
+    {
+        auto current = slots.load();
+        auto it = current->indices.find(thing_id);
+        if(it == current->indices.end())
+            return std::nullopt;
+        return it->second;
+    }
+
+    // Index the next thing with an unknown id is added at
+    int get_next_index() const
+    {
+        return static_cast<int>(slots.load()->ids.size());
+    }
+
+    // Add a thing and get the index it is addressed by. Lookups are not
+    // blocked, they get the things either before or after it was added.
+    // throws std::logic_error if the container holds a single thing or
+    // already a thing with the id of thing
+    int add_thing(Thing* thing)
+    {
         if(type == ThingType::SingleThing)
-            return things[0];
+            throw std::logic_error("Things can only be added to MultipleThings");
 
-        return things[index];
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto index = get_index(thing->get_id());
+        if(index && get_thing(*index))
+            throw std::logic_error("Thing already hosted: " + thing->get_id());
+
+        update_slots([&](Slots& modified)
+        {
+            if(!index)
+            {
+                index = static_cast<int>(modified.ids.size());
+                modified.things.push_back(nullptr);
+                modified.ids.push_back(thing->get_id());
+            }
+            modified.things[*index] = thing;
+        });
+        return *index;
     }
 
-    std::vector<Thing*> get_things()
+    // Remove the thing with thing_id, returns the index it was addressed by
+    // or std::nullopt if no thing with the id was hosted
+    std::optional<int> remove_thing(const std::string& thing_id)
     {
-        return things;
+        if(type == ThingType::SingleThing)
+            return std::nullopt;
+
+        std::scoped_lock<std::mutex> lock(mutex);
+        auto index = get_index(thing_id);
+        if(!index || !get_thing(*index))
+            return std::nullopt;
+
+        update_slots([&](Slots& modified){ modified.things[*index] = nullptr; });
+        return index;
     }
 
 protected:
-    std::vector<Thing*> things;
+    // Things by index, a removed thing leaves an empty slot reserved for its id
+    struct Slots
+    {
+        std::vector<Thing*> things;
+        std::vector<std::string> ids;
+        // indices by id, the keys refer to the ids of the same slots
+        std::unordered_map<std::string_view, int> indices;
+
+        void index_ids()
+        {
+            indices.clear();
+            for(size_t i = 0; i < ids.size(); i++)
+                indices[ids[i]] = static_cast<int>(i);
+        }
+    };
+
+    // immutable, replaced by a modified copy on every change
+    AtomicSharedPtr<const Slots> slots;
+    std::mutex mutex;
     std::string name;
     ThingType type;
+
+    std::optional<Thing*> get_thing(const Slots& current, int index) const
+    {
+        if(index < 0 || index >= static_cast<int>(current.things.size()))
+            return std::nullopt;
+
+        if(type == ThingType::SingleThing)
+            return current.things[0];
+
+        if(!current.things[index])
+            return std::nullopt;
+
+        return current.things[index];
+    }
+
+    template<class Function>
+    void update_slots(Function&& modify)
+    {
+        auto modified = std::make_shared<Slots>(*slots.load());
+        modify(*modified);
+        modified->index_ids();
+        slots.store(std::move(modified));
+    }
 };
 
 struct SingleThing : public ThingContainer
@@ -134,10 +323,64 @@ public:
             return *this;
         }
 
+        // number of latest messages per thing that are retained
+        // to be replayed to reconnecting websocket clients
+        Builder& message_log_size(size_t message_log_size)
+        {
+            websocket_options_.message_log_size = message_log_size;
+            return *this;
+        }
+
+        // enable permessage-deflate compression of websocket messages,
+        // e.g. uWS::SHARED_COMPRESSOR or uWS::DEDICATED_COMPRESSOR
+        Builder& websocket_compression(uWS::CompressOptions compression)
+        {
+            websocket_options_.compression = compression;
+            return *this;
+        }
+
+        // default handling of slow websocket consumers
+        Builder& backpressure(BackpressureConfig config)
+        {
+            websocket_options_.backpressure = config;
+            return *this;
+        }
+
+        // handling of slow websocket consumers of a specific thing
+        Builder& backpressure(std::string thing_id, BackpressureConfig config)
+        {
+            websocket_options_.thing_backpressure[thing_id] = config;
+            return *this;
+        }
+
+        // run synchronous value forwarders and getters of properties accessed
+        // via the web api, e.g. on a thread pool, instead of blocking the server loop
+        Builder& value_executor(Executor executor)
+        {
+            value_executor_ = executor;
+            return *this;
+        }
+
+        // tick length of the scheduler, timers expire at most one tick late
+        Builder& scheduler_resolution(std::chrono::milliseconds resolution)
+        {
+            scheduler_resolution_ = resolution;
+            return *this;
+        }
+
+        // persist property values in a file, from which they are restored
+        // before the server starts listening, e.g. instead of polling devices
+        Builder& persist_property_values(std::string path, std::chrono::milliseconds interval = std::chrono::seconds(1))
+        {
+            property_persistence_ = {path, interval};
+            return *this;
+        }
+
         WebThingServer build()
         {
             return WebThingServer(things_, port_, hostname_, base_path_, 
-                disable_host_validation_, ssl_options_, mdns_enabled_);
+                disable_host_validation_, ssl_options_, mdns_enabled_, websocket_options_,
+                value_executor_, scheduler_resolution_, property_persistence_);
         }
 
         void start()
@@ -153,16 +396,65 @@ public:
         std::string base_path_ = "/";
         bool disable_host_validation_ = false;
         bool mdns_enabled_ = true;
+        WebSocketOptions websocket_options_;
+        Executor value_executor_;
+        std::chrono::milliseconds scheduler_resolution_ = DEFAULT_SCHEDULER_RESOLUTION;
+        PropertyPersistenceOptions property_persistence_;
+    };
+
+    // Scope of using the arena of the calling thread, e.g. to build a response
+    // or to encode a websocket message. All scopes of a thread share its arena,
+    // which is reset once the outermost scope ended.
+    struct ArenaScope
+    {
+        ArenaScope()
+        {
+            scopes++;
+        }
+
+        ArenaScope(const ArenaScope& other) = delete;
+
+        ~ArenaScope()
+        {
+            if(--scopes == 0)
+                arena().reset();
+        }
+
+        static Arena& arena()
+        {
+            thread_local Arena arena;
+            return arena;
+        }
 
+        inline static thread_local int scopes = 0;
     };
 
+    // Builds the response to a request. Headers and encoded content are
+    // allocated from the arena of the handling thread, see ArenaScope. The
+    // status, headers and body are copied by uWebSockets when written, so
+    // nothing refers to the arena after end().
     struct Response
     {
         Response(uWS::HttpRequest* req, uwsHttpResponse* res)
+            : Response(req, res,
+                negotiate_content_format(req->getHeader("accept")),
+                negotiate_content_encoding(req->getHeader("accept-encoding")))
+        {}
+
+        // format, encoding -- negotiated in advance, required when the request
+        // is not accessible any longer, e.g. after receiving its body
+        Response(uWS::HttpRequest* req, uwsHttpResponse* res, ContentFormat format,
+            ContentEncoding encoding = ContentEncoding::identity)
             : req_(req)
             , res_(res)
+            , headers_(ArenaAllocator<Header>(ArenaScope::arena()))
+            , format_(format)
+            , encoding_(encoding)
+            , content_(ArenaAllocator<char>(ArenaScope::arena()))
         {}
 
+        Response(const Response& other) = delete;
+
         Response& status(std::string_view status)
         {
             status_ = status;
@@ -172,6 +464,15 @@ public:
         Response& body(std::string_view body)
         {
             body_ = body;
+            precompressed_ = nullptr;
+            return *this;
+        }
+
+        // Set a body which is compressed at most once per encoding
+        Response& body(PrecompressedContent& body)
+        {
+            this->body(body.get());
+            precompressed_ = &body;
             return *this;
         }
 
@@ -185,11 +486,26 @@ public:
             return status("403 Forbidden");
         }
 
+        Response& payload_too_large()
+        {
+            return status("413 Payload Too Large");
+        }
+
         Response& not_found()
         {
             return status("404 Not Found");
         }
 
+        Response& bad_gateway()
+        {
+            return status("502 Bad Gateway");
+        }
+
+        Response& gateway_timeout()
+        {
+            return status("504 Gateway Timeout");
+        }
+
         Response& method_not_allowed()
         {
             return status("405 Method Not Allowed");
@@ -210,9 +526,19 @@ public:
             return status("201 Created");
         }
 
+        // key and value are copied, they may refer to temporary strings
         Response& header(std::string_view key, std::string_view value)
         {
-            headers_[key] = value;
+            auto copied = ArenaScope::arena().copy(value);
+            for(auto& h : headers_)
+            {
+                if(h.first == key)
+                {
+                    h.second = copied;
+                    return *this;
+                }
+            }
+            headers_.emplace_back(ArenaScope::arena().copy(key), copied);
             return *this;
         }
 
@@ -231,6 +557,37 @@ public:
             return *this;
         }
 
+        // Set body encoded in the content format accepted by the client
+        Response& content(const bw::webthing::json& body)
+        {
+            this->header("Vary", "Accept");
+            this->header("Content-Type", content_type(format_));
+            content_.clear();
+            encode(body, format_, content_);
+            this->body(std::string_view(content_.data(), content_.size()));
+            return *this;
+        }
+
+        // Set a body already encoded in the content format accepted by the
+        // client, which is compressed at most once per encoding
+        Response& content(PrecompressedContent& encoded)
+        {
+            this->header("Vary", "Accept");
+            this->header("Content-Type", content_type(format_));
+            this->body(encoded);
+            return *this;
+        }
+
+        ContentFormat get_format() const
+        {
+            return format_;
+        }
+
+        ContentEncoding get_encoding() const
+        {
+            return encoding_;
+        }
+
         Response& html(std::string_view body)
         {
             this->header("Content-Type", "text/html; charset=utf-8");
@@ -238,10 +595,18 @@ public:
             return *this;
         }
 
+        Response& html(PrecompressedContent& body)
+        {
+            this->header("Content-Type", "text/html; charset=utf-8");
+            this->body(body);
+            return *this;
+        }
+
 
         void end()
         {
             cors();
+            compress_body();
 
             res_->writeStatus(status_);
             for(const auto& kv : headers_)
@@ -250,26 +615,55 @@ public:
             }
             res_->end(body_);
 
-            if(logger::get_level() == log_level::trace)
+            // the request is not accessible any longer when responding asynchronously
+            if(logger::get_level() == log_level::trace && req_)
             {
-                std::ostringstream ss;
-                ss << "http - '" << res_->getRemoteAddressAsText() << "'";
-                ss << " '" << req_->getCaseSensitiveMethod();
-                ss << " " << req_->getFullUrl() << " HTTP/1.1'";
-                ss << " '" << status_ << "'";
-                ss << " " << body_.size() * sizeof(char) << "B";
-                ss << " '" << req_->getHeader("host") << "'";
-                ss << " '" << req_->getHeader("user-agent") << "'";
-                logger::trace(ss.str());
+                std::string str = "http - '" + std::string(res_->getRemoteAddressAsText()) + "'";
+                str.append(" '").append(req_->getCaseSensitiveMethod());
+                str.append(" ").append(req_->getFullUrl()).append(" HTTP/1.1'");
+                str.append(" '").append(status_).append("'");
+                str.append(" ").append(std::to_string(body_.size())).append("B");
+                str.append(" '").append(req_->getHeader("host")).append("'");
+                str.append(" '").append(req_->getHeader("user-agent")).append("'");
+                logger::trace(str);
             }
         }
 
     private:
+        void compress_body()
+        {
+            if(encoding_ == ContentEncoding::identity || body_.size() < HTTP_COMPRESSION_MIN_SIZE)
+                return;
+
+            if(precompressed_)
+            {
+                body_ = precompressed_->get(encoding_);
+            }
+            else
+            {
+                compressed_ = compress(body_, encoding_);
+                body_ = compressed_;
+            }
+
+            bool varies = std::any_of(headers_.begin(), headers_.end(), [](auto& h){ return h.first == "Vary"; });
+            header("Content-Encoding", content_encoding_name(encoding_));
+            header("Vary", varies ? "Accept, Accept-Encoding" : "Accept-Encoding");
+        }
+
+        typedef std::pair<std::string_view, std::string_view> Header;
+
+        // declared first, so the arena is in use until all members are destroyed
+        ArenaScope arena_scope_;
         uWS::HttpRequest* req_;
         uwsHttpResponse* res_;
         std::string_view status_ = uWS::HTTP_200_OK;
         std::string_view body_ = {};
-        std::map<std::string_view, std::string_view> headers_;
+        std::vector<Header, ArenaAllocator<Header>> headers_;
+        ContentFormat format_;
+        ContentEncoding encoding_;
+        std::vector<char, ArenaAllocator<char>> content_;
+        std::string compressed_;
+        PrecompressedContent* precompressed_ = nullptr;
     };
 
 public:
@@ -282,7 +676,10 @@ public:
     WebThingServer(const WebThingServer& other) = delete;
 
     WebThingServer(ThingContainer things, int port, std::optional<std::string> hostname, 
-        std::string base_path, bool disable_host_validation, SSLOptions ssl_options = {}, bool enable_mdns = true)
+        std::string base_path, bool disable_host_validation, SSLOptions ssl_options = {}, bool enable_mdns = true,
+        WebSocketOptions websocket_options = {}, Executor value_executor = nullptr,
+        std::chrono::milliseconds scheduler_resolution = DEFAULT_SCHEDULER_RESOLUTION,
+        PropertyPersistenceOptions property_persistence = {})
         : things(things)
         , name(things.get_name())
         , port(port)
@@ -291,29 +688,23 @@ public:
         , disable_host_validation(disable_host_validation)
         , ssl_options(ssl_options)
         , enable_mdns(enable_mdns)
+        , websocket_options(websocket_options)
+        , value_executor(value_executor)
+        , scheduler(std::make_shared<Scheduler>(scheduler_resolution))
+        , property_persistence(property_persistence)
     {
         if(this->base_path.back() == '/')
             this->base_path.pop_back();
 
-        hosts.push_back("localhost");
-        hosts.push_back("localhost:" + std::to_string(port));
-
-        auto if_ips = get_addresses();
-        for(auto& ip : if_ips)
-        {
-            hosts.push_back(ip);
-            hosts.push_back(ip + ":" + std::to_string(port));
-        }
-
         if(this->hostname)
         {
             auto hn = this->hostname.value();
             std::transform(hn.begin(), hn.end(), hn.begin(), ::tolower);
             this->hostname = hn;
-            hosts.push_back(*this->hostname);
-            hosts.push_back(*this->hostname + ":" + std::to_string(port));
         }
+        refresh_hosts();
 
+        restore_property_values();
         initialize_webthing_routes();
     }
 
@@ -325,14 +716,16 @@ public:
         bool is_single = things.get_type() == ThingType::SingleThing;
         
         int thing_index = -1;
-        for(auto& thing : things.get_things())
+        std::vector<std::shared_ptr<MessageLog>> thing_message_logs;
         {
-            thing_index++;
-            thing->set_href_prefix(base_path + (is_single ? "" : "/" + std::to_string(thing_index)));
-            thing->add_message_observer([this](auto topic, auto msg)
+            std::scoped_lock<std::mutex> lock(things_mutex);
+            for(auto& thing : things.get_things())
             {
-                handle_thing_message(topic, msg);
-            });
+                thing_index++;
+                thing->set_href_prefix(base_path + (is_single ? "" : "/" + std::to_string(thing_index)));
+                thing->set_scheduler(scheduler);
+                thing_message_logs.push_back(observe_thing(thing_index, thing));
+            }
         }
         
         #define CREATE_HANDLER(handler_function) [&](auto* res, auto* req) { \
@@ -349,6 +742,7 @@ public:
         server.get(base_path + thing_id_param, CREATE_HANDLER(handle_thing));
         server.get(base_path + thing_id_param + "/", CREATE_HANDLER(handle_thing));
         server.get(base_path + thing_id_param + "/properties", CREATE_HANDLER(handle_properties));
+        server.put(base_path + thing_id_param + "/properties", CREATE_HANDLER(handle_properties_put));
         server.get(base_path + thing_id_param + "/properties/:property_name", CREATE_HANDLER(handle_property_get));
         server.put(base_path + thing_id_param + "/properties/:property_name", CREATE_HANDLER(handle_property_put));
         server.get(base_path + thing_id_param + "/actions", CREATE_HANDLER(handle_actions_get));
@@ -364,124 +758,11 @@ public:
         server.any("/*", CREATE_HANDLER(handle_invalid_requests));
         server.options("/*", CREATE_HANDLER(handle_options_requests));
 
+        thing_index = -1;
         for(auto& thing : things.get_things())
         {
-            auto thing_id = thing->get_id();
-            uWebsocketsApp::WebSocketBehavior<std::string> ws_behavior;
-            ws_behavior.compression = uWS::SHARED_COMPRESSOR;
-            ws_behavior.open = [thing_id](auto *ws)
-            {
-                std::string* ws_id = (std::string *) ws->getUserData();
-                ws_id->append(generate_uuid());
-
-                logger::trace("websocket open " + *ws_id);
-                ws->subscribe(thing_id + "/properties");
-                ws->subscribe(thing_id + "/actions");
-            };
-            ws_behavior.message = [thing_id, thing](auto *ws, std::string_view message, uWS::OpCode op_code)
-            {
-                logger::trace("websocket msg " + *((std::string*)ws->getUserData()) + ": " + std::string(message));
-                json j;
-                try
-                {
-                    j = json::parse(message);
-                }
-                catch (json::parse_error&)
-                {
-                    json error_message = {{"messageType", "error"}, {"data", {
-                        {"status", "400 Bad Request"},
-                        {"message", "Parsing request failed"}
-                    }}};
-                    ws->send(error_message.dump(), op_code);
-                    return;
-                }
-
-                if(!j.contains("messageType") || !j.contains("data"))
-                {
-                    json error_message = {{"messageType", "error"}, {"data", {
-                        {"status", "400 Bad Request"},
-                        {"message", "Invalid message"}
-                    }}};
-                    ws->send(error_message.dump(), op_code);
-                    return;
-                }
-
-                // e.g. {"messageType":"addEventSubscription", "data":{"eventName":{}}}
-                std::string message_type = j["messageType"];
-                if(message_type == "addEventSubscription")
-                {
-                    for(auto& evt : j["data"].items())
-                        ws->subscribe(thing_id + "/events/" + evt.key());
-                }
-                else if(message_type == "setProperty")
-                {
-                    for(auto& property_entry : j["data"].items())
-                    {
-                        try
-                        {
-                            auto prop_setter = [&](auto val){
-                                thing->set_property(property_entry.key(), val);
-                            };
-
-                            json v = property_entry.value();
-                            if(v.is_boolean())
-                                prop_setter(v.get<bool>());
-                            else if(v.is_string())
-                                prop_setter(v.get<std::string>());
-                            else if(v.is_number_integer())
-                                prop_setter(v.get<int>());
-                            else if(v.is_number_float())
-                                prop_setter(v.get<double>());
-                            else
-                                prop_setter(v);
-                        }
-                        catch(std::exception& ex)
-                        {
-                            json error_message = {{"messageType", "error"}, {"data", {
-                                {"status", "400 Bad Request"},
-                                {"message", ex.what()}
-                            }}};
-                            ws->send(error_message.dump(), op_code);
-                        }
-                    }
-                }
-                else if(message_type == "requestAction")
-                {
-                    for(auto& action_entry : j["data"].items())
-                    {
-                        std::optional<json> input;
-                        if(j["data"][action_entry.key()].contains("input"))
-                            input = j["data"][action_entry.key()]["input"];
-                        
-                        auto action = thing->perform_action(action_entry.key(), std::move(input));
-                        if(action)
-                        {
-                            std::thread action_runner([action]{
-                                action->start();
-                            });
-                            action_runner.detach(); 
-                        }
-                    }
-                }
-                else
-                {
-                    json error_message = {{"messageType", "error"}, {"data", {
-                        {"status", "400 Bad Request"},
-                        {"message", "Unknown messageType: " + message_type},
-                        {"request", message}
-                    }}};
-                    ws->send(error_message.dump(), op_code);
-                }
-            };
-            ws_behavior.close = [thing_id](auto *ws, int /*code*/, std::string_view /*message*/)
-            {
-                logger::trace("websocket close " + *((std::string*)ws->getUserData()));
-                ws->unsubscribe(thing_id + "/properties");
-                ws->unsubscribe(thing_id + "/actions");
-                ws->unsubscribe(thing_id + "/events/#");
-            };
-
-            server.ws<std::string>(thing->get_href(), std::move(ws_behavior));
+            thing_index++;
+            add_websocket_route(thing_index, thing->get_id(), thing->get_href(), thing_message_logs[thing_index]);
         }
 
         server.listen(port, [&](auto *listen_socket) {
@@ -501,7 +782,41 @@ public:
             start_mdns_service();
 
         webserver_loop = uWS::Loop::get();
+        webserver_thread_id = std::this_thread::get_id();
+
+        // the scheduler is advanced on the server loop, which only wakes up
+        // when its next timer expires, without keeping the loop running
+        scheduler_timer = us_create_timer(reinterpret_cast<struct us_loop_t*>(webserver_loop), 1, sizeof(WebThingServer*));
+        *static_cast<WebThingServer**>(us_timer_ext(scheduler_timer)) = this;
+        scheduler->set_schedule_observer([this]{ run_on_loop([this]{ arm_scheduler_timer(); }); });
+        Scheduler::set_current(scheduler.get());
+
+        schedule_eviction();
+        std::optional<Scheduler::TimerId> hosts_refresh;
+        if(!disable_host_validation)
+            hosts_refresh = scheduler->schedule_periodic(HOSTS_REFRESH_INTERVAL, [this]{ refresh_hosts(); });
+        std::optional<Scheduler::TimerId> persistence;
+        if(property_snapshot_file)
+            persistence = scheduler->schedule_periodic(property_persistence.interval, [this]{ persist_property_values(); });
+        arm_scheduler_timer();
+
         web_server->run();
+        if(eviction)
+            scheduler->cancel(*eviction);
+        eviction.reset();
+        if(hosts_refresh)
+            scheduler->cancel(*hosts_refresh);
+        if(persistence)
+        {
+            scheduler->cancel(*persistence);
+            persist_property_values();
+            property_snapshot_file->sync();
+        }
+        scheduler->set_schedule_observer(nullptr);
+        Scheduler::set_current(nullptr);
+        us_timer_close(scheduler_timer);
+        scheduler_timer = nullptr;
+        scheduler_timer_expiry.reset();
         
         logger::info("Stopped WebThingServer hosting '" + things.get_name() + "'");
     }
@@ -526,71 +841,495 @@ public:
         return port;
     }
 
-    std::string get_base_path() const
-    {
-        return base_path;
+    std::string get_base_path() const
+    {
+        return base_path;
+    }
+
+    uWebsocketsApp* get_web_server() const
+    {
+        return web_server.get();
+    }
+
+    // Scheduler for periodic and delayed tasks, e.g. sampling sensors. Its
+    // tasks are run on the server loop while the server is running.
+    Scheduler& get_scheduler() const
+    {
+        return *scheduler;
+    }
+
+    // number of messages that were not delivered to slow websocket consumers
+    uint64_t get_dropped_messages() const
+    {
+        return dropped_messages;
+    }
+
+    // number of property status messages that were conflated for slow websocket consumers
+    uint64_t get_conflated_messages() const
+    {
+        return conflated_messages;
+    }
+
+    // number of thing description requests served from the cache
+    uint64_t get_description_cache_hits() const
+    {
+        return description_cache_hits;
+    }
+
+    // Host an additional thing, e.g. a hot plugged device, also while the server
+    // is running. Returns the index the thing is addressed by, which is the index
+    // of the thing with its id hosted before, so its clients can reconnect.
+    // throws std::logic_error if the server hosts a single thing or already a
+    // thing with the id of thing
+    int add_thing(Thing* thing)
+    {
+        if(things.get_type() == ThingType::SingleThing)
+            throw std::logic_error("Things can only be added to MultipleThings");
+
+        std::scoped_lock<std::mutex> lock(things_mutex);
+        auto thing_id = thing->get_id();
+        int index = things.get_index(thing_id).value_or(things.get_next_index());
+        if(hosted_thing(index))
+            throw std::logic_error("Thing already hosted: " + thing_id);
+
+        thing->set_href_prefix(base_path + "/" + std::to_string(index));
+        thing->set_scheduler(scheduler);
+        auto message_log = observe_thing(index, thing);
+        things.add_thing(thing);
+        logger::info("Added thing '" + thing_id + "' to WebThingServer hosting '" + things.get_name() + "'");
+
+        auto register_routes = [this, index, thing_id, href = thing->get_href(), message_log]
+        {
+            add_websocket_route(index, thing_id, href, message_log);
+            invalidate_descriptions("");
+            if(scheduler_timer)
+                schedule_eviction();
+        };
+        if(webserver_loop)
+            run_on_loop(std::move(register_routes));
+        else
+            register_routes();
+        return index;
+    }
+
+    // Stop hosting the thing with thing_id, e.g. an unplugged device. Its
+    // websockets are closed and requests for it are answered with 404 Not Found.
+    // removed is called on the server loop once no request handler accesses the
+    // thing anymore, the thing may be destroyed from then on. Returns false if
+    // no thing with the id was hosted.
+    // The messages logged for the thing are dropped, while its index, websocket
+    // route and message sequence are kept for a thing added again with its id.
+    // These take a few hundred bytes per distinct thing id ever hosted.
+    bool remove_thing(const std::string& thing_id, std::function<void()> removed = nullptr)
+    {
+        std::scoped_lock<std::mutex> lock(things_mutex);
+        if(!things.remove_thing(thing_id))
+            return false;
+        stop_observing(thing_id);
+        if(auto it = message_logs.find(thing_id); it != message_logs.end())
+            it->second->clear();
+        logger::info("Removed thing '" + thing_id + "' from WebThingServer hosting '" + things.get_name() + "'");
+
+        auto close_websockets = [this, thing_id, removed]
+        {
+            if(auto it = websockets.find(thing_id); it != websockets.end())
+            {
+                auto open = std::move(it->second);
+                websockets.erase(it);
+                for(auto ws : open)
+                    ws->end(1001, "Thing removed");
+            }
+            invalidate_descriptions(thing_id);
+            invalidate_descriptions("");
+            if(removed)
+                removed();
+        };
+        if(webserver_loop)
+            run_on_loop(std::move(close_websockets));
+        else
+            close_websockets();
+        return true;
+    }
+
+private:
+
+    // data attached to each websocket connection
+    struct WebSocketData
+    {
+        std::string id;
+        std::optional<uint64_t> since;
+        ContentFormat format = ContentFormat::json;
+        PropertyStatusConflation conflation;
+        // set when a message to the websocket was dropped while publishing
+        bool dropped = false;
+        // reset on close, tells asynchronous completions not to use the websocket
+        std::shared_ptr<bool> open = std::make_shared<bool>(true);
+
+        // name of topic in the format of this websocket
+        std::string topic(const std::string& name) const
+        {
+            return format_topic(name, format);
+        }
+    };
+
+    typedef uWS::WebSocket<is_ssl_enabled(), true, WebSocketData> uwsWebSocket;
+
+    // Messages are published once per format to separate topics
+    static std::string format_topic(const std::string& topic, ContentFormat format)
+    {
+        if(!is_binary(format))
+            return topic;
+        return std::string(websocket_protocol(format)) + ":" + topic;
+    }
+
+    static uWS::OpCode websocket_op_code(ContentFormat format)
+    {
+        return is_binary(format) ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+    }
+
+    bool compress_websocket_messages() const
+    {
+        return websocket_options.compression != uWS::DISABLED;
+    }
+
+    // Send message encoded in the format of the websocket
+    template<class WebSocket>
+    void send_message(WebSocket* ws, const json& message)
+    {
+        auto format = ws->getUserData()->format;
+        send_encoded(message, format, [&](std::string_view encoded){
+            ws->send(encoded, websocket_op_code(format), compress_websocket_messages());
+        });
+    }
+
+    // Encode message into the arena of the calling thread shared with responses
+    // and pass it to send, which has to copy it. The arena is also reset if
+    // encoding failed, e.g. due to invalid UTF-8.
+    template<class Send>
+    static void send_encoded(const json& message, ContentFormat format, Send&& send)
+    {
+        ArenaScope scope;
+        std::vector<char, ArenaAllocator<char>> encoded{ArenaAllocator<char>(ArenaScope::arena())};
+        encode(message, format, encoded);
+        send(std::string_view(encoded.data(), encoded.size()));
+    }
+
+    // Forward the messages of thing to websocket clients until it stops being
+    // observed, returns the message log of its id. Must hold things_mutex.
+    std::shared_ptr<MessageLog> observe_thing(int index, Thing* thing)
+    {
+        auto& message_log = message_logs[thing->get_id()];
+        if(!message_log)
+            message_log = std::make_shared<MessageLog>(websocket_options.message_log_size);
+
+        stop_observing(thing->get_id());
+        auto observing = std::make_shared<std::atomic<bool>>(true);
+        auto observer_id = thing->add_message_observer([this, index, thing, message_log, observing](auto topic, auto msg)
+        {
+            if(*observing && hosted_thing(index) == thing)
+                handle_thing_message(*message_log, topic, msg);
+        });
+        observed_things[thing->get_id()] = {thing, observer_id, observing};
+        return message_log;
+    }
+
+    // Remove the observer from the thing with thing_id, while it is still hosted.
+    // Messages notified concurrently are dropped by the flag. Must hold things_mutex.
+    void stop_observing(const std::string& thing_id)
+    {
+        if(auto it = observed_things.find(thing_id); it != observed_things.end())
+        {
+            *it->second.observing = false;
+            it->second.thing->remove_message_observer(it->second.observer_id);
+            observed_things.erase(it);
+        }
+    }
+
+    // Add the websocket route of the thing hosted at index, once per thing id.
+    // The route is reused when a thing with the id is added again.
+    void add_websocket_route(int index, const std::string& thing_id, const std::string& href,
+        std::shared_ptr<MessageLog> message_log)
+    {
+        if(!websocket_routes.insert(thing_id).second)
+            return;
+
+        auto backpressure = websocket_options.thing_backpressure.count(thing_id) > 0
+            ? websocket_options.thing_backpressure.at(thing_id) : websocket_options.backpressure;
+
+        uWebsocketsApp::WebSocketBehavior<WebSocketData> ws_behavior;
+        ws_behavior.compression = websocket_options.compression;
+        ws_behavior.maxBackpressure = backpressure.max_backpressure;
+        ws_behavior.closeOnBackpressureLimit = backpressure.policy == SlowConsumerPolicy::DropConnection;
+        ws_behavior.upgrade = [this, index](auto *res, auto *req, auto *context)
+        {
+            // the route is kept once the thing was removed, in case it is added again
+            if(!hosted_thing(index))
+            {
+                res->writeStatus("404 Not Found")->end();
+                return;
+            }
+
+            WebSocketData data;
+            data.id = generate_uuid();
+
+            // e.g. ws://localhost/things/0?since=42 to receive all messages
+            // published after sequence 42 or a snapshot when using since=0
+            auto since = req->getQuery("since");
+            uint64_t sequence;
+            if(std::from_chars(since.data(), since.data() + since.size(), sequence).ec == std::errc())
+                data.since = sequence;
+
+            // e.g. Sec-WebSocket-Protocol: webthing.cbor to exchange cbor encoded messages
+            auto protocols = req->getHeader("sec-websocket-protocol");
+            data.format = negotiate_websocket_format(protocols);
+            auto protocol = is_binary(data.format) ? websocket_protocol(data.format) : protocols;
+
+            res->template upgrade<WebSocketData>(std::move(data),
+                req->getHeader("sec-websocket-key"),
+                protocol,
+                req->getHeader("sec-websocket-extensions"),
+                context);
+        };
+        ws_behavior.open = [this, index, thing_id, message_log](auto *ws)
+        {
+            WebSocketData* data = ws->getUserData();
+            logger::trace("websocket open " + data->id);
+            Thing* thing = hosted_thing(index);
+            if(!thing)
+            {
+                ws->end(1001, "Thing removed");
+                return;
+            }
+            websockets[thing_id].insert(ws);
+            ws->subscribe(data->topic(thing_id + "/properties"));
+            ws->subscribe(data->topic(thing_id + "/actions"));
+
+            if(data->since)
+                synchronize_websocket(ws, thing, *message_log, *data->since);
+        };
+        ws_behavior.message = [this, index, thing_id, message_log](auto *ws, std::string_view message, uWS::OpCode op_code)
+        {
+            WebSocketData* data = ws->getUserData();
+            Thing* thing = hosted_thing(index);
+            if(!thing)
+                return;
+
+            logger::trace("websocket msg " + data->id + ": " + (op_code == uWS::OpCode::TEXT ? std::string(message) : "binary"));
+            auto ws_message = op_code == uWS::OpCode::BINARY
+                ? WebSocketMessageParser::parse(message, data->format)
+                : WebSocketMessageParser::parse(message);
+            if(!ws_message)
+            {
+                json error_message = {{"messageType", "error"}, {"data", {
+                    {"status", "400 Bad Request"},
+                    {"message", "Parsing request failed"}
+                }}};
+                send_message(ws, error_message);
+                return;
+            }
+
+            if(!ws_message->is_valid())
+            {
+                json error_message = {{"messageType", "error"}, {"data", {
+                    {"status", "400 Bad Request"},
+                    {"message", "Invalid message"}
+                }}};
+                send_message(ws, error_message);
+                return;
+            }
+
+            // e.g. {"messageType":"addEventSubscription", "data":{"eventName":{}}}
+            const std::string& message_type = *ws_message->message_type;
+            if(message_type == "addEventSubscription")
+            {
+                for(auto& [event_name, value] : ws_message->data)
+                    ws->subscribe(data->topic(thing_id + "/events/" + event_name));
+            }
+            // e.g. {"messageType":"addPropertySubscription", "data":{"propertyName":{}}}
+            // Once a property subscription was added, the websocket only receives
+            // status messages of properties it explicitly subscribed to.
+            else if(message_type == "addPropertySubscription")
+            {
+                bool subscribed = false;
+                for(auto& [property_name, value] : ws_message->data)
+                {
+                    if(!thing->has_property(property_name))
+                    {
+                        json error_message = {{"messageType", "error"}, {"data", {
+                            {"status", "400 Bad Request"},
+                            {"message", "Unknown property: " + property_name}
+                        }}};
+                        send_message(ws, error_message);
+                        continue;
+                    }
+                    ws->subscribe(data->topic(thing_id + "/properties/" + property_name));
+                    subscribed = true;
+                }
+
+                // unknown properties only leave the websocket subscribed to all properties
+                if(subscribed)
+                    ws->unsubscribe(data->topic(thing_id + "/properties"));
+            }
+            // e.g. {"messageType":"removePropertySubscription", "data":{"propertyName":{}}}
+            // Once the last property subscription was removed, the websocket
+            // receives status messages of all properties again.
+            else if(message_type == "removePropertySubscription")
+            {
+                for(auto& [property_name, value] : ws_message->data)
+                    ws->unsubscribe(data->topic(thing_id + "/properties/" + property_name));
+
+                auto names = thing->get_property_snapshot()->names;
+                if(std::none_of(names->begin(), names->end(), [ws, data, &thing_id](const auto& name){
+                    return ws->isSubscribed(data->topic(thing_id + "/properties/" + name));
+                }))
+                    ws->subscribe(data->topic(thing_id + "/properties"));
+            }
+            // e.g. {"messageType":"synchronize", "data":{"since":42}}
+            // without "since" a snapshot of all subscribed properties is sent
+            else if(message_type == "synchronize")
+            {
+                uint64_t since = 0;
+                for(const auto& entry : ws_message->data)
+                    if(entry.first == "since" && entry.second.is_number_unsigned())
+                        since = entry.second.get<uint64_t>();
+
+                synchronize_websocket(ws, thing, *message_log, since);
+            }
+            // e.g. {"messageType":"setProperty", "data":{"on":true,"brightness":42}}
+            // the values are set together, none is set if any of them is invalid
+            else if(message_type == "setProperty")
+            {
+                try
+                {
+                    thing->validate_properties(ws_message->data);
+
+                    auto open = data->open;
+                    set_properties_without_blocking(thing, std::move(ws_message->data), [this, ws, open](std::exception_ptr error)
+                    {
+                        if(!error || !*open)
+                            return;
+
+                        try
+                        {
+                            std::rethrow_exception(error);
+                        }
+                        catch(std::exception& ex)
+                        {
+                            bool timed_out = dynamic_cast<ForwardTimeoutError*>(&ex) != nullptr;
+                            json error_message = {{"messageType", "error"}, {"data", {
+                                {"status", timed_out ? "504 Gateway Timeout" : "400 Bad Request"},
+                                {"message", ex.what()}
+                            }}};
+                            send_message(ws, error_message);
+                        }
+                    });
+                }
+                catch(std::exception& ex)
+                {
+                    json error_message = {{"messageType", "error"}, {"data", {
+                        {"status", "400 Bad Request"},
+                        {"message", ex.what()}
+                    }}};
+                    send_message(ws, error_message);
+                }
+            }
+            else if(message_type == "requestAction")
+            {
+                for(auto& [action_name, value] : ws_message->data)
+                {
+                    std::optional<json> input;
+                    if(value.is_object() && value.contains("input"))
+                        input = std::move(value["input"]);
+                    
+                    auto action = thing->perform_action(action_name, std::move(input));
+                    if(action)
+                        start_action(action);
+                }
+            }
+            else
+            {
+                json error_message = {{"messageType", "error"}, {"data", {
+                    {"status", "400 Bad Request"},
+                    {"message", "Unknown messageType: " + message_type}
+                }}};
+                if(op_code == uWS::OpCode::TEXT)
+                    error_message["data"]["request"] = message;
+                send_message(ws, error_message);
+            }
+        };
+        ws_behavior.dropped = [this, backpressure](auto *ws, std::string_view message, uWS::OpCode /*op_code*/)
+        {
+            WebSocketData* data = ws->getUserData();
+            data->dropped = true;
+            if(backpressure.policy == SlowConsumerPolicy::ConflateProperties && data->conflation.add(message, data->format))
+            {
+                conflating_websockets.insert(ws);
+                conflated_messages++;
+                return;
+            }
+
+            dropped_messages++;
+            logger::trace("websocket dropped message " + data->id);
+        };
+        ws_behavior.drain = [this, backpressure](auto *ws)
+        {
+            WebSocketData* data = ws->getUserData();
+            if(!data->conflation.empty() && ws->getBufferedAmount() < backpressure.max_backpressure)
+            {
+                conflating_websockets.erase(ws);
+                ws->send(data->conflation.take(data->format), websocket_op_code(data->format), compress_websocket_messages());
+            }
+        };
+        ws_behavior.close = [this, thing_id](auto *ws, int /*code*/, std::string_view /*message*/)
+        {
+            WebSocketData* data = ws->getUserData();
+            logger::trace("websocket close " + data->id);
+            if(auto it = websockets.find(thing_id); it != websockets.end())
+                it->second.erase(ws);
+            conflating_websockets.erase(ws);
+            *data->open = false;
+            ws->unsubscribe(data->topic(thing_id + "/properties"));
+            ws->unsubscribe(data->topic(thing_id + "/actions"));
+            ws->unsubscribe(data->topic(thing_id + "/events/#"));
+        };
+
+        web_server->ws<WebSocketData>(href, std::move(ws_behavior));
     }
 
-    uWebsocketsApp* get_web_server() const
+    // The thing hosted at index, nullptr if it was removed
+    Thing* hosted_thing(int index) const
     {
-        return web_server.get();
+        return things.get_thing(index).value_or(nullptr);
     }
 
-private:
-
     void start_mdns_service()
     {
-        std::thread([this]{
-
-            logger::info("Start mDNS service for WebThingServer hosting '" + things.get_name() + "'");
-            
-            mdns_service = std::make_unique<MdnsService>();
-            mdns_service->start_service(things.get_name(), "_webthing._tcp.local.", port, base_path + "/", is_ssl_enabled());
-
-            logger::info("Stopped mDNS service for WebThingServer hosting '" + things.get_name() + "'");
-  
-        }).detach();
+        logger::info("Start mDNS service for WebThingServer hosting '" + things.get_name() + "'");
+        mdns_service = std::make_unique<MdnsService>();
+        mdns_service->start_service(things.get_name(), "_webthing._tcp.local.", port, base_path + "/", is_ssl_enabled());
     }
 
     void stop_mdns_service()
     {
-        using namespace std::chrono;
-
         if(mdns_service)
         {
             logger::info("Stop mDNS service for WebThingServer hosting '" + things.get_name() + "'");
             mdns_service->stop_service();
-
-            auto timeout = milliseconds(5000);
-            auto start = steady_clock::now();
-            bool timeout_reached = false;
-            while(mdns_service->is_running() || timeout_reached)
-            {
-                std::this_thread::sleep_for(milliseconds(1));
-                auto current = steady_clock::now();
-                timeout_reached = duration_cast<milliseconds>(current - start) >= timeout;
-            }
-
+            logger::info("Stopped mDNS service for WebThingServer hosting '" + things.get_name() + "'");
         }
     }
 
+    // Things of MultipleThings are addressed by index or id, e.g. /things/0 or /things/urn:dev:ops:lamp
     std::optional<Thing*> find_thing_from_url(uWS::HttpRequest* req)
     {
         if(things.get_type() == ThingType::SingleThing)
             return things.get_thing(0);
 
-        auto thing_id_str = req->getParameter(0);
-        try{
-            int thing_id = std::stoi(thing_id_str.data());
-            return things.get_thing(thing_id);
-        }
-        catch(std::exception&)
-        {
-            return std::nullopt;
-        }
+        return things.find_thing(req->getParameter(0));
     }
 
-    std::optional<std::string> find_param_after_thing_id_from_url(uWS::HttpRequest* req, int index_after_thing_id = 0)
+    // The parameters refer to the request, they are only valid while it is handled
+    std::optional<std::string_view> find_param_after_thing_id_from_url(uWS::HttpRequest* req, int index_after_thing_id = 0)
     {
         int parameter_index = index_after_thing_id;
         if(things.get_type() == ThingType::MultipleThings)
@@ -600,57 +1339,80 @@ private:
         if(param.empty())
             return std::nullopt;
 
-        return std::string(param);
+        return param;
     }
 
-    std::optional<std::string> find_property_name_from_url(uWS::HttpRequest* req)
+    std::optional<std::string_view> find_property_name_from_url(uWS::HttpRequest* req)
     {
         return find_param_after_thing_id_from_url(req);
     }
 
-    std::optional<std::string> find_event_name_from_url(uWS::HttpRequest* req)
+    std::optional<std::string_view> find_event_name_from_url(uWS::HttpRequest* req)
     {
         return find_param_after_thing_id_from_url(req);
     }
 
-    std::optional<std::string> find_action_name_from_url(uWS::HttpRequest* req)
+    std::optional<std::string_view> find_action_name_from_url(uWS::HttpRequest* req)
     {
         return find_param_after_thing_id_from_url(req, 0);
     }
 
-    std::optional<std::string> find_action_id_from_url(uWS::HttpRequest* req)
+    std::optional<std::string_view> find_action_id_from_url(uWS::HttpRequest* req)
     {
         return find_param_after_thing_id_from_url(req, 1);
     }
 
+    // Collect the hosts accepted by validate_host, i.e. localhost, the
+    // addresses of all interfaces and the hostname, with and without port.
+    // Repeated by the scheduler while running, so requests never query the
+    // interfaces themselves.
+    void refresh_hosts()
+    {
+        std::vector<std::string> names = get_addresses();
+        names.push_back("localhost");
+        if(hostname)
+            names.push_back(*hostname);
+
+        std::vector<std::string> refreshed;
+        for(auto& name : names)
+        {
+            refreshed.push_back(name + ":" + std::to_string(port));
+            refreshed.push_back(std::move(name));
+        }
+        std::sort(refreshed.begin(), refreshed.end());
+        refreshed.erase(std::unique(refreshed.begin(), refreshed.end()), refreshed.end());
+
+        hosts = std::move(refreshed);
+    }
+
     bool validate_host(uWS::HttpRequest* req)
     {
         if(disable_host_validation)
             return true;
 
-        std::string host(req->getHeader("host"));
-        return std::find(hosts.begin(), hosts.end(), host) != hosts.end();
+        auto host = req->getHeader("host");
+        return std::binary_search(hosts.begin(), hosts.end(), host, std::less<>());
     }
 
-    void delegate_request(uwsHttpResponse* res, uWS::HttpRequest* req,
-        std::function<void(uwsHttpResponse*, uWS::HttpRequest*)> handler)
+    template<class Handler>
+    void delegate_request(uwsHttpResponse* res, uWS::HttpRequest* req, Handler&& handler)
     {
-        // default aborted handling
+        // default aborted handling, the request is not accessible any longer when aborted
         if(logger::get_level() == log_level::trace)
         {
-            std::ostringstream ss;
-            ss << "http - '" << res->getRemoteAddressAsText() << "'";
-            ss << " '" << req->getCaseSensitiveMethod();
-            ss << " " << req->getFullUrl() << " HTTP/1.1'";
-            ss << " 'ABORTED'";
-            ss << " '" << req->getHeader("host") << "'";
-            ss << " '" << req->getHeader("user-agent") << "'";
-            res->onAborted([str = std::move(ss.str())](){
+            std::string str = "http - '" + std::string(res->getRemoteAddressAsText()) + "'";
+            str.append(" '").append(req->getCaseSensitiveMethod());
+            str.append(" ").append(req->getFullUrl()).append(" HTTP/1.1'");
+            str.append(" 'ABORTED'");
+            str.append(" '").append(req->getHeader("host")).append("'");
+            str.append(" '").append(req->getHeader("user-agent")).append("'");
+            res->onAborted([str = std::move(str)](){
                 logger::trace(str);
             });
         }
         else
         {
+            // stateless, so it is stored without allocation
             res->onAborted([](){/*do nothing*/});
         }
 
@@ -677,7 +1439,7 @@ private:
         {
             // redirect to non-trailing slash url
             auto location = (is_ssl_enabled() ? "https://" : "http://") + std::string(host) + std::string(path.data(), path.size()-1);
-            response.header("Location", location.c_str());
+            response.header("Location", location);
             response.moved_permanently().end();
             return;
         }
@@ -708,19 +1470,62 @@ private:
         return desc;
     }
 
+    // An encoded thing description, valid as long as the
+    // description generations of the described things are unchanged
+    struct CachedDescription
+    {
+        std::vector<uint64_t> generations;
+        PrecompressedContent content;
+    };
+
+    // Thing descriptions are cached per thing, host and format, as their links
+    // refer to the host the client requested. Only accessed from the webserver's
+    // event loop.
+    CachedDescription& cached_description(const std::string& thing_id, uWS::HttpRequest* req, const Response& response)
+    {
+        std::string key = thing_id + ";" + (is_ssl_enabled() ? "https://" : "http://") + std::string(req->getHeader("host"))
+            + ";" + std::string(content_type(response.get_format()));
+
+        // without host validation any host is answered, which must not grow the cache unbounded
+        if(description_cache.size() >= DESCRIPTION_CACHE_MAX_SIZE && description_cache.count(key) == 0)
+            description_cache.clear();
+
+        return description_cache[key];
+    }
+
+    // Drop the cached descriptions of a thing, "" for the descriptions of all things
+    void invalidate_descriptions(const std::string& thing_id)
+    {
+        auto prefix = thing_id + ";";
+        auto it = description_cache.lower_bound(prefix);
+        while(it != description_cache.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+            it = description_cache.erase(it);
+    }
+
     void handle_things(uwsHttpResponse* res, uWS::HttpRequest* req)
     {
         Response response(req, res);
 
-        json descriptions = json::array();
-        
-        for(auto thing : things.get_things())
+        auto hosted_things = things.get_things();
+        std::vector<uint64_t> generations;
+        for(auto thing : hosted_things)
+            generations.push_back(thing->get_description_generation());
+
+        auto& cached = cached_description("", req, response);
+        if(cached.content.get().empty() || cached.generations != generations)
         {
-            json desc = prepare_thing_description(thing, req);
-            descriptions.push_back(desc);
+            json descriptions = json::array();
+            for(auto thing : hosted_things)
+                descriptions.push_back(prepare_thing_description(thing, req));
+
+            cached = {std::move(generations), PrecompressedContent(encode(descriptions, response.get_format()))};
         }
-        
-        response.json(descriptions.dump()).end();
+        else
+        {
+            description_cache_hits++;
+        }
+
+        response.content(cached.content).end();
     }
 
     void handle_thing(uwsHttpResponse* res, uWS::HttpRequest* req)
@@ -734,9 +1539,19 @@ private:
             return;
         }
 
-        json description = prepare_thing_description(*thing, req);
+        std::vector<uint64_t> generations = {(*thing)->get_description_generation()};
+        auto& cached = cached_description((*thing)->get_id(), req, response);
+        if(cached.content.get().empty() || cached.generations != generations)
+        {
+            json description = prepare_thing_description(*thing, req);
+            cached = {std::move(generations), PrecompressedContent(encode(description, response.get_format()))};
+        }
+        else
+        {
+            description_cache_hits++;
+        }
 
-        response.json(description.dump()).end();
+        response.content(cached.content).end();
     }
 
     void handle_properties(uwsHttpResponse* res, uWS::HttpRequest* req)
@@ -750,7 +1565,113 @@ private:
             return;
         }
 
-        response.json((*thing)->get_properties().dump()).end();
+        auto format = response.get_format();
+        auto encoding = response.get_encoding();
+        auto aborted = std::make_shared<bool>(false);
+        res->onAborted([aborted]{
+            *aborted = true;
+            logger::debug("properties request aborted");
+        });
+
+        auto respond = [res, thing, format, encoding, aborted](std::exception_ptr error)
+        {
+            respond_properties_get(res, format, encoding, aborted, error, [&thing]{
+                return (*thing)->get_property_snapshot()->values();
+            });
+        };
+
+        (*thing)->refresh_properties_async([this, respond](std::exception_ptr error){
+            run_on_loop([respond, error]{ respond(error); });
+        }, value_executor);
+    }
+
+    // Handles PUT requests setting multiple properties at once, e.g.
+    // {"on":true,"brightness":42}. None is set if any value is invalid.
+    // Responds with the values of the set properties.
+    // Pass the body of a request to received once it is complete, it may arrive
+    // in multiple chunks. Bodies exceeding HTTP_MAX_REQUEST_BODY_SIZE are
+    // answered with 413 Payload Too Large, without calling received.
+    static void receive_body(uwsHttpResponse* res, ContentFormat format, ContentEncoding encoding,
+        std::function<void (std::string_view /*body*/)> received)
+    {
+        auto buffer = std::make_shared<std::string>();
+        auto rejected = std::make_shared<bool>(false);
+        res->onData([res, format, encoding, buffer, rejected, received = std::move(received)](std::string_view chunk, bool is_last)
+        {
+            if(*rejected)
+                return;
+
+            if(buffer->size() + chunk.size() > HTTP_MAX_REQUEST_BODY_SIZE)
+            {
+                *rejected = true;
+                json body = {{"message", "Request body exceeds " + std::to_string(HTTP_MAX_REQUEST_BODY_SIZE) + " bytes"}};
+                Response(nullptr, res, format, encoding).payload_too_large().content(body).end();
+                return;
+            }
+
+            // a body received in a single chunk is not copied
+            if(is_last && buffer->empty())
+                return received(chunk);
+
+            buffer->append(chunk);
+            if(is_last)
+                received(*buffer);
+        });
+    }
+
+    void handle_properties_put(uwsHttpResponse* res, uWS::HttpRequest* req)
+    {
+        Response response(req, res);
+
+        auto thing = find_thing_from_url(req);
+        if(!thing)
+        {
+            response.not_found().end();
+            return;
+        }
+
+        auto format = negotiate_content_format(req->getHeader("accept"));
+        auto encoding = negotiate_content_encoding(req->getHeader("accept-encoding"));
+        auto aborted = std::make_shared<bool>(false);
+        receive_body(res, format, encoding, [this, res, thing, format, encoding, aborted](std::string_view body)
+        {
+            // the request is not accessible any longer once its body was received
+            Response response(nullptr, res, format, encoding);
+
+            try
+            {
+                if(body.empty())
+                    throw PropertyError("Empty properties request body");
+
+                auto values = parse_json_object_members(body);
+                if(!values)
+                    throw PropertyError("Properties request body is no json object");
+
+                std::vector<std::shared_ptr<PropertyBase>> properties;
+                for(const auto& value : *values)
+                    properties.push_back((*thing)->find_property(value.first));
+
+                set_properties_without_blocking(*thing, std::move(*values), [res, format, encoding, aborted, properties](std::exception_ptr error)
+                {
+                    respond_properties_set(res, format, encoding, aborted, error, [&properties]{
+                        json values = json::object();
+                        for(const auto& property : properties)
+                            values.update(property->get_property_value_object());
+                        return values;
+                    });
+                });
+            }
+            catch(std::exception& ex)
+            {
+                json body = {{"message", ex.what()}};
+                response.bad_request().content(body).end();
+            }
+        });
+
+        res->onAborted([aborted]{
+            *aborted = true;
+            logger::debug("properties request aborted");
+        });
     }
 
     void handle_property_get(uwsHttpResponse* res, uWS::HttpRequest* req)
@@ -774,7 +1695,24 @@ private:
             return;
         }
 
-        response.json(property->get_property_value_object().dump()).end();
+        auto format = response.get_format();
+        auto encoding = response.get_encoding();
+        auto aborted = std::make_shared<bool>(false);
+        res->onAborted([aborted]{
+            *aborted = true;
+            logger::debug("property request aborted");
+        });
+
+        auto respond = [res, property, format, encoding, aborted](std::exception_ptr error)
+        {
+            respond_properties_get(res, format, encoding, aborted, error, [&property]{
+                return property->get_property_value_object();
+            });
+        };
+
+        property->refresh_async([this, respond](std::exception_ptr error){
+            run_on_loop([respond, error]{ respond(error); });
+        }, value_executor);
     }
 
     void handle_property_put(uwsHttpResponse* res, uWS::HttpRequest* req)
@@ -798,51 +1736,47 @@ private:
             return;
         }
 
-        res->onData([res, req, thing, property_name_in_url, property](std::string_view body_chunk, bool is_last)
+        auto format = negotiate_content_format(req->getHeader("accept"));
+        auto encoding = negotiate_content_encoding(req->getHeader("accept-encoding"));
+        auto aborted = std::make_shared<bool>(false);
+        receive_body(res, format, encoding, [this, res, thing, prop_name = property->get_name(), property, format, encoding, aborted](std::string_view body_content)
         {
-            if(is_last)
+            // the request is not accessible any longer once its body was received
+            Response response(nullptr, res, format, encoding);
+
+            try
             {
-                Response response(req, res);
+                if(body_content.empty())
+                    throw PropertyError("Empty property request body");
 
-                try
-                {
-                    if(body_chunk.empty())
-                        throw PropertyError("Empty property request body");
-
-                    std::string prop_name = *property_name_in_url;
-                    json body = json::parse(body_chunk);
-
-                    if(!body.contains(prop_name))
-                        throw PropertyError("Property request body does not contain " + prop_name);
-
-                    auto v = body[prop_name];
-                    auto prop_setter = [&](auto val){
-                        (*thing)->set_property(prop_name, val);
-                    };
-
-                    if(v.is_boolean())
-                        prop_setter(v.get<bool>());
-                    else if(v.is_string())
-                        prop_setter(v.get<std::string>());                          
-                    else if(v.is_number_integer())
-                        prop_setter(v.get<int>());                            
-                    else if(v.is_number_float())
-                        prop_setter(v.get<double>());
-                    else
-                        prop_setter(v);
-
-                    response.json(property->get_property_value_object().dump()).end();
-                }
-                catch(std::exception& ex)
+                auto body = parse_json_object_members(body_content);
+
+                std::optional<json> value;
+                for(auto& member : body.value_or(JsonObjectMembers()))
+                    if(member.first == prop_name)
+                        value = std::move(member.second);
+
+                if(!value)
+                    throw PropertyError("Property request body does not contain " + prop_name);
+
+                JsonObjectMembers values = {{prop_name, std::move(*value)}};
+                set_properties_without_blocking(*thing, std::move(values), [res, format, encoding, aborted, property](std::exception_ptr error)
                 {
-                    json body = {{"message", ex.what()}};
-                    response.bad_request().json(body.dump()).end();
-                }
+                    respond_properties_set(res, format, encoding, aborted, error, [&property]{
+                        return property->get_property_value_object();
+                    });
+                });
+            }
+            catch(std::exception& ex)
+            {
+                json body = {{"message", ex.what()}};
+                response.bad_request().content(body).end();
             }
         });
 
-        res->onAborted([]{
-            logger::debug("transfer request body aborted");
+        res->onAborted([aborted]{
+            *aborted = true;
+            logger::debug("property request aborted");
         });
     }
 
@@ -862,7 +1796,7 @@ private:
 
         // can be std::nullopt which results in a collection of all actions
         auto action_name = find_action_name_from_url(req);
-        response.json((*thing)->get_action_descriptions(action_name).dump()).end();
+        response.content((*thing)->get_action_descriptions(action_name)).end();
     }
 
 
@@ -879,48 +1813,47 @@ private:
             return;
         }
 
-        auto action_name_in_url = find_action_name_from_url(req);
+        std::optional<std::string> action_name_in_url;
+        if(auto action_name = find_action_name_from_url(req))
+            action_name_in_url = std::string(*action_name);
 
-        res->onData([res, req, thing, action_name_in_url](std::string_view body_chunk, bool is_last)
+        auto format = negotiate_content_format(req->getHeader("accept"));
+        auto encoding = negotiate_content_encoding(req->getHeader("accept-encoding"));
+        receive_body(res, format, encoding, [this, res, thing, action_name_in_url, format, encoding](std::string_view body_content)
         {
-            if(is_last)
-            {
-                Response response(req, res);
+            // the request is not accessible any longer once its body was received
+            Response response(nullptr, res, format, encoding);
 
-                try
-                {
-                    if(body_chunk.empty())
-                        throw ActionError("Empty action request body");
+            try
+            {
+                if(body_content.empty())
+                    throw ActionError("Empty action request body");
 
-                    json body = json::parse(body_chunk);
-                    if(!body.is_object() || body.size() != 1 ||
-                        (action_name_in_url && !body.contains(action_name_in_url)))
-                        throw ActionError("Invalid action request body");
+                auto body = parse_json_object_members(body_content);
+                if(!body || body->size() != 1 ||
+                    (action_name_in_url && body->front().first != *action_name_in_url))
+                    throw ActionError("Invalid action request body");
 
-                    std::string action_name = action_name_in_url.value_or(body.begin().key());
-                    json action_params = body[action_name];
+                std::string action_name = body->front().first;
+                json& action_params = body->front().second;
 
-                    std::optional<json> input;
-                    if(action_params.contains("input"))
-                        input = action_params["input"];
+                std::optional<json> input;
+                if(action_params.contains("input"))
+                    input = action_params["input"];
 
-                    auto action = (*thing)->perform_action(action_name, std::move(input));
-                    if(!action)
-                        throw ActionError("Could not perform action");
+                auto action = (*thing)->perform_action(action_name, std::move(input));
+                if(!action)
+                    throw ActionError("Could not perform action");
 
-                    json response_body = action->as_action_description();
-                    std::thread action_runner([action]{
-                        action->start();
-                    });
-                    action_runner.detach();
+                json response_body = action->as_action_description();
+                start_action(action);
 
-                    response.created().json(response_body.dump()).end();
-                }
-                catch(std::exception& ex)
-                {
-                    json body = {{"message", ex.what()}};
-                    response.bad_request().json(body.dump()).end();
-                }
+                response.created().content(response_body).end();
+            }
+            catch(std::exception& ex)
+            {
+                json body = {{"message", ex.what()}};
+                response.bad_request().content(body).end();
             }
         });
 
@@ -951,7 +1884,7 @@ private:
             return;
         }
 
-        response.json(action->as_action_description().dump()).end();
+        response.content(action->as_action_description()).end();
     }
 
     // TODO: this is not yet defined in the spec
@@ -1016,21 +1949,358 @@ private:
 
         // can be std::nullopt which results in a collection of all events
         auto event_name = find_event_name_from_url(req);
-        response.json((*thing)->get_event_descriptions(event_name).dump()).end();
+        response.content((*thing)->get_event_descriptions(event_name)).end();
+    }
+
+    // Set properties without blocking the server loop. Synchronous value
+    // forwarders are run by the value executor, if configured, while
+    // asynchronous ones are only started. completed is called on the server
+    // loop once all values were forwarded, or with ForwardTimeoutError when
+    // the longest forward timeout of the properties expired before. Values
+    // forwarded after the timeout are discarded, as the client was told that
+    // setting them timed out.
+    // throws PropertyError if a property is unknown or a value is invalid
+    void set_properties_without_blocking(Thing* thing, JsonObjectMembers values, ForwardCallback completed)
+    {
+        std::chrono::milliseconds timeout(0);
+        for(const auto& value : values)
+            if(auto property = thing->find_property(value.first))
+                timeout = std::max(timeout, property->get_forward_timeout());
+
+        // only accessed on the server loop
+        auto is_completed = std::make_shared<bool>(false);
+        auto complete = [is_completed, completed](std::exception_ptr error)
+        {
+            if(*is_completed)
+                return;
+            *is_completed = true;
+            completed(error);
+        };
+
+        auto discard = thing->set_properties_async(std::move(values), [this, complete](std::exception_ptr error)
+        {
+            run_on_loop([complete, error]{ complete(error); });
+        }, value_executor);
+
+        if(!*is_completed)
+            scheduler->schedule(timeout, [is_completed, complete, discard]{
+                if(*is_completed)
+                    return;
+                discard();
+                complete(std::make_exception_ptr(ForwardTimeoutError()));
+            });
+    }
+
+    // Respond to a request setting properties once their values were forwarded
+    // values -- supplies the values of the properties after they were set
+    static void respond_properties_set(uwsHttpResponse* res, ContentFormat format, ContentEncoding encoding,
+        const std::shared_ptr<bool>& aborted, std::exception_ptr error, const std::function<json()>& values)
+    {
+        if(*aborted)
+            return;
+
+        res->cork([&]{
+            Response response(nullptr, res, format, encoding);
+            try
+            {
+                if(error)
+                    std::rethrow_exception(error);
+                response.content(values()).end();
+            }
+            catch(ForwardTimeoutError& ex)
+            {
+                response.gateway_timeout().content(json{{"message", ex.what()}}).end();
+            }
+            catch(std::exception& ex)
+            {
+                response.bad_request().content(json{{"message", ex.what()}}).end();
+            }
+        });
+    }
+
+    // Respond to a request getting properties once outdated values were fetched
+    // values -- supplies the values of the properties
+    static void respond_properties_get(uwsHttpResponse* res, ContentFormat format, ContentEncoding encoding,
+        const std::shared_ptr<bool>& aborted, std::exception_ptr error, const std::function<json()>& values)
+    {
+        if(*aborted)
+            return;
+
+        res->cork([&]{
+            Response response(nullptr, res, format, encoding);
+            try
+            {
+                if(error)
+                    std::rethrow_exception(error);
+                response.content(values()).end();
+            }
+            catch(std::exception& ex)
+            {
+                response.bad_gateway().content(json{{"message", ex.what()}}).end();
+            }
+        });
+    }
+
+    // Actions performed asynchronously, e.g. coroutines, are started on the
+    // server loop, all others are performed on a thread of their own
+    void start_action(std::shared_ptr<Action> action)
+    {
+        if(action->performs_async())
+        {
+            action->start();
+            return;
+        }
+
+        std::thread action_runner([action]{
+            action->start();
+        });
+        action_runner.detach();
+    }
+
+    // Restore the property values of all things persisted before
+    void restore_property_values()
+    {
+        if(property_persistence.path.empty())
+            return;
+
+        property_snapshot_file = std::make_unique<SnapshotFile>(property_persistence.path);
+        try
+        {
+            auto snapshot = property_snapshot_file->load();
+            if(!snapshot)
+                return;
+
+            json values = json::from_msgpack(*snapshot, true, false);
+            for(auto thing : things.get_things())
+                if(values.is_object() && values.contains(thing->get_id()))
+                    thing->restore_property_values(values[thing->get_id()]);
+
+            logger::info("Restored property values from " + property_persistence.path);
+        }
+        catch(std::exception& ex)
+        {
+            logger::error("Restoring property values failed: " + std::string(ex.what()));
+        }
+    }
+
+    // Write the property values of all things, if any of them changed
+    void persist_property_values()
+    {
+        uint64_t generation = 0;
+        std::vector<std::shared_ptr<const Thing::PropertySnapshot>> snapshots;
+        for(auto thing : things.get_things())
+        {
+            snapshots.push_back(thing->get_property_snapshot());
+            generation += snapshots.back()->generation;
+        }
+        if(generation == persisted_property_generation)
+            return;
+
+        json values = json::object();
+        size_t index = 0;
+        for(auto thing : things.get_things())
+            values[thing->get_id()] = snapshots[index++]->values();
+
+        try
+        {
+            auto encoded = json::to_msgpack(values);
+            property_snapshot_file->save(std::string_view(reinterpret_cast<const char*>(encoded.data()), encoded.size()));
+            persisted_property_generation = generation;
+        }
+        catch(std::exception& ex)
+        {
+            logger::error("Persisting property values failed: " + std::string(ex.what()));
+        }
+    }
+
+    // Evict expired records periodically, if any storage has a max_age. Records
+    // are evicted on insert, expired ones also when no more are added. Storages
+    // configured with a max_age after their thing was added are evicted on insert only.
+    void schedule_eviction()
+    {
+        if(eviction)
+            return;
+
+        auto hosted = things.get_things();
+        if(std::none_of(hosted.begin(), hosted.end(), [](Thing* t){ return t->has_expiring_records(); }))
+            return;
+
+        eviction = scheduler->schedule_periodic(STORAGE_EVICTION_INTERVAL, [this]{
+            for(auto thing : things.get_things())
+                thing->evict_expired_records();
+        });
+    }
+
+    // Wake up the server loop when the next timer of the scheduler expires,
+    // called on the server loop whenever a timer was scheduled and advanced
+    void arm_scheduler_timer()
+    {
+        if(!scheduler_timer)
+            return;
+
+        auto next = scheduler->next_expiry();
+        if(!next)
+            return;
+
+        auto now = Scheduler::Clock::now();
+        if(scheduler_timer_expiry && *scheduler_timer_expiry <= *next && *scheduler_timer_expiry > now)
+            return;
+
+        auto delay = std::chrono::ceil<std::chrono::milliseconds>(*next - now);
+        scheduler_timer_expiry = *next;
+        us_timer_set(scheduler_timer, [](struct us_timer_t* t)
+        {
+            auto server = *static_cast<WebThingServer**>(us_timer_ext(t));
+            server->scheduler_timer_expiry.reset();
+            server->scheduler->advance();
+            server->arm_scheduler_timer();
+        }, static_cast<int>(std::max<int64_t>(delay.count(), 1)), 0);
+    }
+
+    // Run callback on the server loop, immediately when called from it
+    void run_on_loop(std::function<void()> callback)
+    {
+        if(std::this_thread::get_id() == webserver_thread_id)
+            callback();
+        else
+            webserver_loop->defer(std::move(callback));
     }
 
     // forward thing messages to servers websocket clients
-    void handle_thing_message(const std::string& topic, const json& message)
+    void handle_thing_message(MessageLog& message_log, const std::string& topic, const json& message)
     {
         if(!webserver_loop)
             return;
 
-        std::string t = topic;
-        std::string m = message.dump();
+        // property status messages are additionally published to a topic per
+        // property, serving websockets that subscribed to single properties only
+        MessageLog::Topics topics = {topic};
+        if(message.value("messageType", "") == "propertyStatus" && message.contains("data"))
+            for(const auto& property_entry : message["data"].items())
+                topics.push_back(topic + "/" + property_entry.key());
+
+        message_log.add(std::move(topics), message.dump(), [this](const auto& ts, const auto& m)
+        {
+            webserver_loop->defer([this, ts, m]{
+                logger::trace("server broadcast : " + ts.front() + " : " + m);
+                for(auto ws : conflating_websockets)
+                    ws->getUserData()->dropped = false;
+
+                // the message published to each topic, parsed once needed
+                std::vector<std::optional<json>> messages(ts.size());
+                auto message = [&](size_t i) -> const json&
+                {
+                    if(!messages[0])
+                        messages[0] = json::parse(m);
+                    if(!messages[i])
+                        messages[i] = single_property_message(*messages[0], ts[i].substr(ts[0].size() + 1));
+                    return *messages[i];
+                };
+
+                for(size_t i = 0; i < ts.size(); i++)
+                {
+                    // the topic of a property only gets the value of this property
+                    if(i > 0 && !has_subscribers(ts[i]))
+                        continue;
+
+                    web_server->publish(ts[i], i == 0 ? m : message(i).dump(), uWS::OpCode::TEXT, compress_websocket_messages());
+
+                    // binary encodings are only created when there are subscribers,
+                    // once per format and shared by all of them
+                    for(auto format : CONTENT_FORMATS)
+                    {
+                        if(!is_binary(format) || web_server->numSubscribers(format_topic(ts[i], format)) == 0)
+                            continue;
+
+                        send_encoded(message(i), format, [&](std::string_view encoded){
+                            web_server->publish(format_topic(ts[i], format), encoded, uWS::OpCode::BINARY, compress_websocket_messages());
+                        });
+                    }
+                }
+
+                // conflated values are sent on drain, which is after this message,
+                // so the values it delivered must not be sent again
+                for(auto it = conflating_websockets.begin(); it != conflating_websockets.end();)
+                {
+                    auto ws = *it;
+                    WebSocketData* data = ws->getUserData();
+                    if(!data->dropped)
+                        for(size_t i = 0; i < ts.size(); i++)
+                            if(ws->isSubscribed(data->topic(ts[i])))
+                                data->conflation.discard(message(i));
+                    it = data->conflation.empty() ? conflating_websockets.erase(it) : std::next(it);
+                }
+            });
+        });
+    }
+
+    // Whether a websocket subscribed to topic in any format
+    bool has_subscribers(const std::string& topic) const
+    {
+        return std::any_of(std::begin(CONTENT_FORMATS), std::end(CONTENT_FORMATS), [&](auto format){
+            return web_server->numSubscribers(format_topic(topic, format)) > 0;
+        });
+    }
+
+    // The property status message published to the topic of a single property,
+    // with the sequence number of the message containing all of its properties
+    static json single_property_message(const json& message, const std::string& property_name)
+    {
+        json single = {{"messageType", "propertyStatus"}, {"data", {{property_name, message["data"][property_name]}}}};
+        if(message.contains("sequence"))
+            single["sequence"] = message["sequence"];
+        return single;
+    }
+
+    // Send all messages a websocket missed after the given sequence number.
+    // When these are not retained any longer, or since is 0, a snapshot of all
+    // subscribed properties is sent instead. Clients should ignore messages with
+    // a sequence number lower than the last one they have processed, as messages
+    // might still be queued for publishing during synchronization. Messages per
+    // subscribed property of the same change share its sequence number.
+    template<class WebSocket>
+    void synchronize_websocket(WebSocket* ws, Thing* thing, const MessageLog& message_log, uint64_t since)
+    {
+        WebSocketData* data = ws->getUserData();
+        auto is_subscribed = [ws, data](const MessageLog::Topics& topics){
+            return std::any_of(topics.begin(), topics.end(), [ws, data](const auto& t){ return ws->isSubscribed(data->topic(t)); });
+        };
+
+        bool replayed = since > 0 && message_log.replay(since, [&](const auto& topics, const auto& message){
+            if(ws->isSubscribed(data->topic(topics.front())))
+            {
+                if(is_binary(data->format))
+                    send_message(ws, json::parse(message));
+                else
+                    ws->send(message, uWS::OpCode::TEXT, compress_websocket_messages());
+                return;
+            }
+
+            // websockets subscribed to single properties get their values only
+            if(!is_subscribed(topics))
+                return;
+            json parsed = json::parse(message);
+            for(size_t i = 1; i < topics.size(); i++)
+                if(ws->isSubscribed(data->topic(topics[i])))
+                    send_message(ws, single_property_message(parsed, topics[i].substr(topics[0].size() + 1)));
+        });
+
+        if(replayed)
+            return;
+
+        message_log.with_current_sequence([&](uint64_t sequence){
+            std::string properties_topic = data->topic(thing->get_id() + "/properties");
+            bool all_properties = ws->isSubscribed(properties_topic);
 
-        webserver_loop->defer([this, t, m]{
-            logger::trace("server broadcast : " + t + " : " + m);
-            web_server->publish(t, m, uWS::OpCode::TEXT);
+            json properties = json::object();
+            auto property_snapshot = thing->get_property_snapshot();
+            auto& names = *property_snapshot->names;
+            for(size_t i = 0; i < names.size(); i++)
+                if(all_properties || ws->isSubscribed(properties_topic + "/" + names[i]))
+                    properties[names[i]] = *property_snapshot->slots[i];
+
+            json snapshot = {{"messageType", "propertyStatus"}, {"data", properties}, {"sequence", sequence}};
+            send_message(ws, snapshot);
         });
     }
 
@@ -1043,10 +2313,46 @@ private:
     std::string base_path = "/";
     bool disable_host_validation = false;
     bool enable_mdns = true;
+    WebSocketOptions websocket_options;
 
+    // accepted hosts, sorted to be searched by the host header of requests,
+    // refreshed on the server loop for interfaces added while running
     std::vector<std::string> hosts;
-
-    uWS::Loop* webserver_loop; // Must be initialized from thread that calls start()
+    static constexpr std::chrono::seconds HOSTS_REFRESH_INTERVAL{10};
+    // serializes adding and removing things, lookups use the snapshot of things
+    std::mutex things_mutex;
+    // message logs are kept per thing id, emptied while a thing is removed
+    std::map<std::string, std::shared_ptr<MessageLog>> message_logs;
+    // message observers of the hosted things, the flag is reset on detaching
+    struct ObservedThing
+    {
+        Thing* thing;
+        Thing::ObserverId observer_id;
+        std::shared_ptr<std::atomic<bool>> observing;
+    };
+    std::map<std::string, ObservedThing> observed_things;
+    // websocket routes and open websockets per thing id, only accessed from the server loop
+    std::set<std::string> websocket_routes;
+    std::map<std::string, std::set<uwsWebSocket*>> websockets;
+    // websockets with conflated property values waiting for drain
+    std::set<uwsWebSocket*> conflating_websockets;
+    std::map<std::string, CachedDescription> description_cache;
+    static constexpr size_t DESCRIPTION_CACHE_MAX_SIZE = 64;
+    std::atomic<uint64_t> description_cache_hits = 0;
+    std::atomic<uint64_t> dropped_messages = 0;
+    std::atomic<uint64_t> conflated_messages = 0;
+
+    uWS::Loop* webserver_loop = nullptr; // Must be initialized from thread that calls start()
+    std::thread::id webserver_thread_id;
+    Executor value_executor;
+    std::shared_ptr<Scheduler> scheduler;
+    // one-shot timer of the server loop armed for the next expiry of the scheduler
+    struct us_timer_t* scheduler_timer = nullptr;
+    std::optional<Scheduler::Clock::time_point> scheduler_timer_expiry;
+    std::optional<Scheduler::TimerId> eviction;
+    PropertyPersistenceOptions property_persistence;
+    std::unique_ptr<SnapshotFile> property_snapshot_file;
+    uint64_t persisted_property_generation = 0;
     std::unique_ptr<uWebsocketsApp> web_server;
     std::unique_ptr<MdnsService> mdns_service;
 };
@@ -0,0 +1,124 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <bw/webthing/mapped_file.hpp>
+
+namespace bw::webthing {
+
+// A memory mapped file holding the latest of a series of snapshots, e.g. of
+// property values. Snapshots are written alternately to two slots, so the
+// previous snapshot stays intact while the next one is written. On load the
+// latest slot with a valid checksum is used.
+class SnapshotFile
+{
+public:
+    SnapshotFile(std::string path)
+        : path(std::move(path))
+    {}
+
+    SnapshotFile(const SnapshotFile& other) = delete;
+
+    ~SnapshotFile()
+    {
+        sync();
+    }
+
+    // Read the latest snapshot written before, std::nullopt if there is none
+    // throws std::runtime_error if the file exists but is not accessible
+    std::optional<std::string> load()
+    {
+        std::error_code ec;
+        if(!std::filesystem::exists(path, ec))
+            return std::nullopt;
+
+        MappedFile file(path);
+        size_t size = file.size() / 2;
+        std::optional<std::string> latest;
+        for(size_t slot = 0; slot < 2 && size >= HEADER_SIZE; slot++)
+        {
+            auto header = file.data() + slot * size;
+            uint32_t magic, payload_size, checksum;
+            uint64_t slot_sequence;
+            std::memcpy(&magic, header, 4);
+            std::memcpy(&payload_size, header + 4, 4);
+            std::memcpy(&slot_sequence, header + 8, 8);
+            std::memcpy(&checksum, header + 16, 4);
+
+            if(magic != MAGIC || payload_size > size - HEADER_SIZE || slot_sequence <= sequence ||
+                checksum != crc32(crc32(0, header + 4, 12), header + HEADER_SIZE, payload_size))
+                continue;
+
+            sequence = slot_sequence;
+            next_slot = 1 - slot;
+            latest = std::string(header + HEADER_SIZE, payload_size);
+        }
+        return latest;
+    }
+
+    // Write snapshot to the slot of the older snapshot
+    // throws std::runtime_error if the file could not be written
+    void save(std::string_view snapshot)
+    {
+        if(!file || HEADER_SIZE + snapshot.size() > slot_size)
+        {
+            // a grown file is written aside, so the previous one is replaced at once
+            slot_size = ((HEADER_SIZE + snapshot.size()) * 3 / 2 + 4095) & ~size_t(4095);
+            file.reset();
+            auto grown = std::make_unique<MappedFile>(path + ".tmp", 2 * slot_size);
+            write(*grown, 0, snapshot);
+            grown->sync(0, 2 * slot_size);
+            std::filesystem::rename(path + ".tmp", path);
+            file = std::move(grown);
+            next_slot = 1;
+            return;
+        }
+
+        write(*file, next_slot, snapshot);
+        next_slot = 1 - next_slot;
+    }
+
+    // Write the snapshots back to disk and wait until they were written,
+    // otherwise they are written back by the operating system
+    void sync()
+    {
+        if(file)
+            file->sync(0, file->size());
+    }
+
+private:
+    // magic (4), payload size (4), sequence (8), checksum (4), reserved (4)
+    static constexpr size_t HEADER_SIZE = 24;
+    static constexpr uint32_t MAGIC = 0x53505457; // "WTPS"
+
+    std::string path;
+    std::unique_ptr<MappedFile> file;
+    size_t slot_size = 0;
+    size_t next_slot = 0;
+    uint64_t sequence = 0;
+
+    void write(MappedFile& target, size_t slot, std::string_view snapshot)
+    {
+        auto header = target.data() + slot * slot_size;
+        uint32_t magic = MAGIC, payload_size = static_cast<uint32_t>(snapshot.size()), reserved = 0;
+        ++sequence;
+        std::memcpy(header + HEADER_SIZE, snapshot.data(), snapshot.size());
+        std::memcpy(header + 4, &payload_size, 4);
+        std::memcpy(header + 8, &sequence, 8);
+        uint32_t checksum = crc32(crc32(0, header + 4, 12), header + HEADER_SIZE, snapshot.size());
+        std::memcpy(header + 16, &checksum, 4);
+        std::memcpy(header + 20, &reserved, 4);
+        std::memcpy(header, &magic, 4);
+    }
+};
+
+} // bw::webthing
@@ -4,11 +4,25 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
+#include <bw/webthing/journal.hpp>
+
+#ifdef WT_WITH_PMR
+#include <memory_resource>
+#endif
 
 namespace bw::webthing {
 
@@ -16,30 +30,192 @@ struct StorageConfig
 {
     size_t max_size = SIZE_MAX;
     bool write_protected = true;
+    // elements older than max_age are evicted, zero keeps elements regardless of their age
+    std::chrono::milliseconds max_age = std::chrono::milliseconds::zero();
+    // limit of the accounted sizes of all elements, see storage_size()
+    size_t max_bytes = SIZE_MAX;
+#ifdef WT_WITH_PMR
+    // resource the storage allocates from, e.g. a pool for deterministic allocation
+    // on embedded targets, nullptr for the default resource. Must outlive the storage.
+    std::pmr::memory_resource* memory_resource = nullptr;
+#endif
+};
+
+#ifdef WT_WITH_PMR
+
+// Allocates the elements of a storage from the memory resource of its config.
+// Unlike std::pmr::polymorphic_allocator it is propagated when a storage is
+// assigned, so a storage keeps the resource it was configured with.
+template<class T> struct StorageAllocator
+{
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    StorageAllocator(std::pmr::memory_resource* resource = nullptr)
+        : resource(resource ? resource : std::pmr::get_default_resource())
+    {}
+
+    template<class U> StorageAllocator(const StorageAllocator<U>& other)
+        : resource(other.resource)
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template<class U> bool operator==(const StorageAllocator<U>& other) const
+    {
+        return resource->is_equal(*other.resource);
+    }
+
+    template<class U> bool operator!=(const StorageAllocator<U>& other) const
+    {
+        return !(*this == other);
+    }
+
+    std::pmr::memory_resource* resource;
+};
+
+template<class T> StorageAllocator<T> storage_allocator(const StorageConfig& config)
+{
+    return StorageAllocator<T>(config.memory_resource);
+}
+
+#else
+
+template<class T> using StorageAllocator = std::allocator<T>;
+
+template<class T> StorageAllocator<T> storage_allocator(const StorageConfig&)
+{
+    return StorageAllocator<T>();
+}
+
+#endif
+
+// Approximate number of bytes an element occupies in a storage, which is
+// overloaded for element types with payloads of varying size.
+template<class T> size_t storage_size(const T&)
+{
+    return sizeof(T);
+}
+
+inline size_t storage_size(const std::string& element)
+{
+    return sizeof(std::string) + element.size();
+}
+
+// Converts the elements of a storage to journal records and back, see attach_journal()
+template<class T> struct JournalCodec
+{
+    std::function<std::string (const T& /*element*/)> encode;
+    // may return std::nullopt to skip a record, e.g. of an unknown format
+    std::function<std::optional<T> (std::string_view /*payload*/)> decode;
+    // identifies elements updated or removed later on, required to journal
+    // update() and remove_if() of a FlexibleRingBuffer
+    std::function<std::string (const T& /*element*/)> key;
+};
+
+// Accounts age and size of stored elements, if limited by the storage config.
+// The oldest element is evicted while it exceeds any of these limits, except
+// for byte limits the latest element is kept regardless of its size.
+class StorageRetention
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Record
+    {
+        Clock::time_point added;
+        size_t bytes = 0;
+        // segment of the journal record containing the element, if journaled
+        Journal::SegmentId segment = 0;
+        // insertion order of the element, to find it by its key
+        uint64_t sequence = 0;
+    };
+
+    StorageRetention(const StorageConfig& config)
+        : max_age(config.max_age)
+        , max_bytes(config.max_bytes)
+    {}
+
+    bool is_tracking() const
+    {
+        return max_age.count() > 0 || max_bytes < SIZE_MAX;
+    }
+
+    template<class T> Record add(const T& element, Clock::time_point added)
+    {
+        Record record;
+        record.added = added;
+        if(max_bytes < SIZE_MAX)
+            record.bytes = storage_size(element);
+        total_bytes += record.bytes;
+        return record;
+    }
+
+    void remove(const Record& record)
+    {
+        total_bytes -= record.bytes;
+    }
+
+    bool is_exceeded(const Record& oldest, size_t count, Clock::time_point now) const
+    {
+        return (total_bytes > max_bytes && count > 1) ||
+            (max_age.count() > 0 && now - oldest.added > max_age);
+    }
+
+    size_t get_bytes() const
+    {
+        return total_bytes;
+    }
+
+    // Time a replayed journal record was appended at
+    static Clock::time_point journal_time(int64_t time)
+    {
+        return Clock::now() - std::chrono::milliseconds(Journal::now() - time);
+    }
+
+private:
+    std::chrono::milliseconds max_age;
+    size_t max_bytes;
+    size_t total_bytes = 0;
 };
 
 // A simple ring buffer that overwrites oldest elements when max_size is reached.
+// Elements exceeding max_age or max_bytes are evicted oldest first on insert
+// and by evict_expired(). Elements can be persisted by attaching a journal.
 // This ring buffer can not remove a subset of its elements. 
 template<class T>
 class SimpleRingBuffer
 {
 public:
     SimpleRingBuffer(size_t max_size = SIZE_MAX, bool write_protected = false)
-        : max_size(max_size)
+        : SimpleRingBuffer(StorageConfig{max_size, write_protected})
+    {}
+
+    SimpleRingBuffer(const StorageConfig& config)
+        : buffer(storage_allocator<T>(config))
+        , max_size(config.max_size)
         , current_size(0)
         , start_pos(0)
+        , retention(config)
+        , records(storage_allocator<StorageRetention::Record>(config))
     {
         if(max_size < SIZE_MAX)
             buffer.reserve(max_size);
 
-        if(write_protected)
+        if(config.write_protected)
             mutex = std::make_unique<std::mutex>();
     }
 
-    SimpleRingBuffer(const StorageConfig& config)
-        : SimpleRingBuffer(config.max_size, config.write_protected)
-    {}
-
     T& get(size_t index)
     {
         return buffer[resolve_index(index)];
@@ -53,17 +229,38 @@ public:
     void add(T element)
     {
         auto lock = conditional_lock();
+        Journal::SegmentId segment = 0;
+        if (journal)
+            segment = journal->append(Journal::RecordType::entry, codec.encode(element));
+        insert(std::move(element), StorageRetention::Clock::now(), segment);
+    }
 
-        if (current_size < max_size)
-        {
-            buffer.push_back(element);
-            ++current_size;
-        }
-        else
-        {
-            buffer[start_pos] = element;
-            start_pos = (start_pos + 1) % max_size;
-        }
+    // Persist elements in journal, starting with restoring the elements it
+    // contains. Should be attached in initialization phase, to an empty storage.
+    // throws std::logic_error if the storage is not empty
+    void attach_journal(std::shared_ptr<Journal> journal, JournalCodec<T> codec)
+    {
+        auto lock = conditional_lock();
+        if (current_size > 0)
+            throw std::logic_error("A journal can only be attached to an empty storage");
+
+        this->journal = std::move(journal);
+        this->codec = std::move(codec);
+        this->journal->replay([this](const Journal::Record& record){
+            if (record.type != Journal::RecordType::entry)
+                return;
+
+            if (auto element = this->codec.decode(record.payload))
+                insert(std::move(*element), StorageRetention::journal_time(record.time), record.segment);
+        });
+    }
+
+    // Evict elements that exceeded max_age since they were added,
+    // e.g. periodically when only few elements are added
+    void evict_expired()
+    {
+        auto lock = conditional_lock();
+        evict(StorageRetention::Clock::now());
     }
 
     size_t size() const
@@ -71,24 +268,111 @@ public:
         return current_size;
     }
 
+    // accounted sizes of all elements, if limited by max_bytes
+    size_t bytes() const
+    {
+        return retention.get_bytes();
+    }
+
     auto begin() { return Iterator(this, 0); }
     auto end() { return Iterator(this, current_size); }
     auto begin() const { return ConstIterator(this, 0); }
     auto end() const { return ConstIterator(this, current_size); }
 
 private:
-    std::vector<T> buffer;
+    std::vector<T, StorageAllocator<T>> buffer;
     size_t max_size;
     size_t current_size;
     size_t start_pos;
+    StorageRetention retention;
+    std::vector<StorageRetention::Record, StorageAllocator<StorageRetention::Record>> records; // parallel to buffer, if tracked
+    std::shared_ptr<Journal> journal;
+    JournalCodec<T> codec;
     std::unique_ptr<std::mutex> mutex;
 
+    bool is_recording() const
+    {
+        return retention.is_tracking() || journal;
+    }
+
+    void insert(T element, StorageRetention::Clock::time_point added, Journal::SegmentId segment)
+    {
+        if (current_size == max_size)
+            pop_front();
+
+        std::optional<StorageRetention::Record> record;
+        if (is_recording())
+        {
+            record = retention.add(element, added);
+            record->segment = segment;
+            if (segment)
+                journal->retain(segment);
+        }
+
+        size_t position;
+        if (current_size < buffer.size())
+        {
+            position = (start_pos + current_size) % buffer.size();
+            buffer[position] = std::move(element);
+        }
+        else
+        {
+            // grow a full buffer only when its oldest element is stored first
+            if (start_pos != 0)
+            {
+                std::rotate(buffer.begin(), buffer.begin() + start_pos, buffer.end());
+                if (!records.empty())
+                    std::rotate(records.begin(), records.begin() + start_pos, records.end());
+                start_pos = 0;
+            }
+            position = buffer.size();
+            buffer.push_back(std::move(element));
+        }
+
+        if (record)
+        {
+            records.resize(buffer.size());
+            records[position] = *record;
+        }
+
+        ++current_size;
+        evict(StorageRetention::Clock::now());
+    }
+
     const size_t resolve_index(size_t index) const
     {
         if (index >= current_size)
             throw std::out_of_range("Index out of range");
 
-        return (start_pos + index) % max_size;
+        return (start_pos + index) % buffer.size();
+    }
+
+    void pop_front()
+    {
+        // release the element, its slot might not be overwritten soon
+        if constexpr(std::is_default_constructible_v<T>)
+            buffer[start_pos] = T();
+        if (!records.empty())
+            release(records[start_pos]);
+
+        start_pos = (start_pos + 1) % buffer.size();
+        --current_size;
+    }
+
+    void release(const StorageRetention::Record& record)
+    {
+        retention.remove(record);
+        if (record.segment)
+            journal->release(record.segment);
+    }
+
+    void evict(StorageRetention::Clock::time_point now)
+    {
+        if (records.empty())
+            return;
+
+        while (current_size > 0 && retention.is_exceeded(records[start_pos], current_size, now))
+            pop_front();
     }
 
     std::unique_ptr<std::scoped_lock<std::mutex>> conditional_lock()
@@ -157,22 +441,27 @@ private:
 };
 
 // A more feature rich ring buffer that overwrites oldest elements when max_size is reached.
+// Elements exceeding max_age or max_bytes are evicted oldest first on insert and by evict_expired().
+// Elements, their updates and removals can be persisted by attaching a journal.
 // This ring buffer is able to remove a subset of its elements while maintaining the insertion order.
 template<class T>
 class FlexibleRingBuffer
 {
 public:
     FlexibleRingBuffer(size_t max_size = SIZE_MAX, bool write_protected = false)
-        : max_size(max_size)
+        : FlexibleRingBuffer(StorageConfig{max_size, write_protected})
+    {}
+
+    FlexibleRingBuffer(const StorageConfig& config)
+        : buffer(storage_allocator<T>(config))
+        , max_size(config.max_size)
+        , retention(config)
+        , records(storage_allocator<StorageRetention::Record>(config))
     {
-        if(write_protected)
+        if(config.write_protected)
             mutex = std::make_unique<std::mutex>();
     }
 
-    FlexibleRingBuffer(const StorageConfig& config)
-        : FlexibleRingBuffer(config.max_size, config.write_protected)
-    {}
-
     T& get(size_t index)
     {
         return buffer.at(index);
@@ -186,30 +475,224 @@ public:
     void add(T element)
     {
         auto lock = conditional_lock();
-        buffer.push_back(element);
-        if (size() > max_size)
-            buffer.pop_front();
+        Journal::SegmentId segment = 0;
+        if (journal)
+            segment = journal->append(Journal::RecordType::entry, codec.encode(element));
+        insert(std::move(element), StorageRetention::Clock::now(), segment);
+    }
+
+    // Journal the current state of a stored element, e.g. after it changed,
+    // so that replaying the journal restores it in this state. The element is
+    // found by its key, also while other threads add or remove elements.
+    void update(const T& element)
+    {
+        auto lock = conditional_lock();
+        if (!journal || !codec.key)
+            return;
+
+        auto sequence = sequences.find(codec.key(element));
+        if (sequence == sequences.end())
+            return;
+
+        // records are ordered by their sequence, also after removals
+        auto it = std::lower_bound(records.begin(), records.end(), sequence->second,
+            [](const StorageRetention::Record& r, uint64_t s){ return r.sequence < s; });
+        if (it == records.end() || it->sequence != sequence->second)
+            return;
+
+        auto& record = *it;
+        auto segment = journal->append(Journal::RecordType::entry, codec.encode(element));
+        journal->retain(segment);
+        if (record.segment)
+            journal->release(record.segment);
+        record.segment = segment;
+    }
+
+    // Persist elements in journal, starting with restoring the elements it
+    // contains. Should be attached in initialization phase, to an empty storage.
+    // Journaled storages are locked, as updates may come from other threads.
+    // throws std::logic_error if the storage is not empty
+    void attach_journal(std::shared_ptr<Journal> journal, JournalCodec<T> codec)
+    {
+        if (!mutex)
+            mutex = std::make_unique<std::mutex>();
+        auto lock = conditional_lock();
+        if (!buffer.empty())
+            throw std::logic_error("A journal can only be attached to an empty storage");
+
+        this->journal = std::move(journal);
+        this->codec = std::move(codec);
+
+        // updates replace and removals drop elements replayed before,
+        // which are stored in order of their first record afterwards
+        struct Replayed
+        {
+            T element;
+            StorageRetention::Clock::time_point added;
+            Journal::SegmentId segment;
+        };
+        std::vector<std::optional<Replayed>> replayed;
+        std::unordered_map<std::string, size_t> positions;
+
+        this->journal->replay([&](const Journal::Record& record){
+            if (record.type == Journal::RecordType::removal)
+            {
+                auto it = positions.find(std::string(record.payload));
+                if (it != positions.end())
+                {
+                    replayed[it->second].reset();
+                    positions.erase(it);
+                }
+                return;
+            }
+
+            auto element = this->codec.decode(record.payload);
+            if (!element)
+                return;
+
+            auto added = StorageRetention::journal_time(record.time);
+            if (this->codec.key)
+            {
+                auto [it, inserted] = positions.try_emplace(this->codec.key(*element), replayed.size());
+                if (!inserted)
+                {
+                    added = replayed[it->second]->added;
+                    replayed[it->second] = Replayed{std::move(*element), added, record.segment};
+                    return;
+                }
+            }
+            replayed.push_back(Replayed{std::move(*element), added, record.segment});
+        });
+
+        for (auto& r : replayed)
+            if (r)
+                insert(std::move(r->element), r->added, r->segment);
     }
 
     void remove_if(std::function<bool (const T& element)> predicate)
     {
         auto lock = conditional_lock();
-        buffer.erase(std::remove_if(buffer.begin(), buffer.end(), predicate), buffer.end());
+        if (records.empty())
+        {
+            buffer.erase(std::remove_if(buffer.begin(), buffer.end(), predicate), buffer.end());
+            return;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < buffer.size(); i++)
+        {
+            if (predicate(buffer[i]))
+            {
+                if (journal && codec.key)
+                    journal->append(Journal::RecordType::removal, codec.key(buffer[i]));
+                forget_key(buffer[i], records[i]);
+                release(records[i]);
+                continue;
+            }
+
+            if (kept != i)
+            {
+                buffer[kept] = std::move(buffer[i]);
+                records[kept] = records[i];
+            }
+            kept++;
+        }
+        buffer.erase(buffer.begin() + kept, buffer.end());
+        records.erase(records.begin() + kept, records.end());
+    }
+
+    // Evict elements that exceeded max_age since they were added,
+    // e.g. periodically when only few elements are added
+    void evict_expired()
+    {
+        auto lock = conditional_lock();
+        evict(StorageRetention::Clock::now());
     }
 
     size_t size() const
     {
         return buffer.size();
     }
+
+    // accounted sizes of all elements, if limited by max_bytes
+    size_t bytes() const
+    {
+        return retention.get_bytes();
+    }
     auto begin() { return buffer.begin(); }
     auto end() { return buffer.end(); }
     auto begin() const { return buffer.begin(); }
     auto end() const { return buffer.end(); }
 
 private:
-    std::deque<T> buffer;
+    std::deque<T, StorageAllocator<T>> buffer;
     size_t max_size;
+    StorageRetention retention;
+    std::deque<StorageRetention::Record, StorageAllocator<StorageRetention::Record>> records; // parallel to buffer, if tracked
+    std::shared_ptr<Journal> journal;
+    JournalCodec<T> codec;
     std::unique_ptr<std::mutex> mutex;
+    // sequences of the records of journaled elements by their keys, see update()
+    std::unordered_map<std::string, uint64_t> sequences;
+    uint64_t next_sequence = 0;
+
+    bool is_recording() const
+    {
+        return retention.is_tracking() || journal;
+    }
+
+    void insert(T element, StorageRetention::Clock::time_point added, Journal::SegmentId segment)
+    {
+        if (is_recording())
+        {
+            auto record = retention.add(element, added);
+            record.segment = segment;
+            record.sequence = ++next_sequence;
+            if (segment)
+                journal->retain(segment);
+            if (journal && codec.key)
+                sequences[codec.key(element)] = record.sequence;
+            records.push_back(record);
+        }
+        buffer.push_back(std::move(element));
+        if (size() > max_size)
+            pop_front();
+        evict(StorageRetention::Clock::now());
+    }
+
+    void pop_front()
+    {
+        if (!records.empty())
+        {
+            forget_key(buffer.front(), records.front());
+            release(records.front());
+            records.pop_front();
+        }
+        buffer.pop_front();
+    }
+
+    void forget_key(const T& element, const StorageRetention::Record& record)
+    {
+        if (!journal || !codec.key)
+            return;
+
+        auto it = sequences.find(codec.key(element));
+        if (it != sequences.end() && it->second == record.sequence)
+            sequences.erase(it);
+    }
+
+    void release(const StorageRetention::Record& record)
+    {
+        retention.remove(record);
+        if (record.segment)
+            journal->release(record.segment);
+    }
+
+    void evict(StorageRetention::Clock::time_point now)
+    {
+        while (!records.empty() && retention.is_exceeded(records.front(), records.size(), now))
+            pop_front();
+    }
 
     std::unique_ptr<std::scoped_lock<std::mutex>> conditional_lock()
     {
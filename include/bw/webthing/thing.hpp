@@ -4,13 +4,26 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <bw/webthing/action.hpp>
 #include <bw/webthing/constants.hpp>
 #include <bw/webthing/event.hpp>
 #include <bw/webthing/json.hpp>
+#include <bw/webthing/journal.hpp>
+#include <bw/webthing/json_parser.hpp>
+#include <bw/webthing/name_map.hpp>
 #include <bw/webthing/property.hpp>
+#include <bw/webthing/scheduler.hpp>
 #include <bw/webthing/storage.hpp>
+#include <bw/webthing/utils.hpp>
 
 namespace bw::webthing {
 
@@ -22,9 +35,31 @@ public:
     {
         json metadata;
         ActionSupplier class_supplier;
+        std::optional<std::chrono::milliseconds> timeout;
     };
 
     typedef std::function<void(const std::string& /*topic*/, const json& /*message*/)> MessageCallback; 
+    typedef uint64_t ObserverId;
+
+    // Values of all properties of a thing captured at the same instant
+    struct PropertySnapshot
+    {
+        // incremented with every change of the captured values
+        uint64_t generation = 0;
+        // property names in order, shared until properties are added or removed
+        std::shared_ptr<const std::vector<std::string>> names = std::make_shared<const std::vector<std::string>>();
+        // the value of each named property, shared with other snapshots until it changes
+        std::vector<std::shared_ptr<const json>> slots;
+
+        // Get the values as json object, e.g. {"brightness":42,"on":true}
+        json values() const
+        {
+            json values = json::object();
+            for(size_t i = 0; i < slots.size(); i++)
+                values[(*names)[i]] = *slots[i];
+            return values;
+        }
+    };
 
     Thing(std::string id, std::string title, std::vector<std::string> type, std::string description = "")
         : id(id), title(title), type(type), description(description)
@@ -92,6 +127,7 @@ public:
     void set_ui_href(std::string href)
     {
         ui_href = href;
+        description_generation++;
     }
 
     std::string get_id() const
@@ -122,6 +158,14 @@ public:
     void set_context(std::string context)
     {
         this->context = context;
+        description_generation++;
+    }
+
+    // Changes whenever the thing description changes, e.g. to tell
+    // whether a cached description is outdated
+    uint64_t get_description_generation() const
+    {
+        return description_generation;
     }
 
     json get_property_descriptions() const
@@ -134,7 +178,7 @@ public:
 
     // Get the thing's actions as json array
     // action_name -- Optional action name to get description for
-    json get_action_descriptions(std::optional<std::string> action_name = std::nullopt) const
+    json get_action_descriptions(std::optional<std::string_view> action_name = std::nullopt) const
     {
         json descriptions = json::array();
 
@@ -148,7 +192,7 @@ public:
 
     // Get the thing's events as json array.
     // event_name -- Optional event name to get description for
-    json get_event_descriptions(const std::optional<std::string>& event_name = std::nullopt) const
+    json get_event_descriptions(std::optional<std::string_view> event_name = std::nullopt) const
     {
         json descriptions = json::array();
 
@@ -162,20 +206,27 @@ public:
     void add_property(std::shared_ptr<PropertyBase> property)
     {
         property->set_href_prefix(href_prefix);
+        // captures changes, also of properties not notifying them
+        property->add_value_observer([this](json value_object){
+            property_values_changed(value_object);
+        });
         properties[property->get_name()] = property;
+        description_generation++;
+        capture_property_snapshot();
     }
 
     void remove_property(const PropertyBase& property)
     {
         properties.erase(property.get_name());
+        description_generation++;
+        capture_property_snapshot();
     }
 
     // Find a property by name
-    std::shared_ptr<PropertyBase> find_property(std::string property_name) const
+    std::shared_ptr<PropertyBase> find_property(std::string_view property_name) const
     {
-        if(properties.count(property_name) > 0)
-            return properties.at(property_name);
-        return nullptr;
+        auto it = properties.find(property_name);
+        return it != properties.end() ? it->second : nullptr;
     }
 
     template<class T>
@@ -186,6 +237,177 @@ public:
             prop->set_value(value);
     }
 
+    // Set multiple properties to json values as received via the web api.
+    // Find the properties to set to values and validate the values
+    // throws PropertyError if a property is unknown or a value is invalid
+    std::vector<std::shared_ptr<PropertyBase>> validate_properties(const JsonObjectMembers& values) const
+    {
+        std::vector<std::shared_ptr<PropertyBase>> properties_to_set;
+        for(const auto& [name, value] : values)
+        {
+            auto property = find_property(name);
+            if(!property)
+                throw PropertyError("Unknown property: " + name);
+
+            property->validate_json_value(value);
+            properties_to_set.push_back(property);
+        }
+        return properties_to_set;
+    }
+
+    // All values are validated before the first one is set, so none is set
+    // if any is invalid. The status of all changed properties is notified
+    // in a single propertyStatus message after the last one was set. Setting
+    // is not rolled back, if a value forwarder throws, the values set before
+    // remain set.
+    // throws PropertyError if a property is unknown or a value is invalid
+    void set_properties(const JsonObjectMembers& values)
+    {
+        auto properties_to_set = validate_properties(values);
+
+        update_properties([&]{
+            for(size_t i = 0; i < values.size(); i++)
+                properties_to_set[i]->set_json_value(values[i].second, false);
+        });
+    }
+
+    // Like set_properties, but without waiting for the value forwarders.
+    // Values are validated immediately, done is called on the thread the last
+    // forwarder completed on. The values forwarded successfully are set at
+    // once, even if forwarding others failed. done receives the first error.
+    // Returns a function to discard the values, e.g. once the caller timed
+    // out waiting for them. Values forwarded afterwards are not set and done
+    // is not called anymore.
+    // executor -- runs synchronous value forwarders, e.g. on a thread pool,
+    //             they are called on the calling thread if not given
+    // throws PropertyError if a property is unknown or a value is invalid
+    std::function<void()> set_properties_async(JsonObjectMembers values, ForwardCallback done, const Executor& executor = nullptr)
+    {
+        struct PendingForwards
+        {
+            JsonObjectMembers values;
+            std::vector<std::shared_ptr<PropertyBase>> properties;
+            std::vector<bool> forwarded;
+            size_t remaining;
+            bool discarded = false;
+            std::exception_ptr error;
+            ForwardCallback done;
+            std::mutex mutex;
+        };
+
+        auto pending = std::make_shared<PendingForwards>();
+        pending->properties = validate_properties(values);
+        pending->forwarded.resize(values.size(), false);
+        pending->remaining = values.size();
+        pending->values = std::move(values);
+        pending->done = std::move(done);
+
+        auto discard = [pending]{
+            std::scoped_lock<std::mutex> lock(pending->mutex);
+            pending->discarded = true;
+        };
+
+        if(pending->values.empty())
+        {
+            pending->done(nullptr);
+            return discard;
+        }
+
+        for(size_t i = 0; i < pending->values.size(); i++)
+        {
+            auto forward = [this, pending, i]{
+                pending->properties[i]->forward_json_value_async(pending->values[i].second, [this, pending, i](std::exception_ptr error){
+                    {
+                        std::scoped_lock<std::mutex> lock(pending->mutex);
+                        if(!error)
+                            pending->forwarded[i] = true;
+                        else if(!pending->error)
+                            pending->error = error;
+
+                        if(--pending->remaining > 0 || pending->discarded)
+                            return;
+                    }
+
+                    try
+                    {
+                        update_properties([&]{
+                            for(size_t j = 0; j < pending->values.size(); j++)
+                                if(pending->forwarded[j])
+                                    pending->properties[j]->update_json_value(pending->values[j].second);
+                        });
+                    }
+                    catch(...)
+                    {
+                        if(!pending->error)
+                            pending->error = std::current_exception();
+                    }
+                    pending->done(pending->error);
+                });
+            };
+
+            if(executor && !pending->properties[i]->forwards_async())
+                executor(forward);
+            else
+                forward();
+        }
+        return discard;
+    }
+
+    // Group changes of property values, e.g. sensor readings of the same
+    // instant. The changes made by updates on the current thread are applied
+    // to the property snapshot at once and notified in a single propertyStatus
+    // message. If updates throws, the changes made before are still applied.
+    void update_properties(const std::function<void()>& updates)
+    {
+        PropertyStatusBatch batch = {this};
+        auto outer_batch = std::exchange(property_status_batch, &batch);
+
+        std::exception_ptr error;
+        try
+        {
+            updates();
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        property_status_batch = outer_batch;
+        property_values_changed(batch.values);
+        if(!batch.data.empty())
+            property_notify({{"messageType", "propertyStatus"}, {"data", std::move(batch.data)}});
+
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // Restore property values captured before, e.g. persisted by the server
+    // before a restart, without forwarding them to the device. Values of
+    // unknown properties and of mismatching types are skipped.
+    void restore_property_values(const json& values)
+    {
+        if(!values.is_object())
+            return;
+
+        update_properties([&]{
+            for(auto& member : values.items())
+            {
+                auto property = find_property(member.key());
+                if(!property || member.value().is_null())
+                    continue;
+
+                try
+                {
+                    property->update_json_value(member.value());
+                }
+                catch(std::exception& ex)
+                {
+                    logger::debug("thing::restore_property_values : skipped '" + member.key() + "' " + ex.what());
+                }
+            }
+        });
+    }
+
     template<class T>
     std::optional<T> get_property(std::string property_name) const
     {
@@ -195,29 +417,79 @@ public:
         return std::nullopt;
     }
 
-    // Get a mapping of all properties and their values.
+    // Get a mapping of all properties and their values. Outdated values of
+    // lazy properties are not fetched, as their getters would block the
+    // caller, e.g. the server loop, see refresh_properties_async.
     json get_properties() const
     {
-        auto json = json::object();
+        return get_property_snapshot()->values();
+    }
+
+    // Fetch the outdated values of lazy properties, see LazyValue. done is
+    // called once all were fetched, with the first error fetching failed with.
+    // executor -- runs the value getters, they are called on the calling thread if not given
+    void refresh_properties_async(ForwardCallback done, const Executor& executor = nullptr) const
+    {
+        struct PendingRefreshes
+        {
+            size_t remaining;
+            std::exception_ptr error;
+            ForwardCallback done;
+            std::mutex mutex;
+        };
+
+        auto pending = std::make_shared<PendingRefreshes>();
+        pending->remaining = properties.size() + 1;
+        pending->done = std::move(done);
+
+        auto refreshed = [pending](std::exception_ptr error){
+            {
+                std::scoped_lock<std::mutex> lock(pending->mutex);
+                if(error && !pending->error)
+                    pending->error = error;
+                if(--pending->remaining > 0)
+                    return;
+            }
+            pending->done(pending->error);
+        };
 
         for(const auto& pe : properties)
-        {
-            json[pe.first] = pe.second->get_property_value_object()[pe.first];
-        }
-        return json;
+            pe.second->refresh_async(refreshed, executor);
+
+        // completes when all properties were refreshed immediately
+        refreshed(nullptr);
+    }
+
+    // Get the values of all properties captured at the same instant. A
+    // snapshot is immutable and replaced on every change of a property, so
+    // it can be serialized without blocking threads updating the values.
+    // Changes are captured before they are notified via property_notify.
+    std::shared_ptr<const PropertySnapshot> get_property_snapshot() const
+    {
+        return property_snapshot.load();
     }
 
     //Determine whether or not this thing has a given property.
     // property_name -- the property to look for
-    bool has_property(std::string property_name) const
+    bool has_property(std::string_view property_name) const
     {
        return properties.find(property_name) != properties.end();
     }
 
     void property_notify(json property_status_message)
     {
+        if(property_status_batch && property_status_batch->thing == this)
+        {
+            property_status_batch->data.update(property_status_message["data"]);
+            property_status_batch->values.update(property_status_message["data"]);
+            return;
+        }
+
+        update_property_snapshot(property_status_message["data"]);
+
         logger::debug("thing::property_notify : " + property_status_message.dump());
-        for(auto& observer : observers)
+        auto current = observers.load();
+        for(auto& [observer_id, observer] : *current)
             observer( id + "/properties", property_status_message);
     }
 
@@ -226,10 +498,11 @@ public:
     // input -- any action inputs 
     std::shared_ptr<Action> perform_action(std::string name, std::optional<json> input = std::nullopt)
     {
-        if(available_actions.count(name) == 0)
+        auto available_action = available_actions.find(name);
+        if(available_action == available_actions.end())
             return nullptr;
 
-        auto& action_type = available_actions[name];
+        auto& action_type = available_action->second;
 
         if(action_type.metadata.contains("input"))
         {
@@ -249,8 +522,12 @@ public:
         {
             auto action = action_type.class_supplier( std::move(input) );
             action->set_href_prefix(href_prefix);
+            auto scheduler = timeout_scheduler.lock();
+            if(action_type.timeout && !scheduler && !Scheduler::current())
+                logger::warn("thing::perform_action : no scheduler to time out action '" + name + "'");
+            action->set_timeout(action_type.timeout, scheduler ? scheduler.get() : Scheduler::current());
             action_notify(action_status_message(action));
-            actions[name].add(action);
+            actions.find(name)->second.add(action);
             return action;
         }
         catch(std::exception& ex)
@@ -262,33 +539,61 @@ public:
 
     // Add an available action.
     // name -- name of the action
-    // metadata -- action metadata, i.e. type, description, etc. as a json object
+    // metadata -- action metadata, i.e. type, description, etc. as a json object,
+    //   a "timeout" in milliseconds lets actions time out, its deadline is
+    //   scheduled on the scheduler set by set_scheduler, e.g. by the server
+    //   hosting the thing, or else the current one when an action is created.
+    //   It is not applied without a scheduler and not published with the metadata
     // class_supplier -- function to instantiate this action
     void add_available_action(std::string name, json metadata, ActionSupplier class_supplier)
     {
         if(!metadata.is_object())
             throw ActionError("Action metadata must be encoded as json object.");
 
-        available_actions[name] = { metadata, class_supplier };
-        actions[name] = {action_storage_config};
+        std::optional<std::chrono::milliseconds> timeout;
+        if(metadata.contains("timeout"))
+        {
+            if(!metadata["timeout"].is_number_integer() || metadata["timeout"].get<int64_t>() <= 0)
+                throw ActionError("Action timeout must be a positive number of milliseconds.");
+            timeout = std::chrono::milliseconds(metadata["timeout"].get<uint64_t>());
+            metadata.erase("timeout");
+        }
+
+        available_actions[name] = { metadata, class_supplier, timeout };
+        actions[name] = {storage_config(action_storage_config)};
+        attach_action_journal(name);
+        description_generation++;
     }
 
     void action_notify(json action_status_message)
     {
         logger::debug("thing::action_notify : " + action_status_message.dump());
-        for(auto& observer : observers)
+        auto current = observers.load();
+        for(auto& [observer_id, observer] : *current)
             observer( id + "/actions", action_status_message);
     }
 
+    // Journal the changed status of an action, once it was added to the
+    // storage. Called by the action, e.g. on the thread performing it.
+    void journal_action_status(const std::shared_ptr<Action>& action)
+    {
+        if(!action_journal_config)
+            return;
+
+        auto it = actions.find(action->get_name());
+        if(it != actions.end())
+            it->second.update(action);
+    }
+
     // Get an action by its name and id
     // return the action when found, std::nullopt otherwise
-    std::shared_ptr<Action> get_action(std::string action_name, std::string action_id) const
+    std::shared_ptr<Action> get_action(std::string_view action_name, std::string_view action_id) const
     {
-        if(actions.count(action_name) == 0)
+        auto it = actions.find(action_name);
+        if(it == actions.end())
             return nullptr;
 
-        const auto& actions_for_name = actions.at(action_name);
-        for(const auto& action : actions_for_name)
+        for(const auto& action : it->second)
             if(action->get_id() == action_id)
                 return action;
 
@@ -297,14 +602,14 @@ public:
 
     // Remove an existing action identified by its name and id
     // Returns bool indicating the presence of the action 
-    bool remove_action(std::string action_name, std::string action_id)
+    bool remove_action(std::string_view action_name, std::string_view action_id)
     {
         auto action = get_action(action_name, action_id);
         if(!action)
             return false;
         
         action->cancel();
-        auto& as = actions[action_name];
+        auto& as = actions.find(action_name)->second;
         as.remove_if([&action_id](auto a){return a->get_id() == action_id;});
         return true;
     }
@@ -325,6 +630,7 @@ public:
             throw EventError("Event metadata must be encoded as json object.");
 
         available_events[name] = metadata;
+        description_generation++;
     }
 
     void event_notify(const Event& event)
@@ -335,11 +641,19 @@ public:
         json message = event_message(event);
         logger::debug("thing::event_notify : " + message.dump());
 
-        for(auto& observer : observers)
+        auto current = observers.load();
+        for(auto& [observer_id, observer] : *current)
             observer( id + "/events/" + event.get_name(), message);
     }
 
     // Set the prefix of any hrefs associated with this thing.
+    // Scheduler the deadlines of actions timing out are scheduled on,
+    // set by the server hosting the thing
+    void set_scheduler(std::weak_ptr<Scheduler> scheduler)
+    {
+        timeout_scheduler = std::move(scheduler);
+    }
+
     void set_href_prefix(std::string prefix)
     {
         href_prefix = prefix;
@@ -350,18 +664,65 @@ public:
         for(auto& action_entry : actions)
             for(auto& action : action_entry.second)
                 action->set_href_prefix(prefix);
+
+        description_generation++;
     }
 
-    void add_message_observer(MessageCallback observer)
+    // Observe the messages of the thing, returns the id to remove the observer by
+    ObserverId add_message_observer(MessageCallback observer)
     {
-        observers.push_back(observer);
+        std::scoped_lock<std::mutex> lock(observers_mutex);
+        auto modified = std::make_shared<Observers>(*observers.load());
+        modified->emplace_back(++last_observer_id, std::move(observer));
+        observers.store(std::move(modified));
+        return last_observer_id;
+    }
+
+    // Remove an observer, messages notified concurrently may still reach it.
+    // Returns false if there is no observer with the id.
+    bool remove_message_observer(ObserverId observer_id)
+    {
+        std::scoped_lock<std::mutex> lock(observers_mutex);
+        auto current = observers.load();
+        auto modified = std::make_shared<Observers>();
+        std::copy_if(current->begin(), current->end(), std::back_inserter(*modified),
+            [observer_id](auto& observer){ return observer.first != observer_id; });
+        if(modified->size() == current->size())
+            return false;
+        observers.store(std::move(modified));
+        return true;
     }
 
     // configures the storage of events, should be set in initialization phase
     void configure_event_storage(const StorageConfig& config)
     {
         event_storage_config = config;
-        events = {event_storage_config};
+        events = {storage_config(event_storage_config)};
+        attach_event_journal();
+    }
+
+    // Persist events in a journal and restore the events stored in it,
+    // should be set in initialization phase
+    void configure_event_journal(const JournalConfig& config)
+    {
+        event_journal_config = config;
+        events = {storage_config(event_storage_config)};
+        attach_event_journal();
+    }
+
+    // Evict events and actions that exceeded the max_age of their storage,
+    // called periodically by the server
+    void evict_expired_records()
+    {
+        events.evict_expired();
+        for (auto& [action_name, actions] : actions)
+            actions.evict_expired();
+    }
+
+    // true if events or actions are evicted once they exceed a max_age
+    bool has_expiring_records() const
+    {
+        return event_storage_config.max_age.count() > 0 || action_storage_config.max_age.count() > 0;
     }
 
     // configures the storage of actions, should be set in initialization phase
@@ -371,26 +732,223 @@ public:
         action_storage_config = config;
         for (auto& [action_name, actions] : actions)
         {
-            actions = {action_storage_config};
+            actions = {storage_config(action_storage_config)};
+            attach_action_journal(action_name);
+        }
+    }
+
+    // Persist actions and their status in journals, one per action type
+    // stored in files starting with config.path followed by the action name,
+    // and restore the actions stored in them. Should be set in initialization
+    // phase, restored actions are not performed again.
+    void configure_action_journal(const JournalConfig& config)
+    {
+        action_journal_config = config;
+        for (auto& [action_name, actions] : actions)
+        {
+            actions = {storage_config(action_storage_config)};
+            attach_action_journal(action_name);
         }
     }
 
+#ifdef WT_WITH_PMR
+    // Allocate the storages of events and actions, as well as the events and
+    // actions created by make_record(), from resource, e.g. a pool over static
+    // memory on embedded targets. Records are pooled by their size, so the
+    // memory of evicted records is reused by later ones. Storages configured
+    // with a memory resource of their own keep it. Should be set in
+    // initialization phase, resource must be thread safe and outlive the thing
+    // and all of its records.
+    void set_memory_resource(std::pmr::memory_resource* resource)
+    {
+        memory_resource = resource;
+        record_pool = std::make_shared<std::pmr::synchronized_pool_resource>(resource);
+        configure_event_storage(event_storage_config);
+        configure_action_storage(action_storage_config);
+    }
+#endif
+
+    // Create an event or action of the thing, allocated from the pool of
+    // records if a memory resource was set
+    template<class T, class... Args> std::shared_ptr<T> make_record(Args&&... args)
+    {
+#ifdef WT_WITH_PMR
+        if(record_pool)
+            return std::allocate_shared<T>(RecordAllocator<T>(record_pool), std::forward<Args>(args)...);
+#endif
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
 protected:
     std::string id;
     std::string context = WEBTHINGS_IO_CONTEXT;
     std::string title;
     std::vector<std::string> type;
     std::string description;
-    std::map<std::string, std::shared_ptr<PropertyBase>> properties;
-    std::map<std::string, AvailableAction> available_actions;
-    std::map<std::string, json> available_events;
+    NameMap<std::shared_ptr<PropertyBase>> properties;
+    NameMap<AvailableAction> available_actions;
+    NameMap<json> available_events;
     StorageConfig action_storage_config = {10000};
-    std::map<std::string, FlexibleRingBuffer<std::shared_ptr<Action>>> actions;
+    NameMap<FlexibleRingBuffer<std::shared_ptr<Action>>> actions;
     StorageConfig event_storage_config = {100000};
     SimpleRingBuffer<std::shared_ptr<Event>> events = {event_storage_config};
+    std::optional<JournalConfig> event_journal_config;
+    std::optional<JournalConfig> action_journal_config;
     std::string href_prefix;
+    std::weak_ptr<Scheduler> timeout_scheduler;
     std::optional<std::string> ui_href;
-    std::vector<MessageCallback> observers;
+    // immutable, replaced by a modified copy when observers are added or removed
+    typedef std::vector<std::pair<ObserverId, MessageCallback>> Observers;
+    AtomicSharedPtr<const Observers> observers = std::make_shared<const Observers>();
+    std::mutex observers_mutex;
+    ObserverId last_observer_id = 0;
+    std::atomic<uint64_t> description_generation = 0;
+    AtomicSharedPtr<const PropertySnapshot> property_snapshot = std::make_shared<const PropertySnapshot>();
+    std::mutex property_snapshot_mutex;
+
+    // Property changes collected by update_properties on the current thread
+    struct PropertyStatusBatch
+    {
+        const Thing* thing;
+        // values to notify
+        json data = json::object();
+        // values to capture, including those of properties not notifying changes
+        json values = json::object();
+    };
+    inline static thread_local PropertyStatusBatch* property_status_batch = nullptr;
+
+#ifdef WT_WITH_PMR
+    // Allocates records from a pool, which is kept alive by the records
+    // allocated from it, as they might outlive the thing
+    template<class T> struct RecordAllocator
+    {
+        typedef T value_type;
+
+        RecordAllocator(std::shared_ptr<std::pmr::memory_resource> pool)
+            : pool(std::move(pool))
+        {}
+
+        template<class U> RecordAllocator(const RecordAllocator<U>& other)
+            : pool(other.pool)
+        {}
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(pool->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* p, size_t n)
+        {
+            pool->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        template<class U> bool operator==(const RecordAllocator<U>& other) const
+        {
+            return pool == other.pool;
+        }
+
+        template<class U> bool operator!=(const RecordAllocator<U>& other) const
+        {
+            return pool != other.pool;
+        }
+
+        std::shared_ptr<std::pmr::memory_resource> pool;
+    };
+
+    std::pmr::memory_resource* memory_resource = nullptr;
+    std::shared_ptr<std::pmr::memory_resource> record_pool;
+#endif
+
+    // Storage config of the thing's events or actions, allocating from
+    // the memory resource of the thing unless config has one of its own
+    StorageConfig storage_config(StorageConfig config) const
+    {
+#ifdef WT_WITH_PMR
+        if(!config.memory_resource)
+            config.memory_resource = memory_resource;
+#endif
+        return config;
+    }
+
+    void attach_event_journal()
+    {
+        if(event_journal_config)
+            events.attach_journal(std::make_shared<Journal>(*event_journal_config), make_event_journal_codec(this));
+    }
+
+    void attach_action_journal(const std::string& action_name)
+    {
+        if(!action_journal_config)
+            return;
+
+        auto config = *action_journal_config;
+        config.path += "-" + action_name;
+        actions[action_name].attach_journal(std::make_shared<Journal>(config), make_action_journal_codec(this));
+        for(auto& action : actions[action_name])
+            action->set_href_prefix(href_prefix);
+    }
+
+    // Capture changed values of properties, grouped while updating properties
+    void property_values_changed(const json& values)
+    {
+        if(property_status_batch && property_status_batch->thing == this)
+            property_status_batch->values.update(values);
+        else
+            update_property_snapshot(values);
+    }
+
+    // Replace the property snapshot by a copy containing the changed values
+    // of properties. Only the slots of these values are replaced, the others
+    // are shared. Writers are serialized, readers keep using the snapshot
+    // they already got.
+    void update_property_snapshot(const json& values)
+    {
+        if(!values.is_object() || values.empty())
+            return;
+
+        std::scoped_lock<std::mutex> lock(property_snapshot_mutex);
+        auto current = property_snapshot.load();
+        std::shared_ptr<PropertySnapshot> snapshot;
+        for(auto& member : values.items())
+        {
+            auto& names = *current->names;
+            auto it = std::lower_bound(names.begin(), names.end(), member.key());
+            if(it == names.end() || *it != member.key())
+                continue;
+
+            size_t slot = it - names.begin();
+            if(*current->slots[slot] == member.value())
+                continue;
+
+            if(!snapshot)
+            {
+                snapshot = std::make_shared<PropertySnapshot>(*current);
+                snapshot->generation++;
+            }
+            snapshot->slots[slot] = std::make_shared<const json>(member.value());
+        }
+
+        if(snapshot)
+            property_snapshot.store(std::move(snapshot));
+    }
+
+    // Capture the current values of all properties, e.g. after properties
+    // were added or removed
+    void capture_property_snapshot()
+    {
+        std::scoped_lock<std::mutex> lock(property_snapshot_mutex);
+        auto snapshot = std::make_shared<PropertySnapshot>();
+        snapshot->generation = property_snapshot.load()->generation + 1;
+
+        auto names = std::make_shared<std::vector<std::string>>();
+        for(const auto& pe : properties)
+        {
+            names->push_back(pe.first);
+            snapshot->slots.push_back(std::make_shared<const json>(pe.second->get_property_value_object()[pe.first]));
+        }
+        snapshot->names = std::move(names);
+        property_snapshot.store(std::move(snapshot));
+    }
 };
 
 } // bw::webthing
\ No newline at end of file
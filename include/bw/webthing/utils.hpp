@@ -4,14 +4,21 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <random>
 #include <regex>
 #include <sstream>
+#include <string_view>
 #include <thread>
 #include <time.h>
 
@@ -314,4 +321,101 @@ inline To try_static_cast(const From& value)
     throw std::bad_cast();
 }
 
+// remove leading and trailing whitespace
+inline std::string_view trim(std::string_view str)
+{
+    while(!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        str.remove_prefix(1);
+    while(!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        str.remove_suffix(1);
+    return str;
+}
+
+// Pass each element of a weighted http header value, e.g. "gzip;q=0.5, deflate",
+// with its quality to callback. Elements without quality value have quality 1.
+inline void for_each_weighted_value(std::string_view header, const std::function<void (std::string_view, double)>& callback)
+{
+    while(!header.empty())
+    {
+        size_t end = header.find(',');
+        std::string_view element = header.substr(0, end);
+        header = end == std::string_view::npos ? std::string_view() : header.substr(end + 1);
+
+        size_t params = element.find(';');
+        std::string_view value = trim(element.substr(0, params));
+
+        double quality = 1.0;
+        while(params != std::string_view::npos)
+        {
+            element = element.substr(params + 1);
+            params = element.find(';');
+            std::string_view param = trim(element.substr(0, params));
+            if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                quality = std::atof(std::string(param.substr(2)).c_str());
+        }
+
+        if(!value.empty())
+            callback(value, quality);
+    }
+}
+
+// compare strings case insensitive
+inline bool iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char ca, char cb){
+        return std::tolower(static_cast<unsigned char>(ca)) == std::tolower(static_cast<unsigned char>(cb));
+    });
+}
+
+// A shared_ptr loaded and replaced concurrently, e.g. an immutable snapshot.
+// Uses std::atomic<std::shared_ptr> where available, otherwise the atomic
+// shared_ptr functions of C++11, which are deprecated as of C++20. Neither
+// is guaranteed to be lock-free, e.g. libstdc++ implements the functions with
+// a pool of mutexes picked by address, held only while copying the pointer.
+template<class T> class AtomicSharedPtr
+{
+public:
+    AtomicSharedPtr(std::shared_ptr<T> ptr = nullptr)
+        : ptr(std::move(ptr))
+    {}
+
+    AtomicSharedPtr(const AtomicSharedPtr& other)
+        : ptr(other.load())
+    {}
+
+    AtomicSharedPtr& operator=(const AtomicSharedPtr& other)
+    {
+        store(other.load());
+        return *this;
+    }
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::shared_ptr<T> load() const
+    {
+        return ptr.load();
+    }
+
+    void store(std::shared_ptr<T> desired)
+    {
+        ptr.store(std::move(desired));
+    }
+
+private:
+    std::atomic<std::shared_ptr<T>> ptr;
+#else
+    std::shared_ptr<T> load() const
+    {
+        return std::atomic_load(&ptr);
+    }
+
+    void store(std::shared_ptr<T> desired)
+    {
+        std::atomic_store(&ptr, std::move(desired));
+    }
+
+private:
+    std::shared_ptr<T> ptr;
+#endif
+};
+
 } // bw::webthing
\ No newline at end of file
@@ -4,31 +4,136 @@
 
 #pragma once
 
+#include <chrono>
+#include <exception>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <vector>
+#include <bw/webthing/errors.hpp>
 
 namespace bw::webthing {
 
+// Time a value forwarder may take until waiting for it is given up
+constexpr std::chrono::milliseconds DEFAULT_FORWARD_TIMEOUT = std::chrono::seconds(5);
+
+// Called once a value was forwarded, with nullptr on success
+// or the exception forwarding the value failed with
+typedef std::function<void (std::exception_ptr)> ForwardCallback;
+
+// Runs a task, e.g. on a thread pool
+typedef std::function<void (std::function<void()> /*task*/)> Executor;
+
 template<class T>
-class Value
+class Value : public std::enable_shared_from_this<Value<T>>
 {
 public:
     typedef std::function<void (const T&)> ValueForwarder;
     typedef std::function<void (const T&)> ValueChangedCallback;
 
-    Value(std::optional<T> initial_value = std::nullopt, ValueForwarder value_forwarder = nullptr)
+    // Forwards a value without blocking the caller, e.g. to a device
+    // connected via a slow serial bus. done must be called exactly once,
+    // from any thread.
+    typedef std::function<void (const T&, ForwardCallback done)> AsyncValueForwarder;
+
+    Value(std::optional<T> initial_value = std::nullopt, ValueForwarder value_forwarder = nullptr,
+        std::chrono::milliseconds forward_timeout = DEFAULT_FORWARD_TIMEOUT)
         : last_value(initial_value)
         , value_forwarder(value_forwarder)
+        , forward_timeout(forward_timeout)
+    {
+    }
+
+    Value(std::optional<T> initial_value, AsyncValueForwarder async_value_forwarder,
+        std::chrono::milliseconds forward_timeout)
+        : last_value(initial_value)
+        , async_value_forwarder(async_value_forwarder)
+        , forward_timeout(forward_timeout)
     {
     }
 
+    virtual ~Value() = default;
+
+    // Forward and set the value, waits for an asynchronous value forwarder.
+    // The calling thread is blocked meanwhile, so the forwarder must not
+    // complete on it, e.g. on the server loop, see set_async instead. A value
+    // forwarded after the timeout is not set.
+    // throws ForwardTimeoutError if it did not complete within the forward timeout
     void set(T value)
     {
-        if (value_forwarder)
+        if (async_value_forwarder)
+        {
+            auto promise = std::make_shared<std::promise<void>>();
+            auto forwarded = promise->get_future();
+            forward_async(value, [promise](std::exception_ptr error){
+                error ? promise->set_exception(error) : promise->set_value();
+            });
+
+            if (forwarded.wait_for(forward_timeout) == std::future_status::timeout)
+                throw ForwardTimeoutError();
+            forwarded.get();
+        }
+        else if (value_forwarder)
+        {
             value_forwarder(value);
+        }
         notify_of_external_update(value);
     }
 
+    // Forward the value without waiting for an asynchronous value forwarder.
+    // The value is set once it was forwarded successfully, done is called
+    // afterwards on the thread the forwarder completed on. A value owned by a
+    // std::shared_ptr may be destroyed meanwhile, it is not set then. Any other
+    // value must outlive its forwarder.
+    void set_async(T value, ForwardCallback done)
+    {
+        auto weak_this = this->weak_from_this();
+        bool owned = !weak_this.expired();
+        forward_async(value, [this, weak_this, owned, value, done](std::exception_ptr error){
+            auto self = weak_this.lock();
+            if (!error && (self || !owned))
+                notify_of_external_update(value);
+            done(error);
+        });
+    }
+
+    // Forward the value without setting it. A synchronous value forwarder
+    // is called on the calling thread before done is called.
+    void forward_async(const T& value, ForwardCallback done)
+    {
+        try
+        {
+            if (async_value_forwarder)
+                return async_value_forwarder(value, done);
+            if (value_forwarder)
+                value_forwarder(value);
+        }
+        catch (...)
+        {
+            return done(std::current_exception());
+        }
+        done(nullptr);
+    }
+
+    bool forwards_async() const
+    {
+        return async_value_forwarder != nullptr;
+    }
+
+    std::chrono::milliseconds get_forward_timeout() const
+    {
+        return forward_timeout;
+    }
+
+    // Fetch the value from the device if the known value is outdated.
+    // Values updated by the device itself are never outdated.
+    virtual void refresh_async(ForwardCallback done, const Executor& /*executor*/)
+    {
+        done(nullptr);
+    }
+
     std::optional<T> get() const
     {
         return last_value;
@@ -48,6 +153,13 @@ public:
         observers.push_back(observer);
     }
 
+    // Call observer on the next change of the value only
+    void observe_next_change(ValueChangedCallback observer)
+    {
+        std::scoped_lock<std::mutex> lock(next_observers_mutex);
+        next_observers.push_back(observer);
+    }
+
 private:
 
     void notify_observers(T value)
@@ -56,11 +168,131 @@ private:
         {
             observer(value);
         }
+
+        std::vector<ValueChangedCallback> next;
+        {
+            std::scoped_lock<std::mutex> lock(next_observers_mutex);
+            next.swap(next_observers);
+        }
+        for (auto& observer : next)
+        {
+            observer(value);
+        }
     }
 
     std::optional<T> last_value;
     ValueForwarder value_forwarder;
+    AsyncValueForwarder async_value_forwarder;
+    std::chrono::milliseconds forward_timeout;
     std::vector<ValueChangedCallback> observers;
+    std::vector<ValueChangedCallback> next_observers;
+    std::mutex next_observers_mutex;
+};
+
+// A value that is read from the device on demand, e.g. a register of a
+// device that must be polled. A fetched value is cached for ttl. Values
+// fetched by an executor must be owned by a std::shared_ptr, e.g. created
+// by make_lazy_value, as they might be destroyed before the fetch runs.
+template<class T>
+class LazyValue : public Value<T>
+{
+public:
+    // Read the current value from the device, throws if it could not be read
+    typedef std::function<T ()> ValueGetter;
+
+    LazyValue(ValueGetter value_getter, std::chrono::milliseconds ttl,
+        typename Value<T>::ValueForwarder value_forwarder = nullptr)
+        : Value<T>(std::nullopt, value_forwarder)
+        , value_getter(value_getter)
+        , ttl(ttl)
+    {
+    }
+
+    // Refreshes still waiting for a fetch fail, e.g. when the value was
+    // destroyed before the executor ran its fetch
+    ~LazyValue()
+    {
+        auto error = std::make_exception_ptr(PropertyError("Value destroyed before it was fetched"));
+        for(auto& callback : waiting)
+            callback(error);
+    }
+
+    bool is_stale() const
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return is_stale_unlocked();
+    }
+
+    // Fetch the value unless the cached one is fresh. Concurrent calls share
+    // a single fetch, done is called once it completed on the thread the
+    // getter ran on, or immediately if the cached value is fresh.
+    // executor -- runs the getter, it is called on the calling thread if not given
+    // throws std::bad_weak_ptr if an executor is given, but the value is not owned by a std::shared_ptr
+    void refresh_async(ForwardCallback done, const Executor& executor) override
+    {
+        std::weak_ptr<LazyValue> weak_this;
+        if(executor)
+            weak_this = std::static_pointer_cast<LazyValue>(this->shared_from_this());
+
+        bool is_fresh = false;
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            is_fresh = !is_stale_unlocked();
+            if(!is_fresh)
+            {
+                waiting.push_back(std::move(done));
+                if(waiting.size() > 1)
+                    return;
+            }
+        }
+
+        if(is_fresh)
+            return done(nullptr);
+
+        if(executor)
+            executor([weak_this]{
+                if(auto self = weak_this.lock())
+                    self->fetch();
+            });
+        else
+            fetch();
+    }
+
+private:
+    // Read the value and complete all waiting refreshes
+    void fetch()
+    {
+        std::exception_ptr error;
+        try
+        {
+            this->notify_of_external_update(value_getter());
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        std::vector<ForwardCallback> completed;
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            if(!error)
+                fetched_at = std::chrono::steady_clock::now();
+            completed.swap(waiting);
+        }
+        for(auto& callback : completed)
+            callback(error);
+    }
+
+    bool is_stale_unlocked() const
+    {
+        return !fetched_at || std::chrono::steady_clock::now() - *fetched_at >= ttl;
+    }
+
+    ValueGetter value_getter;
+    std::chrono::milliseconds ttl;
+    std::optional<std::chrono::steady_clock::time_point> fetched_at;
+    std::vector<ForwardCallback> waiting;
+    mutable std::mutex mutex;
 };
 
 } // bw::webthing
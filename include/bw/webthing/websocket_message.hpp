@@ -0,0 +1,287 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <bw/webthing/content_format.hpp>
+#include <bw/webthing/json.hpp>
+#include <bw/webthing/json_parser.hpp>
+
+namespace bw::webthing {
+
+// An incoming websocket message of the form {"messageType":"...","data":{...}}
+// The entries of data are kept in order of appearance. Only nested values,
+// e.g. the input of a requested action, are represented as json objects/arrays.
+struct WebSocketMessage
+{
+    typedef std::pair<std::string, json> DataEntry;
+
+    std::optional<std::string> message_type;
+    bool has_data = false;
+    std::vector<DataEntry> data;
+
+    bool is_valid() const
+    {
+        return message_type && has_data;
+    }
+};
+
+// SAX handler which streams a serialized websocket message into a WebSocketMessage
+// without building a json document for the whole message.
+class WebSocketMessageParser
+{
+public:
+    typedef json::number_integer_t number_integer_t;
+    typedef json::number_unsigned_t number_unsigned_t;
+    typedef json::number_float_t number_float_t;
+    typedef json::string_t string_t;
+    typedef json::binary_t binary_t;
+
+    // Returns std::nullopt if message is not well-formed json.
+    static std::optional<WebSocketMessage> parse(std::string_view message)
+    {
+#ifdef WT_USE_SIMDJSON
+        try
+        {
+            return parse_with_simdjson(message);
+        }
+        catch(simdjson::simdjson_error&)
+        {
+            return std::nullopt;
+        }
+        catch(json::exception&)
+        {
+            return std::nullopt;
+        }
+#else
+        WebSocketMessageParser parser;
+        if(!json::sax_parse(message.begin(), message.end(), &parser))
+            return std::nullopt;
+        return std::move(parser.result);
+#endif
+    }
+
+    // Parse a message received in format.
+    // Returns std::nullopt if message is not well-formed.
+    static std::optional<WebSocketMessage> parse(std::string_view message, ContentFormat format)
+    {
+        if(!is_binary(format))
+            return parse(message);
+
+        json j;
+        try
+        {
+            j = decode(message, format);
+        }
+        catch(json::exception&)
+        {
+            return std::nullopt;
+        }
+
+        WebSocketMessage result;
+        if(!j.is_object())
+            return result;
+
+        if(j.contains("messageType") && j["messageType"].is_string())
+            result.message_type = j["messageType"].get<std::string>();
+
+        if(j.contains("data"))
+        {
+            result.has_data = true;
+            if(j["data"].is_object())
+                for(auto& entry : j["data"].items())
+                    result.data.emplace_back(entry.key(), std::move(entry.value()));
+        }
+
+        return result;
+    }
+
+    bool null()
+    {
+        add_value(nullptr);
+        return true;
+    }
+
+    bool boolean(bool val)
+    {
+        add_value(val);
+        return true;
+    }
+
+    bool number_integer(number_integer_t val)
+    {
+        add_value(val);
+        return true;
+    }
+
+    bool number_unsigned(number_unsigned_t val)
+    {
+        add_value(val);
+        return true;
+    }
+
+    bool number_float(number_float_t val, const string_t& /*s*/)
+    {
+        add_value(val);
+        return true;
+    }
+
+    bool string(string_t& val)
+    {
+        if(depth == 1 && current_key == "messageType")
+        {
+            result.message_type = std::move(val);
+            return true;
+        }
+        add_value(std::move(val));
+        return true;
+    }
+
+    bool binary(binary_t& val)
+    {
+        add_value(std::move(val));
+        return true;
+    }
+
+    bool start_object(std::size_t /*elements*/)
+    {
+        return start_structure(json::object());
+    }
+
+    bool key(string_t& val)
+    {
+        if(!nested.empty())
+            nested_element = &(*nested.back())[val];
+        else
+            current_key = std::move(val);
+        return true;
+    }
+
+    bool end_object()
+    {
+        return end_structure();
+    }
+
+    bool start_array(std::size_t /*elements*/)
+    {
+        return start_structure(json::array());
+    }
+
+    bool end_array()
+    {
+        return end_structure();
+    }
+
+    bool parse_error(std::size_t /*position*/, const std::string& /*last_token*/, const nlohmann::detail::exception& /*ex*/)
+    {
+        return false;
+    }
+
+private:
+#ifdef WT_USE_SIMDJSON
+    static WebSocketMessage parse_with_simdjson(std::string_view message)
+    {
+        WebSocketMessage result;
+
+        auto& document = simdjson_iterate(message);
+        if(document.type() != simdjson::ondemand::json_type::object)
+        {
+            simdjson_to_json(document);
+            simdjson_require_end(document);
+            return result;
+        }
+
+        // values outside of data are skipped without being converted
+        for(simdjson::ondemand::field field : document.get_object())
+        {
+            std::string_view key = field.unescaped_key();
+            simdjson::ondemand::value value = field.value();
+            if(key == "messageType" && value.type() == simdjson::ondemand::json_type::string)
+            {
+                result.message_type = std::string(std::string_view(value.get_string()));
+            }
+            else if(key == "data")
+            {
+                result.has_data = true;
+                if(value.type() != simdjson::ondemand::json_type::object)
+                {
+                    simdjson_to_json(value);
+                    continue;
+                }
+
+                for(simdjson::ondemand::field data_field : value.get_object())
+                    result.data.emplace_back(std::string_view(data_field.unescaped_key()), simdjson_to_json(data_field.value()));
+            }
+        }
+        simdjson_require_end(document);
+
+        return result;
+    }
+#endif
+
+    template<class Value>
+    json* add_value(Value&& val)
+    {
+        if(!nested.empty())
+        {
+            if(nested.back()->is_array())
+            {
+                nested.back()->emplace_back(std::forward<Value>(val));
+                return &nested.back()->back();
+            }
+            *nested_element = std::forward<Value>(val);
+            return nested_element;
+        }
+
+        if(depth == 1 && current_key == "data")
+            result.has_data = true;
+        else if(depth == 2 && in_data)
+        {
+            result.data.emplace_back(current_key, std::forward<Value>(val));
+            return &result.data.back().second;
+        }
+
+        // values outside of data are not of interest
+        return &ignored;
+    }
+
+    bool start_structure(json&& structure)
+    {
+        if(!nested.empty() || (depth == 2 && in_data))
+            nested.push_back(add_value(std::move(structure)));
+        else if(depth == 1 && current_key == "data")
+        {
+            in_data = structure.is_object();
+            result.has_data = true;
+        }
+
+        ++depth;
+        return true;
+    }
+
+    bool end_structure()
+    {
+        --depth;
+        if(!nested.empty())
+            nested.pop_back();
+        else if(depth == 1)
+            in_data = false;
+        return true;
+    }
+
+    WebSocketMessage result;
+    std::size_t depth = 0;
+    bool in_data = false;
+    std::string current_key;
+    std::vector<json*> nested;
+    json* nested_element = nullptr;
+    json ignored;
+};
+
+} // bw::webthing
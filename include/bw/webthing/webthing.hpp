@@ -5,13 +5,25 @@
 #pragma once
 
 #include <bw/webthing/action.hpp>
+#include <bw/webthing/arena.hpp>
+#include <bw/webthing/compression.hpp>
+#include <bw/webthing/content_format.hpp>
+#include <bw/webthing/coroutine.hpp>
 #include <bw/webthing/errors.hpp>
 #include <bw/webthing/event.hpp>
+#include <bw/webthing/journal.hpp>
 #include <bw/webthing/json.hpp>
+#include <bw/webthing/json_parser.hpp>
 #include <bw/webthing/json_validator.hpp>
+#include <bw/webthing/mapped_file.hpp>
 #include <bw/webthing/mdns.hpp>
+#include <bw/webthing/message_log.hpp>
+#include <bw/webthing/name_map.hpp>
+#include <bw/webthing/websocket_message.hpp>
 #include <bw/webthing/property.hpp>
+#include <bw/webthing/scheduler.hpp>
 #include <bw/webthing/server.hpp>
+#include <bw/webthing/snapshot_file.hpp>
 #include <bw/webthing/thing.hpp>
 #include <bw/webthing/utils.hpp>
 #include <bw/webthing/value.hpp>
@@ -42,6 +54,21 @@ template<class T> std::shared_ptr<Value<T>> make_value(T initial_value,  typenam
     return std::make_shared<Value<T>>(initial_value, std::move(value_forwarder));
 }
 
+// Create a value forwarded to the device without blocking the caller
+// forward_timeout -- time until waiting for the forwarder is given up
+template<class T> std::shared_ptr<Value<T>> make_async_value(T initial_value, typename Value<T>::AsyncValueForwarder value_forwarder,
+    std::chrono::milliseconds forward_timeout = DEFAULT_FORWARD_TIMEOUT)
+{
+    return std::make_shared<Value<T>>(initial_value, std::move(value_forwarder), forward_timeout);
+}
+
+// Create a value read from the device on demand and cached for ttl
+template<class T> std::shared_ptr<Value<T>> make_lazy_value(typename LazyValue<T>::ValueGetter value_getter, std::chrono::milliseconds ttl,
+    typename Value<T>::ValueForwarder value_forwarder = nullptr)
+{
+    return std::make_shared<LazyValue<T>>(std::move(value_getter), ttl, std::move(value_forwarder));
+}
+
 template<class T> std::shared_ptr<Value<T>> make_unknown_value(typename Value<T>::ValueForwarder value_forwarder = nullptr)
 {
     return std::make_shared<Value<T>>(std::nullopt, std::move(value_forwarder));
@@ -84,7 +111,7 @@ inline void link_event(std::shared_ptr<Thing> thing, std::string name, json meta
 
 inline std::shared_ptr<Event> emit_event(Thing* thing, std::string name, std::optional<json> data = std::nullopt)
 {
-    auto event = std::make_shared<Event>(thing, name, data);
+    auto event = thing->make_record<Event>(thing, name, data);
     thing->add_event(event);
     return event;
 }
@@ -96,14 +123,14 @@ inline std::shared_ptr<Event> emit_event(std::shared_ptr<Thing> thing, std::stri
 
 inline std::shared_ptr<Event> emit_event(Thing* thing, Event&& event)
 {
-    auto event_ptr = std::make_shared<Event>(event);
+    auto event_ptr = thing->make_record<Event>(event);
     thing->add_event(event_ptr);
     return event_ptr;
 }
 
 inline std::shared_ptr<Event> emit_event(std::shared_ptr<Thing> thing, Event&& event)
 {
-    auto event_ptr = std::make_shared<Event>(event);
+    auto event_ptr = thing->make_record<Event>(event);
     thing->add_event(event_ptr);
     return event_ptr;
 }
@@ -112,7 +139,7 @@ inline void link_action(Thing* thing, std::string action_name, json metadata,
     std::function<void()> perform_action = nullptr, std::function<void()> cancel_action = nullptr)
 {
     Thing::ActionSupplier action_supplier = [thing, action_name, perform_action, cancel_action](auto input){
-        return std::make_shared<Action>(generate_uuid(), 
+        return thing->make_record<Action>(generate_uuid(), 
             make_action_behavior(thing, perform_action, cancel_action),
             action_name, input);
     };
@@ -146,7 +173,7 @@ template<class ActionImpl> void link_action(Thing* thing, std::string action_nam
     if constexpr(std::is_constructible_v<ActionImpl, Thing*, std::optional<json>>)
     {
         action_supplier = [thing](auto input){
-            return std::make_shared<ActionImpl>(thing, input);
+            return thing->make_record<ActionImpl>(thing, input);
         };
     }
     else if constexpr(std::is_constructible_v<ActionImpl, Thing*, json>)
@@ -154,13 +181,13 @@ template<class ActionImpl> void link_action(Thing* thing, std::string action_nam
         action_supplier = [thing](auto input){
             if(!input)
                 throw ActionError("Input must not be empty for this Action type");
-            return std::make_shared<ActionImpl>(thing, input.value_or(json()));
+            return thing->make_record<ActionImpl>(thing, input.value_or(json()));
         };
     }
     else if constexpr(std::is_constructible_v<ActionImpl, Thing*>)
     {
         action_supplier = [thing](auto input){
-            return std::make_shared<ActionImpl>(thing);
+            return thing->make_record<ActionImpl>(thing);
         };
     }
     else
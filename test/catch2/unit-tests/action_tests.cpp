@@ -61,32 +61,38 @@ SCENARIO( "actions have a stateful lifecycle", "[action]" )
         struct CustomAction : public Action
         {
             CustomAction(void* thing_void_ptr)
-                : Action("abc123", {
-                    /*notify_thing*/[](json j){
-                        logger::info("THING GOT " + j.dump());
-                    },
-                    /*perform_action*/[&]{
-                        logger::info("CustomAction perform action with input:" + get_input().value_or(json()).dump());
-
-                        auto start_time = std::chrono::steady_clock::now();
-                        auto max_duration = std::chrono::milliseconds(300);
-
-                        while (!cancel_work && std::chrono::steady_clock::now() - start_time < max_duration)
-                        {
-                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                        }
-                        work_done = !cancel_work;
-                    },
-                    /*canel_action*/[&]{
-                        logger::info("CustomAction cancel action" + get_input().value_or(json()).dump());
-                        cancel_work = true;
-                    },
-                    /*get_thing*/[&]{
-                        return thing_ptr;
-                    }
-                }, "my-custom-action", json({"a", "b", "c"}))
+                : Action("abc123", make_behavior(this), "my-custom-action", json({"a", "b", "c"}))
                 , thing_ptr(thing_void_ptr)
             {}
+
+            static ActionBehavior make_behavior(CustomAction* self)
+            {
+                ActionBehavior behavior;
+                behavior.notify_thing = [](json j){
+                    logger::info("THING GOT " + j.dump());
+                };
+                behavior.perform_action = [self]{
+                    logger::info("CustomAction perform action with input:" + self->get_input().value_or(json()).dump());
+
+                    auto start_time = std::chrono::steady_clock::now();
+                    auto max_duration = std::chrono::milliseconds(300);
+
+                    while (!self->cancel_work && std::chrono::steady_clock::now() - start_time < max_duration)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    self->work_done = !self->cancel_work;
+                };
+                behavior.cancel_action = [self]{
+                    logger::info("CustomAction cancel action" + self->get_input().value_or(json()).dump());
+                    self->cancel_work = true;
+                };
+                behavior.get_thing = [self]{
+                    return self->thing_ptr;
+                };
+                return behavior;
+            }
+
             void* thing_ptr = nullptr;
             bool cancel_work = false;
             bool work_done = false;
@@ -140,13 +146,64 @@ SCENARIO( "actions have a stateful lifecycle", "[action]" )
             if(t.joinable())
                 t.join();
 
-            THEN("action will be considered completed but work to be unfinsihed")
+            THEN("action will be considered cancelled and work to be unfinsihed")
             {
-                REQUIRE( action.get_status() == "completed" );
+                REQUIRE( action.get_status() == "cancelled" );
                 REQUIRE_FALSE( action.work_done );
                 REQUIRE( action.get_time_completed() == "2025-02-17T02:34:56.000+00:00" );
             }
         }
     }
 
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Actions can be timed out and pass cancellation tokens", "[action]" )
+{
+    std::vector<std::string> notified;
+    bool cancel_action_called = false;
+    ActionBehavior behavior;
+    behavior.notify_thing = [&](json j){ notified.push_back(j["data"]["timed-action"]["status"]); };
+    behavior.cancel_action = [&]{ cancel_action_called = true; };
+    auto action = std::make_shared<Action>("abc123", behavior, "timed-action");
+
+    action->set_timeout(std::chrono::milliseconds(100));
+    REQUIRE( action->get_timeout() == std::chrono::milliseconds(100) );
+
+    auto token = action->get_cancellation_token();
+    int cancel_callbacks = 0;
+    token.on_cancel([&]{ cancel_callbacks++; });
+    REQUIRE_FALSE( token.is_cancelled() );
+
+    SECTION( "Actions that timed out are not completed afterwards" )
+    {
+        action->time_out();
+        REQUIRE( action->get_status() == "timedout" );
+        REQUIRE( action->get_time_completed() );
+        REQUIRE( token.is_cancelled() );
+        REQUIRE( action->is_cancelled() );
+        REQUIRE( cancel_callbacks == 1 );
+        REQUIRE( cancel_action_called );
+
+        // not performed any more
+        action->start();
+        action->finish();
+        action->cancel();
+        REQUIRE( action->get_status() == "timedout" );
+        REQUIRE( notified == std::vector<std::string>{"timedout"} );
+
+        token.on_cancel([&]{ cancel_callbacks++; });
+        REQUIRE( cancel_callbacks == 2 );
+    }
+
+    SECTION( "Completed actions are not cancelled" )
+    {
+        action->start();
+        action->cancel();
+        action->time_out();
+        REQUIRE( action->get_status() == "completed" );
+        REQUIRE_FALSE( token.is_cancelled() );
+        REQUIRE_FALSE( cancel_action_called );
+        REQUIRE( cancel_callbacks == 0 );
+        REQUIRE( notified == std::vector<std::string>{"pending", "completed"} );
+    }
+}
@@ -0,0 +1,91 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/arena.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "Arena allocates aligned memory until it is reset", "[arena]" )
+{
+    Arena arena(64);
+    REQUIRE( arena.capacity() == 0 );
+
+    auto c = static_cast<char*>(arena.allocate(1, 1));
+    auto d = static_cast<double*>(arena.allocate(sizeof(double), alignof(double)));
+    REQUIRE( reinterpret_cast<uintptr_t>(d) % alignof(double) == 0 );
+    REQUIRE( reinterpret_cast<char*>(d) > c );
+    REQUIRE( arena.capacity() == 64 );
+
+    std::string temporary = "http://localhost:8888/things";
+    auto copied = arena.copy(temporary);
+    temporary.clear();
+    REQUIRE( copied == "http://localhost:8888/things" );
+    REQUIRE( arena.copy("").empty() );
+
+    // allocations exceeding the block get a block of their own
+    arena.allocate(100);
+    REQUIRE( arena.capacity() == 64 + 100 );
+
+    // blocks are merged, so the next request fits into a single block
+    arena.reset();
+    REQUIRE( arena.capacity() == 164 );
+    auto first = static_cast<char*>(arena.allocate(150, 1));
+    REQUIRE( static_cast<char*>(arena.allocate(1, 1)) == first + 150 );
+    REQUIRE( arena.capacity() == 164 );
+}
+
+TEST_CASE( "Arena releases memory exceeding its retained capacity on reset", "[arena]" )
+{
+    Arena arena(64, 256);
+
+    // a single block exceeding the retained capacity is shrunk
+    arena.allocate(1000);
+    REQUIRE( arena.capacity() == 1000 );
+    arena.reset();
+    REQUIRE( arena.capacity() == 256 );
+
+    // merged blocks are capped as well
+    arena.allocate(200);
+    arena.allocate(200);
+    REQUIRE( arena.capacity() == 456 );
+    arena.reset();
+    REQUIRE( arena.capacity() == 256 );
+
+    // memory within the retained capacity is kept
+    auto first = static_cast<char*>(arena.allocate(100, 1));
+    arena.reset();
+    REQUIRE( static_cast<char*>(arena.allocate(100, 1)) == first );
+    REQUIRE( arena.capacity() == 256 );
+
+    Arena releasing(64, 0);
+    releasing.allocate(10);
+    releasing.reset();
+    REQUIRE( releasing.capacity() == 0 );
+}
+
+TEST_CASE( "Containers can allocate from an arena", "[arena]" )
+{
+    Arena arena;
+    std::vector<char, ArenaAllocator<char>> buffer{ArenaAllocator<char>(arena)};
+    for(int i = 0; i < 10000; i++)
+        buffer.push_back('a' + i % 26);
+
+    REQUIRE( buffer.size() == 10000 );
+    REQUIRE( buffer[27] == 'b' );
+
+    std::vector<std::pair<std::string_view, std::string_view>, ArenaAllocator<std::pair<std::string_view, std::string_view>>>
+        headers{ArenaAllocator<char>(arena)};
+    headers.emplace_back(arena.copy("Content-Type"), arena.copy("application/json"));
+    REQUIRE( headers[0].second == "application/json" );
+
+    auto capacity = arena.capacity();
+    arena.reset();
+    std::vector<char, ArenaAllocator<char>> reused{ArenaAllocator<char>(arena)};
+    reused.assign(10000, 'x');
+    REQUIRE( arena.capacity() == capacity );
+}
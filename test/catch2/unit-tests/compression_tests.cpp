@@ -0,0 +1,81 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/compression.hpp>
+
+using namespace bw::webthing;
+
+static std::string decompress(const std::string& data, ContentEncoding encoding)
+{
+    z_stream stream = {};
+    REQUIRE( inflateInit2(&stream, encoding == ContentEncoding::gzip ? MAX_WBITS + 16 : MAX_WBITS) == Z_OK );
+
+    std::string decompressed(64 * 1024, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(decompressed.data());
+    stream.avail_out = static_cast<uInt>(decompressed.size());
+
+    int result = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    REQUIRE( result == Z_STREAM_END );
+
+    decompressed.resize(stream.total_out);
+    return decompressed;
+}
+
+TEST_CASE( "Content encoding is negotiated by accept-encoding header", "[compression]" )
+{
+    REQUIRE( negotiate_content_encoding("") == ContentEncoding::identity );
+    REQUIRE( negotiate_content_encoding("br") == ContentEncoding::identity );
+    REQUIRE( negotiate_content_encoding("gzip") == ContentEncoding::gzip );
+    REQUIRE( negotiate_content_encoding("x-gzip") == ContentEncoding::gzip );
+    REQUIRE( negotiate_content_encoding("*") == ContentEncoding::gzip );
+    REQUIRE( negotiate_content_encoding("deflate") == ContentEncoding::deflate );
+    REQUIRE( negotiate_content_encoding("gzip, deflate, br") == ContentEncoding::gzip );
+    REQUIRE( negotiate_content_encoding("deflate, gzip") == ContentEncoding::deflate );
+    REQUIRE( negotiate_content_encoding("gzip;q=0.5, DEFLATE") == ContentEncoding::deflate );
+    REQUIRE( negotiate_content_encoding("gzip;q=0, deflate;q=0") == ContentEncoding::identity );
+}
+
+TEST_CASE( "Content can be compressed in gzip and deflate format", "[compression]" )
+{
+    std::string content;
+    for(int i = 0; i < 1000; i++)
+        content += "{\"brightness\":" + std::to_string(i) + "},";
+
+    REQUIRE( compress(content, ContentEncoding::identity) == content );
+
+    for(auto encoding : {ContentEncoding::gzip, ContentEncoding::deflate})
+    {
+        auto compressed = compress(content, encoding);
+        REQUIRE( compressed.size() < content.size() / 4 );
+        REQUIRE( decompress(compressed, encoding) == content );
+    }
+
+    auto gzip = compress(content, ContentEncoding::gzip);
+    REQUIRE( static_cast<unsigned char>(gzip[0]) == 0x1f );
+    REQUIRE( static_cast<unsigned char>(gzip[1]) == 0x8b );
+}
+
+TEST_CASE( "Precompressed content is compressed once per encoding", "[compression]" )
+{
+    PrecompressedContent content(std::string(2048, 'a'));
+    REQUIRE( content.get() == std::string(2048, 'a') );
+    REQUIRE( &content.get(ContentEncoding::identity) == &content.get() );
+
+    auto& gzip = content.get(ContentEncoding::gzip);
+    REQUIRE( &content.get(ContentEncoding::gzip) == &gzip );
+    REQUIRE( decompress(gzip, ContentEncoding::gzip) == content.get() );
+    REQUIRE( decompress(content.get(ContentEncoding::deflate), ContentEncoding::deflate) == content.get() );
+
+    content = PrecompressedContent(std::string(2048, 'b'));
+    REQUIRE( content.get() == std::string(2048, 'b') );
+    REQUIRE( decompress(content.get(ContentEncoding::gzip), ContentEncoding::gzip) == content.get() );
+
+    PrecompressedContent copy(content);
+    REQUIRE( copy.get() == content.get() );
+    REQUIRE( decompress(copy.get(ContentEncoding::deflate), ContentEncoding::deflate) == content.get() );
+}
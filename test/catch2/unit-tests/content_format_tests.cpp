@@ -0,0 +1,55 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/content_format.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "Content format is negotiated by accept header", "[content_format]" )
+{
+    REQUIRE( negotiate_content_format("") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("*/*") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("application/json") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("text/html") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("application/cbor") == ContentFormat::cbor );
+    REQUIRE( negotiate_content_format("Application/CBOR") == ContentFormat::cbor );
+    REQUIRE( negotiate_content_format("application/msgpack") == ContentFormat::msgpack );
+    REQUIRE( negotiate_content_format("application/x-msgpack") == ContentFormat::msgpack );
+    REQUIRE( negotiate_content_format("application/json, application/cbor") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("application/cbor, application/json") == ContentFormat::json );
+    REQUIRE( negotiate_content_format("application/json;q=0.5, application/cbor") == ContentFormat::cbor );
+    REQUIRE( negotiate_content_format("application/cbor;q=0.8, application/msgpack ; q=0.9, */*;q=0.1") == ContentFormat::msgpack );
+    REQUIRE( negotiate_content_format("application/cbor;q=0") == ContentFormat::json );
+}
+
+TEST_CASE( "Websocket format is negotiated by subprotocol", "[content_format]" )
+{
+    REQUIRE( negotiate_websocket_format("") == ContentFormat::json );
+    REQUIRE( negotiate_websocket_format("webthing") == ContentFormat::json );
+    REQUIRE( negotiate_websocket_format("webthing.cbor") == ContentFormat::cbor );
+    REQUIRE( negotiate_websocket_format("other, webthing.msgpack") == ContentFormat::msgpack );
+    REQUIRE( negotiate_websocket_format("webthing.msgpack,webthing.cbor") == ContentFormat::msgpack );
+}
+
+TEST_CASE( "Content can be encoded and decoded", "[content_format]" )
+{
+    json j = {{"messageType", "propertyStatus"}, {"data", {{"on", true}, {"level", 0.5}, {"name", "lamp"}}}};
+
+    for(auto format : CONTENT_FORMATS)
+        REQUIRE( decode(encode(j, format), format) == j );
+
+    REQUIRE( encode(j, ContentFormat::json) == j.dump() );
+    REQUIRE( encode(j, ContentFormat::cbor) != encode(j, ContentFormat::msgpack) );
+    REQUIRE( content_type(ContentFormat::cbor) == "application/cbor" );
+    REQUIRE_THROWS_AS( decode("\xff", ContentFormat::cbor), json::parse_error );
+
+    std::vector<char> buffer = {'x'};
+    for(auto format : CONTENT_FORMATS)
+    {
+        buffer.resize(1);
+        encode(j, format, buffer);
+        REQUIRE( std::string(buffer.begin() + 1, buffer.end()) == encode(j, format) );
+    }
+}
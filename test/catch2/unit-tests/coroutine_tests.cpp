@@ -0,0 +1,201 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/webthing.hpp>
+
+#ifdef WT_WITH_COROUTINES
+
+using namespace bw::webthing;
+using namespace std::chrono_literals;
+
+static ActionTask ramp(Scheduler& scheduler, std::vector<int>& steps, int to)
+{
+    for(int step = 1; step <= to; step++)
+    {
+        co_await sleep_for(scheduler, 10ms);
+        steps.push_back(step);
+    }
+}
+
+static ActionTask fail(Scheduler& scheduler)
+{
+    co_await sleep_for(scheduler, 10ms);
+    throw std::runtime_error("device not responding");
+}
+
+TEST_CASE( "Action tasks are resumed by the scheduler", "[coroutine]" )
+{
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+    std::vector<int> steps;
+    bool completed = false;
+    std::exception_ptr error;
+
+    auto task = ramp(scheduler, steps, 3);
+    REQUIRE( steps.empty() );
+
+    task.start([&](std::exception_ptr e){ completed = true; error = e; });
+    REQUIRE_THROWS_AS( task.start(nullptr), std::logic_error );
+    REQUIRE( scheduler.size() == 1 );
+
+    scheduler.advance(now + 25ms);
+    REQUIRE( steps == std::vector<int>{1} );
+    REQUIRE_FALSE( completed );
+
+    for(int i = 1; i < 10; i++)
+        scheduler.advance(now + i * 25ms);
+    REQUIRE( steps == std::vector<int>{1, 2, 3} );
+    REQUIRE( completed );
+    REQUIRE_FALSE( error );
+    REQUIRE( scheduler.size() == 0 );
+
+    SECTION( "Tasks can await other tasks" )
+    {
+        steps.clear();
+        completed = false;
+        [](Scheduler& scheduler, std::vector<int>& steps) -> ActionTask
+        {
+            co_await ramp(scheduler, steps, 2);
+            steps.push_back(42);
+            co_await fail(scheduler);
+            steps.push_back(43);
+        }(scheduler, steps).start([&](std::exception_ptr e){ completed = true; error = e; });
+
+        for(int i = 1; i < 10; i++)
+            scheduler.advance(now + 250ms + i * 25ms);
+        REQUIRE( steps == std::vector<int>{1, 2, 42} );
+        REQUIRE( completed );
+        REQUIRE_THROWS_WITH( std::rethrow_exception(error), "device not responding" );
+    }
+}
+
+TEST_CASE( "Action tasks can await value changes and resume on executors", "[coroutine]" )
+{
+    Value<int> level(0);
+    std::vector<std::function<void()>> queue;
+    Executor executor = [&](std::function<void()> task){ queue.push_back(task); };
+
+    std::vector<int> levels;
+    bool completed = false;
+    [](Value<int>& level, std::vector<int>& levels, Executor executor) -> ActionTask
+    {
+        levels.push_back(co_await next_change(level));
+        levels.push_back(co_await next_change(level));
+        co_await resume_on(executor);
+        levels.push_back(-1);
+    }(level, levels, executor).start([&](std::exception_ptr){ completed = true; });
+
+    level.notify_of_external_update(0);
+    REQUIRE( levels.empty() );
+    level.notify_of_external_update(5);
+    level.notify_of_external_update(7);
+    level.notify_of_external_update(9);
+    REQUIRE( levels == std::vector<int>{5, 7} );
+
+    REQUIRE( queue.size() == 1 );
+    REQUIRE_FALSE( completed );
+    queue.front()();
+    REQUIRE( levels == std::vector<int>{5, 7, -1} );
+    REQUIRE( completed );
+}
+
+struct RampAction : public Action
+{
+    RampAction(Thing* thing, std::optional<json> input)
+        : Action(generate_uuid(), thing, this, "ramp", input)
+    {}
+
+    ActionTask perform_action()
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            co_await sleep_for(10ms);
+            get_thing<Thing>()->set_property("level", i + 1);
+        }
+    }
+};
+
+TEST_CASE( "Coroutine actions finish once completed", "[coroutine][action]" )
+{
+    auto thing = make_thing();
+    link_property(thing, "level", 0);
+    link_action<RampAction>(thing, "ramp");
+
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+
+    auto action = thing->perform_action("ramp");
+    REQUIRE( action->performs_async() );
+
+    // sleep_for fails without a scheduler advanced by the thread starting the action
+    action->start();
+    REQUIRE( action->get_status() == "failed" );
+    REQUIRE( action->get_error() );
+    REQUIRE( *thing->get_property<int>("level") == 0 );
+
+    action = thing->perform_action("ramp");
+    Scheduler::set_current(&scheduler);
+    action->start();
+    Scheduler::set_current(nullptr);
+    REQUIRE( action->get_status() == "pending" );
+
+    std::weak_ptr<Action> weak_action = action;
+    thing->remove_action("ramp", action->get_id());
+    action.reset();
+    REQUIRE_FALSE( weak_action.expired() );
+
+    for(int i = 1; i < 10; i++)
+        scheduler.advance(now + i * 25ms);
+    REQUIRE( *thing->get_property<int>("level") == 3 );
+    REQUIRE( weak_action.expired() );
+}
+
+struct CalibrateAction : public Action
+{
+    CalibrateAction(Thing* thing, std::optional<json> input)
+        : Action(generate_uuid(), thing, this, "calibrate", input)
+    {}
+
+    ActionTask perform_action()
+    {
+        co_await sleep_for(10ms);
+        throw std::runtime_error("device not responding");
+    }
+};
+
+TEST_CASE( "Coroutine actions fail with the exception of their task", "[coroutine][action]" )
+{
+    auto thing = make_thing();
+    link_action<CalibrateAction>(thing, "calibrate");
+
+    std::vector<std::string> statuses;
+    thing->add_message_observer([&](const std::string&, const json& message){
+        if(message["messageType"] == "actionStatus")
+            statuses.push_back(message["data"]["calibrate"]["status"]);
+    });
+
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+
+    auto action = thing->perform_action("calibrate");
+    Scheduler::set_current(&scheduler);
+    action->start();
+    Scheduler::set_current(nullptr);
+    REQUIRE( action->get_status() == "pending" );
+
+    scheduler.advance(now + 20ms);
+    REQUIRE( action->get_status() == "failed" );
+    REQUIRE( action->get_error() == "device not responding" );
+    REQUIRE( action->get_time_completed() );
+    REQUIRE( action->as_action_description()["calibrate"]["error"] == "device not responding" );
+    REQUIRE( statuses.back() == "failed" );
+
+    // failed actions are not completed or cancelled afterwards
+    action->finish();
+    action->cancel();
+    REQUIRE( action->get_status() == "failed" );
+}
+
+#endif
@@ -0,0 +1,236 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/journal.hpp>
+#include <bw/webthing/storage.hpp>
+
+using namespace bw::webthing;
+
+namespace {
+
+// Directory removed with its journals at the end of a test
+struct JournalDirectory
+{
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("webthing-journal-" + generate_uuid());
+
+    ~JournalDirectory()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+
+    JournalConfig config(size_t segment_size = 1024, size_t sync_batch = 0) const
+    {
+        return {(path / "records").string(), segment_size, sync_batch};
+    }
+
+    std::vector<std::filesystem::path> segments() const
+    {
+        std::vector<std::filesystem::path> files;
+        for(auto& entry : std::filesystem::directory_iterator(path))
+            files.push_back(entry.path());
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+};
+
+std::vector<std::string> replay_payloads(Journal& journal)
+{
+    std::vector<std::string> payloads;
+    journal.replay([&](const Journal::Record& record){
+        payloads.push_back(std::string(record.payload));
+    });
+    return payloads;
+}
+
+JournalCodec<std::string> string_codec()
+{
+    return {
+        [](const std::string& element){ return element; },
+        [](std::string_view payload){ return std::optional<std::string>(std::string(payload)); },
+        [](const std::string& element){ return element.substr(0, element.find(':')); }
+    };
+}
+
+}
+
+TEST_CASE( "The journal replays appended records after reopening", "[journal]" )
+{
+    JournalDirectory directory;
+    std::vector<std::string> appended;
+    {
+        Journal journal(directory.config(1024, 4));
+        REQUIRE( replay_payloads(journal).empty() );
+
+        // records are kept while retained
+        for(int i = 0; i < 100; i++)
+        {
+            appended.push_back("record " + std::to_string(i) + std::string(i, 'x'));
+            journal.retain(journal.append(Journal::RecordType::entry, appended.back(), 1000 + i));
+        }
+        // records exceeding the segment size get a segment of their own
+        appended.push_back(std::string(5000, 'y'));
+        journal.retain(journal.append(Journal::RecordType::removal, appended.back(), 2000));
+        appended.push_back("");
+        journal.retain(journal.append(Journal::RecordType::entry, appended.back(), 3000));
+        REQUIRE( journal.segment_count() > 5 );
+    }
+
+    Journal journal(directory.config());
+    std::vector<Journal::Record> records;
+    std::vector<std::string> payloads;
+    journal.replay([&](const Journal::Record& record){
+        records.push_back(record);
+        payloads.push_back(std::string(record.payload));
+    });
+
+    REQUIRE( payloads == appended );
+    REQUIRE( records[0].type == Journal::RecordType::entry );
+    REQUIRE( records[0].time == 1000 );
+    REQUIRE( records[99].time == 1099 );
+    REQUIRE( records[100].type == Journal::RecordType::removal );
+    REQUIRE( records[101].time == 3000 );
+    REQUIRE( records[0].segment < records[101].segment );
+
+    // records appended after reopening are continued in a new segment
+    auto segment = journal.append(Journal::RecordType::entry, "next");
+    REQUIRE( segment > records[101].segment );
+}
+
+TEST_CASE( "The journal skips records of torn writes", "[journal]" )
+{
+    JournalDirectory directory;
+    {
+        Journal journal(directory.config());
+        journal.replay([](auto&){});
+        journal.append(Journal::RecordType::entry, "first");
+        journal.append(Journal::RecordType::entry, "second");
+        journal.append(Journal::RecordType::entry, "third");
+    }
+
+    auto segments = directory.segments();
+    REQUIRE( segments.size() == 1 );
+    {
+        // corrupt the payload of the second record
+        std::fstream file(segments[0], std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(32 + 24 + 2);
+        file.put('X');
+    }
+
+    Journal journal(directory.config());
+    REQUIRE( replay_payloads(journal) == std::vector<std::string>{"first"} );
+}
+
+TEST_CASE( "The journal deletes segments once their records were released", "[journal]" )
+{
+    JournalDirectory directory;
+    Journal journal(directory.config(256));
+    journal.replay([](auto&){});
+
+    std::vector<Journal::SegmentId> segments;
+    for(int i = 0; i < 10; i++)
+    {
+        segments.push_back(journal.append(Journal::RecordType::entry, std::string(200, 'a' + i)));
+        journal.retain(segments.back());
+    }
+    REQUIRE( journal.segment_count() == 10 );
+    REQUIRE( directory.segments().size() == 10 );
+
+    // only the oldest segments are deleted
+    journal.release(segments[1]);
+    REQUIRE( journal.segment_count() == 10 );
+    journal.release(segments[0]);
+    REQUIRE( journal.segment_count() == 8 );
+    REQUIRE( directory.segments().size() == 8 );
+
+    // the segment appended to is kept
+    for(int i = 2; i < 10; i++)
+        journal.release(segments[i]);
+    REQUIRE( journal.segment_count() == 1 );
+
+    Journal reopened(directory.config(256));
+    REQUIRE( replay_payloads(reopened) == std::vector<std::string>{std::string(200, 'j')} );
+}
+
+TEMPLATE_TEST_CASE( "RingBufferImpl restores its elements from a journal", "[journal][storage]",
+    SimpleRingBuffer<std::string>, FlexibleRingBuffer<std::string> )
+{
+    JournalDirectory directory;
+    {
+        TestType storage(StorageConfig{5});
+        storage.attach_journal(std::make_shared<Journal>(directory.config(256)), string_codec());
+        for(int i = 0; i < 50; i++)
+            storage.add(std::to_string(i) + ":" + std::string(100, 'x'));
+
+        // segments of evicted elements are deleted
+        REQUIRE( directory.segments().size() <= 4 );
+        REQUIRE_THROWS_AS( storage.attach_journal(std::make_shared<Journal>(directory.config()), string_codec()), std::logic_error );
+    }
+
+    {
+        TestType storage(StorageConfig{5});
+        storage.attach_journal(std::make_shared<Journal>(directory.config(256)), string_codec());
+        REQUIRE( storage.size() == 5 );
+        REQUIRE( storage.get(0) == "45:" + std::string(100, 'x') );
+        REQUIRE( storage.get(4) == "49:" + std::string(100, 'x') );
+    }
+
+    // elements older than max age are not restored
+    StorageConfig config{5};
+    config.max_age = std::chrono::milliseconds(50);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    TestType expired(config);
+    expired.attach_journal(std::make_shared<Journal>(directory.config(256)), string_codec());
+    REQUIRE( expired.size() == 0 );
+}
+
+TEST_CASE( "FlexibleRingBuffer restores updated and removed elements from a journal", "[journal][storage]" )
+{
+    JournalDirectory directory;
+    {
+        FlexibleRingBuffer<std::string> storage;
+        storage.attach_journal(std::make_shared<Journal>(directory.config()), string_codec());
+        storage.add("a:created");
+        storage.add("b:created");
+        storage.add("c:created");
+        storage.add("d:created");
+
+        storage.get(1) = "b:completed";
+        storage.update(storage.get(1));
+        storage.remove_if([](const std::string& element){ return element[0] == 'c'; });
+        storage.update("c:completed");
+    }
+
+    FlexibleRingBuffer<std::string> storage;
+    storage.attach_journal(std::make_shared<Journal>(directory.config()), string_codec());
+    REQUIRE( std::vector<std::string>(storage.begin(), storage.end()) ==
+        std::vector<std::string>{"a:created", "b:completed", "d:created"} );
+}
+
+TEST_CASE( "FlexibleRingBuffer finds updated elements by their key after evictions", "[journal][storage]" )
+{
+    JournalDirectory directory;
+    {
+        FlexibleRingBuffer<std::string> storage(2);
+        storage.attach_journal(std::make_shared<Journal>(directory.config()), string_codec());
+        storage.add("a:created");
+        storage.add("b:created");
+        storage.add("c:created");
+
+        // evicted elements are not journaled again
+        storage.update("a:completed");
+        storage.get(1) = "c:completed";
+        storage.update(storage.get(1));
+    }
+
+    FlexibleRingBuffer<std::string> storage(2);
+    storage.attach_journal(std::make_shared<Journal>(directory.config()), string_codec());
+    REQUIRE( std::vector<std::string>(storage.begin(), storage.end()) ==
+        std::vector<std::string>{"b:created", "c:completed"} );
+}
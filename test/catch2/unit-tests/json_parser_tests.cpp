@@ -0,0 +1,49 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/json_parser.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "JSON object members can be parsed", "[json]" )
+{
+    auto members = parse_json_object_members(
+        R"({"on":true,"brightness":42,"offset":-7,"level":0.5,"name":"lämp","none":null,"big":18446744073709551615,)"
+        R"("nested":{"input":{"steps":[1,[2.5,"x"],{"y":false}]}}})");
+
+    REQUIRE( members );
+    REQUIRE( members->size() == 8 );
+
+    json expected = json::parse(
+        R"({"on":true,"brightness":42,"offset":-7,"level":0.5,"name":"lämp","none":null,"big":18446744073709551615,)"
+        R"("nested":{"input":{"steps":[1,[2.5,"x"],{"y":false}]}}})");
+
+    size_t i = 0;
+    for(auto& expected_member : expected.items())
+    {
+        auto& member = (*members)[i++];
+        REQUIRE( member.first == expected_member.key() );
+        REQUIRE( member.second == expected_member.value() );
+        REQUIRE( member.second.type() == expected_member.value().type() );
+    }
+}
+
+TEST_CASE( "JSON payloads that are no objects have no members", "[json]" )
+{
+    REQUIRE_FALSE( parse_json_object_members("42") );
+    REQUIRE_FALSE( parse_json_object_members("[1,2]") );
+    REQUIRE_FALSE( parse_json_object_members("\"text\"") );
+    REQUIRE( parse_json_object_members("{}")->empty() );
+}
+
+TEST_CASE( "Malformed JSON payloads are rejected", "[json]" )
+{
+    REQUIRE_THROWS( parse_json_object_members("") );
+    REQUIRE_THROWS( parse_json_object_members("no json") );
+    REQUIRE_THROWS( parse_json_object_members(R"({"on":true)") );
+    REQUIRE_THROWS( parse_json_object_members(R"({"on":tru})") );
+    REQUIRE_THROWS( parse_json_object_members(R"({"on":true} trailing)") );
+    REQUIRE_THROWS( parse_json_object_members(R"({"on":true}{"off":false})") );
+}
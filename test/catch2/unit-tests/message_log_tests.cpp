@@ -0,0 +1,144 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/message_log.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "MessageLog assigns sequence numbers to messages", "[message_log]" )
+{
+    MessageLog log(10);
+    REQUIRE( log.get_sequence() == 0 );
+
+    std::vector<std::string> published;
+    auto publish = [&](const auto& topics, const auto& message){
+        published.push_back(topics.front() + " " + message);
+    };
+
+    REQUIRE( log.add({"thing/properties"}, R"({"messageType":"propertyStatus","data":{"on":true}})", publish) == 1 );
+    REQUIRE( log.add({"thing/actions"}, R"({"messageType":"actionStatus","data":{}})", publish) == 2 );
+    REQUIRE( log.add({"thing/events/e"}, "{}", publish) == 3 );
+    REQUIRE( log.get_sequence() == 3 );
+
+    std::vector<std::string> expected = {
+        R"(thing/properties {"messageType":"propertyStatus","data":{"on":true},"sequence":1})",
+        R"(thing/actions {"messageType":"actionStatus","data":{},"sequence":2})",
+        R"(thing/events/e {"sequence":3})"
+    };
+    REQUIRE( published == expected );
+}
+
+TEST_CASE( "MessageLog replays retained messages", "[message_log]" )
+{
+    MessageLog log(3);
+    for(int i = 1; i <= 5; i++)
+        log.add({"topic-" + std::to_string(i)}, "{}");
+
+    std::vector<std::string> replayed;
+    auto consumer = [&](const auto& topics, const auto& message){
+        replayed.push_back(topics.front());
+    };
+
+    // messages 3, 4 and 5 are retained
+    REQUIRE( log.replay(2, consumer) );
+    REQUIRE( replayed == std::vector<std::string>{"topic-3", "topic-4", "topic-5"} );
+
+    replayed.clear();
+    REQUIRE( log.replay(4, consumer) );
+    REQUIRE( replayed == std::vector<std::string>{"topic-5"} );
+
+    // nothing missed
+    replayed.clear();
+    REQUIRE( log.replay(5, consumer) );
+    REQUIRE( replayed.empty() );
+
+    // message 2 was already dropped
+    REQUIRE_FALSE( log.replay(1, consumer) );
+    // unknown sequence
+    REQUIRE_FALSE( log.replay(6, consumer) );
+    REQUIRE( replayed.empty() );
+}
+
+TEST_CASE( "MessageLog without capacity only assigns sequence numbers", "[message_log]" )
+{
+    MessageLog log(0);
+    int published = 0;
+    REQUIRE( log.add({"topic"}, "{}", [&](const auto&, const auto&){ published++; }) == 1 );
+    REQUIRE( log.add({"topic"}, "{}", [&](const auto&, const auto&){ published++; }) == 2 );
+    REQUIRE( published == 2 );
+
+    REQUIRE( log.replay(2, [](const auto&, const auto&){}) );
+    REQUIRE_FALSE( log.replay(1, [](const auto&, const auto&){}) );
+
+    log.with_current_sequence([](uint64_t sequence){
+        REQUIRE( sequence == 2 );
+    });
+}
+
+TEST_CASE( "MessageLog drops its messages on clear and continues the sequence", "[message_log]" )
+{
+    MessageLog log(3);
+    for(int i = 1; i <= 3; i++)
+        log.add({"topic"}, "{}");
+
+    log.clear();
+    REQUIRE( log.get_sequence() == 3 );
+    REQUIRE( log.replay(3, [](const auto&, const auto&){}) );
+    REQUIRE_FALSE( log.replay(2, [](const auto&, const auto&){}) );
+
+    REQUIRE( log.add({"topic"}, "{}") == 4 );
+    int replayed = 0;
+    REQUIRE( log.replay(3, [&](const auto&, const auto&){ replayed++; }) );
+    REQUIRE( replayed == 1 );
+}
+
+TEST_CASE( "PropertyStatusConflation keeps latest value of each property", "[message_log]" )
+{
+    PropertyStatusConflation conflation;
+    REQUIRE( conflation.empty() );
+
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"brightness":10},"sequence":1})") );
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"on":true},"sequence":2})") );
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"brightness":20},"sequence":3})") );
+    REQUIRE_FALSE( conflation.empty() );
+
+    // other messages can not be conflated
+    REQUIRE_FALSE( conflation.add(R"({"messageType":"actionStatus","data":{"fade":{}},"sequence":4})") );
+    REQUIRE_FALSE( conflation.add("no json") );
+
+    auto message = json::parse(conflation.take());
+    REQUIRE( message["messageType"] == "propertyStatus" );
+    REQUIRE( message["data"] == json{{"brightness", 20}, {"on", true}} );
+    REQUIRE( message["sequence"] == 3 );
+    REQUIRE( conflation.empty() );
+
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"on":false}})") );
+    REQUIRE( json::parse(conflation.take()) == json{{"messageType", "propertyStatus"}, {"data", {{"on", false}}}} );
+}
+
+TEST_CASE( "PropertyStatusConflation discards values outdated by delivered messages", "[message_log]" )
+{
+    PropertyStatusConflation conflation;
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"brightness":10,"on":true},"sequence":1})") );
+
+    conflation.discard(json::parse(R"({"messageType":"propertyStatus","data":{"brightness":20},"sequence":2})"));
+    REQUIRE_FALSE( conflation.empty() );
+    REQUIRE( json::parse(conflation.take()) == json{{"messageType", "propertyStatus"}, {"data", {{"on", true}}}, {"sequence", 2}} );
+
+    REQUIRE( conflation.add(R"({"messageType":"propertyStatus","data":{"on":false},"sequence":3})") );
+    conflation.discard(json::parse(R"({"messageType":"propertyStatus","data":{"on":true},"sequence":4})"));
+    REQUIRE( conflation.empty() );
+}
+
+TEST_CASE( "PropertyStatusConflation supports binary formats", "[message_log]" )
+{
+    PropertyStatusConflation conflation;
+
+    json status = {{"messageType", "propertyStatus"}, {"data", {{"on", true}}}, {"sequence", 1}};
+    REQUIRE( conflation.add(encode(status, ContentFormat::cbor), ContentFormat::cbor) );
+    REQUIRE_FALSE( conflation.add(status.dump(), ContentFormat::cbor) );
+
+    REQUIRE( json::from_msgpack(conflation.take(ContentFormat::msgpack)) == status );
+}
@@ -0,0 +1,89 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <map>
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/name_map.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "NameMap finds values by name and iterates in name order", "[name_map]" )
+{
+    NameMap<int> names;
+    REQUIRE( names.empty() );
+    REQUIRE( names.find("level") == names.end() );
+
+    names["on"] = 1;
+    names["level"] = 2;
+    names["brightness"] = 3;
+    names["level"] = 4;
+    REQUIRE( names.size() == 3 );
+
+    std::string_view name = "level-and-more";
+    REQUIRE( names.find(name.substr(0, 5))->second == 4 );
+    REQUIRE( names.count("brightness") == 1 );
+    REQUIRE( names.count("color") == 0 );
+
+    std::vector<std::string> order;
+    for(auto& entry : names)
+        order.push_back(entry.first);
+    REQUIRE( order == std::vector<std::string>{"brightness", "level", "on"} );
+
+    REQUIRE( names.erase("level") == 1 );
+    REQUIRE( names.erase("level") == 0 );
+    REQUIRE( names.find("level") == names.end() );
+    REQUIRE( names.find("on")->second == 1 );
+    REQUIRE( names.find("brightness")->second == 3 );
+}
+
+TEST_CASE( "NameMap keeps finding values while growing", "[name_map]" )
+{
+    NameMap<int> names;
+    for(int i = 0; i < 2000; i++)
+        names["property-" + std::to_string(i)] = i;
+
+    REQUIRE( names.size() == 2000 );
+    for(int i = 0; i < 2000; i++)
+        REQUIRE( names.find("property-" + std::to_string(i))->second == i );
+
+    for(int i = 0; i < 2000; i += 2)
+        names.erase("property-" + std::to_string(i));
+
+    REQUIRE( names.size() == 1000 );
+    REQUIRE( names.find("property-42") == names.end() );
+    REQUIRE( names.find("property-43")->second == 43 );
+    REQUIRE( std::is_sorted(names.begin(), names.end(), [](auto& a, auto& b){ return a.first < b.first; }) );
+}
+
+TEST_CASE( "NameMap lookups compared to std::map", "[.][benchmark][name_map]" )
+{
+    int number_names = GENERATE(10, 2000);
+    std::string num_str = ", " + std::to_string(number_names) + " names";
+
+    NameMap<int> name_map;
+    std::map<std::string, int, std::less<>> std_map;
+    std::vector<std::string> names;
+    for(int i = 0; i < number_names; i++)
+    {
+        names.push_back("urn:dev:property-" + std::to_string(i));
+        name_map[names.back()] = i;
+        std_map[names.back()] = i;
+    }
+
+    BENCHMARK("NameMap" + num_str)
+    {
+        int sum = 0;
+        for(auto& name : names)
+            sum += name_map.find(std::string_view(name))->second;
+        return sum;
+    };
+
+    BENCHMARK("std::map" + num_str)
+    {
+        int sum = 0;
+        for(auto& name : names)
+            sum += std_map.find(std::string_view(name))->second;
+        return sum;
+    };
+}
@@ -0,0 +1,207 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <future>
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/scheduler.hpp>
+
+using namespace bw::webthing;
+using namespace std::chrono_literals;
+
+TEST_CASE( "The scheduler runs tasks once their delay expired", "[scheduler]" )
+{
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+    int runs = 0;
+
+    auto id = scheduler.schedule(50ms, [&]{ runs++; });
+    REQUIRE( id != 0 );
+    REQUIRE( scheduler.size() == 1 );
+
+    REQUIRE( scheduler.advance(now) == 0 );
+    REQUIRE( scheduler.advance(now + 30ms) == 0 );
+    REQUIRE( runs == 0 );
+
+    REQUIRE( scheduler.advance(now + 100ms) == 1 );
+    REQUIRE( runs == 1 );
+    REQUIRE( scheduler.size() == 0 );
+
+    REQUIRE( scheduler.advance(now + 200ms) == 0 );
+    REQUIRE( runs == 1 );
+    REQUIRE_FALSE( scheduler.cancel(id) );
+}
+
+TEST_CASE( "The scheduler runs periodic tasks until they are canceled", "[scheduler]" )
+{
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+    int runs = 0;
+
+    auto id = scheduler.schedule_periodic(100ms, [&]{ runs++; });
+    for(int i = 1; i <= 10; i++)
+        scheduler.advance(now + i * 50ms + 25ms);
+    REQUIRE( runs == 5 );
+
+    // runs missed while not advanced are skipped
+    scheduler.advance(now + 2000ms);
+    REQUIRE( runs == 6 );
+
+    REQUIRE( scheduler.cancel(id) );
+    REQUIRE_FALSE( scheduler.cancel(id) );
+    REQUIRE( scheduler.size() == 0 );
+    scheduler.advance(now + 3000ms);
+    REQUIRE( runs == 6 );
+
+    SECTION( "Periodic tasks can cancel themselves" )
+    {
+        Scheduler::TimerId self = 0;
+        self = scheduler.schedule_periodic(10ms, [&]{
+            runs++;
+            REQUIRE( scheduler.cancel(self) );
+        });
+        scheduler.advance(now + 4000ms);
+        scheduler.advance(now + 5000ms);
+        REQUIRE( runs == 7 );
+        REQUIRE( scheduler.size() == 0 );
+    }
+
+    SECTION( "Tasks can schedule further tasks" )
+    {
+        scheduler.schedule(10ms, [&]{
+            runs++;
+            scheduler.schedule(10ms, [&]{ runs++; });
+        });
+        scheduler.advance(now + 4000ms);
+        REQUIRE( runs == 7 );
+        scheduler.advance(now + 5000ms);
+        REQUIRE( runs == 8 );
+    }
+}
+
+TEST_CASE( "The scheduler cancels pending timers", "[scheduler]" )
+{
+    Scheduler scheduler;
+    auto now = Scheduler::Clock::now();
+    std::vector<int> runs;
+
+    std::vector<Scheduler::TimerId> ids;
+    for(int i = 0; i < 10; i++)
+        ids.push_back(scheduler.schedule(10ms, [&runs, i]{ runs.push_back(i); }));
+
+    REQUIRE( scheduler.cancel(ids[0]) );
+    REQUIRE( scheduler.cancel(ids[5]) );
+    REQUIRE( scheduler.cancel(ids[9]) );
+    REQUIRE_FALSE( scheduler.cancel(ids[5]) );
+    REQUIRE_FALSE( scheduler.cancel(0) );
+    REQUIRE( scheduler.size() == 7 );
+
+    // the slot of a canceled timer is reused without reviving its id
+    auto reused = scheduler.schedule(10ms, [&runs]{ runs.push_back(42); });
+    REQUIRE( reused != ids[9] );
+    REQUIRE_FALSE( scheduler.cancel(ids[9]) );
+
+    scheduler.advance(now + 100ms);
+    std::sort(runs.begin(), runs.end());
+    REQUIRE( runs == std::vector<int>{1, 2, 3, 4, 6, 7, 8, 42} );
+}
+
+TEST_CASE( "The scheduler runs thousands of timers at their time", "[scheduler]" )
+{
+    Scheduler scheduler(10ms);
+    auto start = Scheduler::Clock::now();
+
+    // delays spanning all levels of the wheel, up to two days
+    std::vector<std::chrono::milliseconds> delays;
+    for(int i = 0; i < 3000; i++)
+        delays.push_back(i * 37ms);
+    delays.push_back(20min);
+    delays.push_back(3h);
+    delays.push_back(48h);
+
+    std::vector<std::optional<Scheduler::Clock::time_point>> fired(delays.size());
+    Scheduler::Clock::time_point now;
+    for(size_t i = 0; i < delays.size(); i++)
+        scheduler.schedule(delays[i], [&, i]{ fired[i] = now; });
+    auto scheduled = Scheduler::Clock::now();
+
+    for(now = start; now < start + 120s; now += 10ms)
+        scheduler.advance(now);
+    for(std::chrono::minutes t : {10min, 30min, 120min, 240min, 1440min, 2820min, 2940min})
+        scheduler.advance(now = start + t);
+
+    REQUIRE( scheduler.size() == 0 );
+    for(size_t i = 0; i < delays.size(); i++)
+    {
+        REQUIRE( fired[i] );
+        REQUIRE( *fired[i] >= start + delays[i] );
+        if(i < 3000)
+            REQUIRE( *fired[i] <= scheduled + delays[i] + 30ms );
+    }
+    REQUIRE( *fired[3000] == start + 30min );
+    REQUIRE( *fired[3001] == start + 4h );
+    REQUIRE( *fired[3002] == start + 49h );
+}
+
+TEST_CASE( "The scheduler tells when it has to be advanced next", "[scheduler]" )
+{
+    Scheduler scheduler(10ms);
+    auto start = Scheduler::Clock::now();
+    REQUIRE_FALSE( scheduler.next_expiry() );
+
+    int scheduled = 0;
+    scheduler.set_schedule_observer([&]{ scheduled++; });
+
+    std::vector<std::chrono::milliseconds> delays{50ms, 3s, 20min, 3h};
+    std::vector<std::optional<Scheduler::Clock::time_point>> fired(delays.size());
+    Scheduler::Clock::time_point now;
+    for(size_t i = 0; i < delays.size(); i++)
+        scheduler.schedule(delays[i], [&, i]{ fired[i] = now; });
+    auto after = Scheduler::Clock::now();
+    REQUIRE( scheduled == 4 );
+
+    // only advancing at the expiries runs all timers, with a few wake ups
+    // to move the timers down the wheel
+    int wake_ups = 0;
+    while(auto next = scheduler.next_expiry())
+    {
+        REQUIRE( *next > now );
+        now = *next;
+        scheduler.advance(now);
+        wake_ups++;
+    }
+
+    REQUIRE( wake_ups < 20 );
+    REQUIRE( scheduler.size() == 0 );
+    for(size_t i = 0; i < delays.size(); i++)
+    {
+        REQUIRE( fired[i] );
+        REQUIRE( *fired[i] >= start + delays[i] );
+        REQUIRE( *fired[i] <= after + delays[i] + 10ms );
+    }
+
+    scheduler.set_schedule_observer(nullptr);
+    scheduler.schedule(1ms, []{});
+    REQUIRE( scheduled == 4 );
+}
+
+TEST_CASE( "The scheduler can be advanced by a dedicated thread", "[scheduler]" )
+{
+    Scheduler scheduler(5ms);
+    REQUIRE( scheduler.get_resolution() == 5ms );
+
+    std::promise<std::thread::id> promise;
+    scheduler.start();
+    scheduler.schedule(20ms, [&]{ promise.set_value(std::this_thread::get_id()); });
+
+    auto future = promise.get_future();
+    REQUIRE( future.wait_for(2s) == std::future_status::ready );
+    REQUIRE( future.get() != std::this_thread::get_id() );
+
+    scheduler.stop();
+    bool run = false;
+    scheduler.schedule(1ms, [&]{ run = true; });
+    std::this_thread::sleep_for(50ms);
+    REQUIRE_FALSE( run );
+    REQUIRE( scheduler.size() == 1 );
+}
@@ -2,6 +2,8 @@
 // SPDX-FileCopyrightText: 2023-present Benno Waldhauer
 // SPDX-License-Identifier: MIT
 
+#include <filesystem>
+#include <future>
 #include <catch2/catch_all.hpp>
 #include <cpr/cpr.h>
 #include <bw/webthing/webthing.hpp>
@@ -205,6 +207,45 @@ TEST_CASE( "It can host multiple things", "[server][http]" )
     });
 }
 
+TEST_CASE( "It adds and removes things while running", "[server][http]" )
+{
+    auto thing_a = make_thing("uri:test:a", "thing-a");
+    auto thing_b = make_thing("uri:test:b", "thing-b");
+    link_property(thing_b, "level", 1);
+
+    auto thing_container = MultipleThings({thing_a.get()}, "hot-plugged-things");
+    auto builder = WebThingServer::host(thing_container).port(57127);
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        REQUIRE(server->add_thing(thing_b.get()) == 1);
+        REQUIRE_THROWS_AS(server->add_thing(thing_b.get()), std::logic_error);
+
+        auto res = cpr::Get(cpr::Url{base_url + "/1"});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["title"] == "thing-b");
+        REQUIRE(json::parse(cpr::Get(cpr::Url{base_url}).text).size() == 2);
+
+        std::promise<void> removed;
+        REQUIRE(server->remove_thing("uri:test:a", [&]{ removed.set_value(); }));
+        REQUIRE_FALSE(server->remove_thing("uri:test:a"));
+        removed.get_future().wait();
+
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/0"}).status_code == 404);
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/1/properties/level"}).status_code == 200);
+        // things are addressed by index or id
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/uri:test:b/properties/level"}).status_code == 200);
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/uri:test:a"}).status_code == 404);
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/1x"}).status_code == 404);
+        auto descriptions = json::parse(cpr::Get(cpr::Url{base_url}).text);
+        REQUIRE(descriptions.size() == 1);
+        REQUIRE(descriptions[0]["title"] == "thing-b");
+
+        // a thing added again is addressed by its previous index
+        REQUIRE(server->add_thing(thing_a.get()) == 0);
+        REQUIRE(cpr::Get(cpr::Url{base_url + "/0"}).status_code == 200);
+    });
+}
+
 TEST_CASE( "It handles invalid requests", "[server][http]" )
 {
     Thing thing("uri:test", "single-thing");
@@ -542,3 +583,313 @@ TEST_CASE( "It supports custom html ui page", "[server][http]" )
         REQUIRE(res.text == "<h1>It works...</h1>");
     });
 }
+
+TEST_CASE( "It negotiates cbor and msgpack responses", "[server][http]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50);
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57117);
+
+    test_running_server(builder, [](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Get(cpr::Url{base_url + "/properties"}, cpr::Header{{"Accept", "application/cbor"}});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(res.header["Content-Type"] == "application/cbor");
+        REQUIRE(json::from_cbor(res.text)["brightness"] == 50);
+
+        res = cpr::Get(cpr::Url{base_url}, cpr::Header{{"Accept", "application/msgpack"}});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(res.header["Content-Type"] == "application/msgpack");
+        REQUIRE(json::from_msgpack(res.text)["title"] == "single-thing");
+
+        res = cpr::Put(
+            cpr::Url{base_url + "/properties/brightness"},
+            cpr::Header{{"Accept", "application/json;q=0.5, application/cbor"}},
+            cpr::Body{json{{"brightness", 42}}.dump()}
+        );
+        REQUIRE(res.status_code == 200);
+        REQUIRE(res.header["Content-Type"] == "application/cbor");
+        REQUIRE(json::from_cbor(res.text)["brightness"] == 42);
+
+        res = cpr::Get(cpr::Url{base_url + "/properties"}, cpr::Header{{"Accept", "application/json, application/cbor"}});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(res.header["Content-Type"] == "application/json");
+        REQUIRE(json::parse(res.text)["brightness"] == 42);
+    });
+}
+
+TEST_CASE( "It serves thing descriptions from a cache per host", "[server][http]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50);
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57129).disable_host_validation(true);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Get(cpr::Url{base_url});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(server->get_description_cache_hits() == 0);
+
+        res = cpr::Get(cpr::Url{base_url});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["title"] == "single-thing");
+        REQUIRE(server->get_description_cache_hits() == 1);
+
+        // the links of the description refer to the requested host
+        res = cpr::Get(cpr::Url{base_url}, cpr::Header{{"Host", "lamp.local:57129"}});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["base"] == "http://lamp.local:57129/");
+        REQUIRE(server->get_description_cache_hits() == 1);
+
+        // changing the description outdates the cached one
+        thing->add_available_event("overheated");
+        res = cpr::Get(cpr::Url{base_url});
+        REQUIRE(json::parse(res.text)["events"].contains("overheated"));
+        REQUIRE(server->get_description_cache_hits() == 1);
+    });
+}
+
+TEST_CASE( "It sets multiple properties at once", "[server][http]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50, {{"type", "integer"}});
+    link_property(thing, "on", false, {{"type", "boolean"}});
+    link_property(thing, "color", std::string("white"), {{"type", "string"}, {"readOnly", true}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57119);
+
+    test_running_server(builder, [](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Put(
+            cpr::Url{base_url + "/properties"},
+            cpr::Body{json{{"brightness", 42}, {"on", true}}.dump()}
+        );
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text) == json{{"brightness", 42}, {"on", true}});
+
+        // none is set when any value is invalid
+        res = cpr::Put(
+            cpr::Url{base_url + "/properties"},
+            cpr::Body{json{{"brightness", 24}, {"color", "red"}}.dump()}
+        );
+        REQUIRE(res.status_code == 400);
+        REQUIRE(json::parse(res.text)["message"] == "Read-only property");
+
+        res = cpr::Put(
+            cpr::Url{base_url + "/properties"},
+            cpr::Body{json{{"brightness", 24}, {"not-existing-property", 1}}.dump()}
+        );
+        REQUIRE(res.status_code == 400);
+        REQUIRE(json::parse(res.text)["message"] == "Unknown property: not-existing-property");
+
+        res = cpr::Put(cpr::Url{base_url + "/properties"}, cpr::Body{json{123}.dump()});
+        REQUIRE(res.status_code == 400);
+
+        res = cpr::Get(cpr::Url{base_url + "/properties"});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text) == json{{"brightness", 42}, {"color", "white"}, {"on", true}});
+
+        // bodies received in several chunks are limited in size
+        auto large_body = json{{"color", std::string(HTTP_MAX_REQUEST_BODY_SIZE, 'x')}}.dump();
+        for(std::string path : {"/properties", "/properties/color", "/actions"})
+        {
+            res = path == "/actions"
+                ? cpr::Post(cpr::Url{base_url + path}, cpr::Body{large_body})
+                : cpr::Put(cpr::Url{base_url + path}, cpr::Body{large_body});
+            REQUIRE(res.status_code == 413);
+        }
+    });
+}
+
+TEST_CASE( "It does not block while forwarding property values", "[server][http]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", make_async_value(50, [](const int&, ForwardCallback done){
+        std::thread([done]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            done(nullptr);
+        }).detach();
+    }), {{"type", "integer"}});
+    link_property(thing, "color", make_async_value(std::string("white"), [](const std::string&, ForwardCallback done){
+        // completes after the timeout
+        std::thread([done]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            done(nullptr);
+        }).detach();
+    }, std::chrono::milliseconds(50)), {{"type", "string"}});
+    link_property(thing, "on", make_value(false, [](const bool&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }), {{"type", "boolean"}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57121)
+        .value_executor([](std::function<void()> task){ std::thread(task).detach(); });
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Put(
+            cpr::Url{base_url + "/properties/brightness"},
+            cpr::Body{json{{"brightness", 42}}.dump()}
+        );
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["brightness"] == 42);
+
+        res = cpr::Put(
+            cpr::Url{base_url + "/properties/color"},
+            cpr::Body{json{{"color", "red"}}.dump()}
+        );
+        REQUIRE(res.status_code == 504);
+        REQUIRE(json::parse(res.text)["message"] == "Forwarding value timed out");
+
+        // the value is not set once it was forwarded late
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        REQUIRE(*thing->get_property<std::string>("color") == "white");
+
+        // the server keeps responding while a synchronous forwarder is executed
+        auto put = cpr::PutAsync(
+            cpr::Url{base_url + "/properties"},
+            cpr::Body{json{{"on", true}, {"brightness", 24}}.dump()}
+        );
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        res = cpr::Get(cpr::Url{base_url + "/properties"});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["on"] == false);
+
+        res = put.get();
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text) == json{{"on", true}, {"brightness", 24}});
+    });
+}
+
+TEST_CASE( "It fetches lazy property values on demand", "[server][http]" )
+{
+    std::atomic<int> reads = 0;
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "level", make_lazy_value<int>([&]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return ++reads;
+    }, std::chrono::hours(1)), {{"type", "integer"}, {"readOnly", true}});
+    link_property(thing, "pressure", make_lazy_value<int>([]() -> int {
+        throw std::runtime_error("sensor offline");
+    }, std::chrono::hours(1)), {{"type", "integer"}, {"readOnly", true}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57122)
+        .value_executor([](std::function<void()> task){ std::thread(task).detach(); });
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        // concurrent requests share a single fetch
+        auto concurrent = cpr::GetAsync(cpr::Url{base_url + "/properties/level"});
+        auto res = cpr::Get(cpr::Url{base_url + "/properties/level"});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["level"] == 1);
+        res = concurrent.get();
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["level"] == 1);
+
+        res = cpr::Get(cpr::Url{base_url + "/properties/level"});
+        REQUIRE(res.status_code == 200);
+        REQUIRE(json::parse(res.text)["level"] == 1);
+        REQUIRE(reads == 1);
+
+        res = cpr::Get(cpr::Url{base_url + "/properties/pressure"});
+        REQUIRE(res.status_code == 502);
+        REQUIRE(json::parse(res.text)["message"] == "sensor offline");
+
+        res = cpr::Get(cpr::Url{base_url + "/properties"});
+        REQUIRE(res.status_code == 502);
+    });
+}
+
+struct HangingTestAction : public Action
+{
+    HangingTestAction(Thing* thing, std::optional<json> input)
+        : Action(generate_uuid(), thing, this, "hanging-action", input)
+    {}
+
+    void perform_action()
+    {
+        while(!is_cancelled())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+};
+
+TEST_CASE( "It times out actions after the timeout of their type", "[server][http]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_action<HangingTestAction>(thing, "hanging-action", {{"timeout", 100}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57124);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        auto pending_timers = server->get_scheduler().size();
+
+        auto res = cpr::Post(cpr::Url{base_url + "/actions"}, cpr::Body{json{{"hanging-action", json::object()}}.dump()});
+        REQUIRE(res.status_code == 201);
+        std::string href = json::parse(res.text)["hanging-action"]["href"];
+
+        res = cpr::Get(cpr::Url{base_url + href});
+        REQUIRE(json::parse(res.text)["hanging-action"]["status"] == "pending");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        res = cpr::Get(cpr::Url{base_url + href});
+        REQUIRE(json::parse(res.text)["hanging-action"]["status"] == "timedout");
+        REQUIRE(json::parse(res.text)["hanging-action"].contains("timeCompleted"));
+
+        res = cpr::Post(cpr::Url{base_url + "/actions"}, cpr::Body{json{{"hanging-action", json::object()}}.dump()});
+        REQUIRE(res.status_code == 201);
+        href = json::parse(res.text)["hanging-action"]["href"];
+
+        auto action = thing->get_action("hanging-action", href.substr(href.rfind('/') + 1));
+        REQUIRE(action);
+        res = cpr::Delete(cpr::Url{base_url + href});
+        REQUIRE(res.status_code == 204);
+        REQUIRE(action->get_status() == "cancelled");
+        REQUIRE(action->is_cancelled());
+
+        // the deadline of the cancelled action is not pending any longer
+        REQUIRE(server->get_scheduler().size() == pending_timers);
+    });
+}
+
+TEST_CASE( "It restores persisted property values before listening", "[server][http]" )
+{
+    auto path = (std::filesystem::temp_directory_path() / ("webthing-values-" + generate_uuid())).string();
+    {
+        auto thing = make_thing("uri:test:1", "single-thing");
+        link_property(thing, "brightness", 10);
+
+        auto thing_container = SingleThing(thing.get());
+        auto builder = WebThingServer::host(thing_container).port(57125)
+            .persist_property_values(path, std::chrono::milliseconds(20));
+
+        test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+        {
+            auto res = cpr::Put(cpr::Url{base_url + "/properties/brightness"}, cpr::Body{json{{"brightness", 42}}.dump()});
+            REQUIRE(res.status_code == 200);
+        });
+    }
+
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 10);
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57126).persist_property_values(path);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        REQUIRE(*thing->get_property<int>("brightness") == 42);
+        auto res = cpr::Get(cpr::Url{base_url + "/properties/brightness"});
+        REQUIRE(json::parse(res.text)["brightness"] == 42);
+    });
+
+    std::filesystem::remove(path);
+}
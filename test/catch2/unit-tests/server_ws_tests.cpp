@@ -2,6 +2,8 @@
 // SPDX-FileCopyrightText: 2023-present Benno Waldhauer
 // SPDX-License-Identifier: MIT
 
+#include <future>
+#include <mutex>
 #include <catch2/catch_all.hpp>
 #include <cpr/cpr.h>
 #include <ixwebsocket/IXWebSocket.h>
@@ -40,19 +42,23 @@ inline void test_running_server(WebThingServer::Builder& builder, std::function<
     }
 };
 
-void connect_via_ws(const std::string& url, std::function<void (ix::WebSocket*, std::vector<json>*)> client_callback)
+void connect_via_ws(const std::string& url, std::function<void (ix::WebSocket*, std::vector<json>*)> client_callback,
+    ContentFormat format = ContentFormat::json)
 {
     std::vector<json> messages_received;
 
     ix::WebSocket ws;
     ws.setUrl(url);
+    if(is_binary(format))
+        ws.addSubProtocol(std::string(websocket_protocol(format)));
+
     ws.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg)
     {
         if (msg->type == ix::WebSocketMessageType::Message)
         {
-            std::string message = msg->str;
-            logger::info("WS_CLIENT RECEIVED: " + message);
-            messages_received.push_back(json::parse(message));
+            json message = decode(msg->str, msg->binary ? format : ContentFormat::json);
+            logger::info("WS_CLIENT RECEIVED: " + message.dump());
+            messages_received.push_back(message);
         }
     });
 
@@ -383,3 +389,397 @@ TEST_CASE( "It offers websocket api for actions", "[server][ws]" )
         REQUIRE(json::parse(res.text).size() == 1);
     });
 }
+
+TEST_CASE( "It offers websocket api for property subscriptions", "[server][ws]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50, {{"title", "Brightness"}, {"type", "integer"}});
+    link_property(thing, "on", true, {{"title", "On/Off"}, {"type", "boolean"}});
+    link_property(thing, "color", std::string("white"), {{"title", "Color"}, {"type", "string"}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57115);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Get(cpr::Url{base_url});
+        REQUIRE(res.status_code == 200);
+        auto td = json::parse(res.text);
+
+        auto links = td["links"];
+        auto found_ws_link_obj = std::find_if(links.begin(), links.end(), [](const json& link) {
+            return link.contains("rel") && link["rel"] == "alternate" && !link.contains("mediaType");
+        });
+        REQUIRE(found_ws_link_obj != links.end());
+        std::string ws_url = (*found_ws_link_obj)["href"];
+
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+
+            // without property subscription all property changes are received
+            thing->set_property("brightness", 10);
+            thing->set_property("on", false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+
+            // subscribe to single properties
+            con->sendText(json{{"messageType", "addPropertySubscription"}, {"data", {
+                {"brightness", json::object()}, {"color", json::object()}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            received_messages.clear();
+
+            thing->set_property("brightness", 20);
+            thing->set_property("on", true);
+            thing->set_property("color", std::string("red"));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[0]["messageType"] == "propertyStatus");
+            REQUIRE(received_messages[0]["data"]["brightness"] == 20);
+            REQUIRE(received_messages[1]["messageType"] == "propertyStatus");
+            REQUIRE(received_messages[1]["data"]["color"] == "red");
+            received_messages.clear();
+
+            // properties set together are received once per subscribed property
+            // with the values of this property only
+            thing->set_properties({{"brightness", 25}, {"on", false}, {"color", "blue"}});
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[0]["data"] == json{{"brightness", 25}});
+            REQUIRE(received_messages[1]["data"] == json{{"color", "blue"}});
+            REQUIRE(received_messages[0]["sequence"] == received_messages[1]["sequence"]);
+
+            // unsubscribe from single property
+            con->sendText(json{{"messageType", "removePropertySubscription"}, {"data", {
+                {"color", json::object()}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            received_messages.clear();
+
+            thing->set_property("brightness", 30);
+            thing->set_property("color", std::string("green"));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 1);
+            REQUIRE(received_messages[0]["data"]["brightness"] == 30);
+
+            // subscribe to unknown property
+            con->sendText(json{{"messageType", "addPropertySubscription"}, {"data", {
+                {"not-existing-property", json::object()}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.back()["messageType"] == "error");
+            REQUIRE(received_messages.back()["data"]["status"] == "400 Bad Request");
+            REQUIRE(received_messages.back()["data"]["message"] == "Unknown property: not-existing-property");
+
+            // removing the last property subscription subscribes to all properties again
+            con->sendText(json{{"messageType", "removePropertySubscription"}, {"data", {
+                {"brightness", json::object()}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            received_messages.clear();
+
+            thing->set_property("brightness", 35);
+            thing->set_property("on", true);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[0]["data"] == json{{"brightness", 35}});
+            REQUIRE(received_messages[1]["data"] == json{{"on", true}});
+        });
+
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+
+            // only unknown properties keep the subscription of all properties
+            con->sendText(json{{"messageType", "addPropertySubscription"}, {"data", {
+                {"not-existing-property", json::object()}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 1);
+            REQUIRE(received_messages[0]["messageType"] == "error");
+            received_messages.clear();
+
+            thing->set_property("brightness", 40);
+            thing->set_property("on", false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[0]["data"]["brightness"] == 40);
+            REQUIRE(received_messages[1]["data"]["on"] == false);
+        });
+    });
+}
+
+TEST_CASE( "It synchronizes reconnecting websockets", "[server][ws]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50, {{"title", "Brightness"}, {"type", "integer"}});
+    link_property(thing, "on", true, {{"title", "On/Off"}, {"type", "boolean"}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57116).message_log_size(3);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        auto res = cpr::Get(cpr::Url{base_url});
+        REQUIRE(res.status_code == 200);
+        auto td = json::parse(res.text);
+
+        auto links = td["links"];
+        auto found_ws_link_obj = std::find_if(links.begin(), links.end(), [](const json& link) {
+            return link.contains("rel") && link["rel"] == "alternate" && !link.contains("mediaType");
+        });
+        REQUIRE(found_ws_link_obj != links.end());
+        std::string ws_url = (*found_ws_link_obj)["href"];
+
+        uint64_t last_sequence = 0;
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+            REQUIRE(received_messages.empty());
+
+            thing->set_property("brightness", 10);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.back()["sequence"].is_number_unsigned());
+            last_sequence = received_messages.back()["sequence"];
+        });
+
+        // changes while disconnected
+        thing->set_property("brightness", 20);
+        thing->set_property("on", false);
+
+        // only missed messages are sent
+        connect_via_ws(ws_url + "?since=" + std::to_string(last_sequence), [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[0]["data"]["brightness"] == 20);
+            REQUIRE(received_messages[0]["sequence"] == last_sequence + 1);
+            REQUIRE(received_messages[1]["data"]["on"] == false);
+            REQUIRE(received_messages[1]["sequence"] == last_sequence + 2);
+        });
+
+        // missed messages are not retained any longer
+        thing->set_property("brightness", 30);
+        thing->set_property("brightness", 40);
+        thing->set_property("brightness", 50);
+
+        connect_via_ws(ws_url + "?since=" + std::to_string(last_sequence), [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+            REQUIRE(received_messages.size() == 1);
+            REQUIRE(received_messages[0]["messageType"] == "propertyStatus");
+            REQUIRE(received_messages[0]["data"] == json{{"brightness", 50}, {"on", false}});
+            REQUIRE(received_messages[0]["sequence"] == last_sequence + 5);
+        });
+
+        // request snapshot via message
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+            REQUIRE(received_messages.empty());
+
+            con->sendText(json{{"messageType", "synchronize"}, {"data", json::object()}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 1);
+            REQUIRE(received_messages[0]["data"] == json{{"brightness", 50}, {"on", false}});
+            REQUIRE(received_messages[0]["sequence"] == last_sequence + 5);
+        });
+    });
+}
+
+TEST_CASE( "It offers websocket api in binary formats", "[server][ws]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    auto brightness = make_value(50);
+    link_property(thing, "brightness", brightness);
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57118);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        std::string ws_url = "ws://127.0.0.1:57118";
+
+        connect_via_ws(ws_url, [&](ix::WebSocket* json_con, std::vector<json>* json_messages)
+        {
+            connect_via_ws(ws_url, [&](ix::WebSocket* con, std::vector<json>* received_messages)
+            {
+                json set_property = {{"messageType", "setProperty"}, {"data", {{"brightness", 23}}}};
+                con->sendBinary(encode(set_property, ContentFormat::cbor));
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+                REQUIRE(*thing->get_property<int>("brightness") == 23);
+                REQUIRE(received_messages->size() == 1);
+                REQUIRE(received_messages->back()["messageType"] == "propertyStatus");
+                REQUIRE(received_messages->back()["data"]["brightness"] == 23);
+                REQUIRE(received_messages->back()["sequence"] == 1);
+
+                // json clients receive the same messages
+                REQUIRE(json_messages->size() == 1);
+                REQUIRE(json_messages->back() == received_messages->back());
+
+                con->sendBinary(encode(json{{"messageType", "unknown"}, {"data", {}}}, ContentFormat::cbor));
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                REQUIRE(received_messages->back()["messageType"] == "error");
+                REQUIRE(received_messages->back()["data"]["message"] == "Unknown messageType: unknown");
+            }, ContentFormat::cbor);
+        });
+    });
+}
+
+TEST_CASE( "It sets multiple properties via websocket at once", "[server][ws]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 50, {{"title", "Brightness"}, {"type", "integer"}});
+    link_property(thing, "on", true, {{"title", "On/Off"}, {"type", "boolean"}});
+    link_property(thing, "color", std::string("white"), {{"title", "Color"}, {"type", "string"}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57120);
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        connect_via_ws("ws://127.0.0.1:57120", [&](auto con, std::vector<json>* received_messages_ptr)
+        {
+            std::vector<json>& received_messages = *received_messages_ptr;
+
+            con->sendText(json{{"messageType", "setProperty"}, {"data", {
+                {"brightness", 10}, {"on", false}, {"color", "red"}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 1);
+            REQUIRE(received_messages[0]["messageType"] == "propertyStatus");
+            REQUIRE(received_messages[0]["data"] == json{{"brightness", 10}, {"on", false}, {"color", "red"}});
+
+            // none of the values is set if any of them is invalid
+            con->sendText(json{{"messageType", "setProperty"}, {"data", {
+                {"brightness", 20}, {"on", "yes"}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 2);
+            REQUIRE(received_messages[1]["messageType"] == "error");
+            REQUIRE(received_messages[1]["data"]["status"] == "400 Bad Request");
+            REQUIRE(received_messages[1]["data"]["message"] == "Property value type not matching");
+
+            con->sendText(json{{"messageType", "setProperty"}, {"data", {
+                {"brightness", 20}, {"level", 1}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(received_messages.size() == 3);
+            REQUIRE(received_messages[2]["messageType"] == "error");
+            REQUIRE(received_messages[2]["data"]["message"] == "Unknown property: level");
+
+            REQUIRE(*thing->get_property<int>("brightness") == 10);
+            REQUIRE(*thing->get_property<bool>("on") == false);
+        });
+    });
+}
+
+TEST_CASE( "It conflates property values for slow websocket consumers", "[server][ws]" )
+{
+    auto thing = make_thing("uri:test:1", "single-thing");
+    link_property(thing, "brightness", 0, {{"title", "Brightness"}, {"type", "integer"}});
+    link_property(thing, "text", std::string(), {{"title", "Text"}, {"type", "string"}});
+
+    auto thing_container = SingleThing(thing.get());
+    auto builder = WebThingServer::host(thing_container).port(57128)
+        .backpressure({16 * 1024, SlowConsumerPolicy::ConflateProperties});
+
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        std::mutex mutex;
+        std::vector<json> received_messages;
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
+
+        ix::WebSocket ws;
+        ws.setUrl("ws://127.0.0.1:57128");
+        ws.disablePerMessageDeflate();
+        ws.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg)
+        {
+            if(msg->type != ix::WebSocketMessageType::Message)
+                return;
+
+            // the client does not read until released, so messages pile up at the server
+            released.wait();
+            std::scoped_lock<std::mutex> lock(mutex);
+            received_messages.push_back(json::parse(msg->str));
+        });
+        ws.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        for(int i = 1; i <= 500; i++)
+        {
+            thing->set_property("text", std::string(64 * 1024, static_cast<char>('a' + i % 26)));
+            thing->set_property("brightness", i);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        release.set_value();
+
+        auto last_brightness = [&]{
+            std::scoped_lock<std::mutex> lock(mutex);
+            for(auto it = received_messages.rbegin(); it != received_messages.rend(); it++)
+                if((*it)["data"].contains("brightness"))
+                    return (*it)["data"]["brightness"].get<int>();
+            return 0;
+        };
+        for(int i = 0; i < 100 && last_brightness() != 500; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ws.stop();
+
+        REQUIRE(server->get_conflated_messages() > 0);
+        REQUIRE(last_brightness() == 500);
+
+        // conflated values are never older than values received before
+        int brightness = 0;
+        for(auto& message : received_messages)
+        {
+            REQUIRE(message["messageType"] == "propertyStatus");
+            if(!message["data"].contains("brightness"))
+                continue;
+            REQUIRE(message["data"]["brightness"] > brightness);
+            brightness = message["data"]["brightness"];
+        }
+    });
+}
+
+TEST_CASE( "It makes things added while running available via websocket", "[server][ws]" )
+{
+    auto thing_a = make_thing("uri:test:a", "thing-a");
+    auto thing_b = make_thing("uri:test:b", "thing-b");
+    link_property(thing_b, "level", 1);
+
+    auto thing_container = MultipleThings({thing_a.get()}, "hot-plugged-things");
+    auto builder = WebThingServer::host(thing_container).port(57130);
+    test_running_server(builder, [&](WebThingServer* server, const std::string& base_url)
+    {
+        REQUIRE(server->add_thing(thing_b.get()) == 1);
+
+        auto links = json::parse(cpr::Get(cpr::Url{base_url + "/1"}).text)["links"];
+        auto ws_link = std::find_if(links.begin(), links.end(), [](const json& link) {
+            return link.contains("rel") && link["rel"] == "alternate" && !link.contains("mediaType");
+        });
+        REQUIRE(ws_link != links.end());
+        std::string ws_url = (*ws_link)["href"];
+
+        auto count_levels = [](const std::vector<json>& messages, int level)
+        {
+            return std::count_if(messages.begin(), messages.end(), [level](const json& message){
+                return message["messageType"] == "propertyStatus" && message["data"].value("level", 0) == level;
+            });
+        };
+
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages)
+        {
+            con->sendText(json{{"messageType", "setProperty"}, {"data", {{"level", 2}}}}.dump());
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            REQUIRE(count_levels(*received_messages, 2) == 1);
+        });
+
+        // a thing added again is observed once
+        std::promise<void> removed;
+        REQUIRE(server->remove_thing("uri:test:b", [&]{ removed.set_value(); }));
+        removed.get_future().wait();
+        REQUIRE(server->add_thing(thing_b.get()) == 1);
+
+        connect_via_ws(ws_url, [&](auto con, std::vector<json>* received_messages)
+        {
+            thing_b->set_property("level", 3);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            REQUIRE(count_levels(*received_messages, 3) == 1);
+        });
+    });
+}
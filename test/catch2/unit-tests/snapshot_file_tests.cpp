@@ -0,0 +1,66 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <filesystem>
+#include <fstream>
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/snapshot_file.hpp>
+#include <bw/webthing/utils.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "A snapshot file restores the latest snapshot written", "[snapshot]" )
+{
+    auto directory = std::filesystem::temp_directory_path() / ("webthing-snapshot-" + generate_uuid());
+    std::filesystem::create_directories(directory);
+    auto path = (directory / "values.snapshot").string();
+
+    REQUIRE_FALSE( SnapshotFile(path).load() );
+    {
+        SnapshotFile file(path);
+        file.save("first");
+        file.save("second");
+        file.save("third");
+    }
+    REQUIRE( SnapshotFile(path).load() == "third" );
+
+    SECTION( "Snapshots are continued after loading" )
+    {
+        {
+            SnapshotFile file(path);
+            file.load();
+            file.save("fourth");
+            file.save("fifth");
+        }
+        REQUIRE( SnapshotFile(path).load() == "fifth" );
+    }
+
+    SECTION( "The file grows with its snapshots" )
+    {
+        std::string large(100000, 'x');
+        {
+            SnapshotFile file(path);
+            file.load();
+            file.save(large);
+            file.save("small");
+        }
+        REQUIRE( SnapshotFile(path).load() == "small" );
+        REQUIRE( std::filesystem::file_size(path) >= 2 * large.size() );
+    }
+
+    SECTION( "A torn snapshot is replaced by the previous one" )
+    {
+        auto size = std::filesystem::file_size(path);
+        {
+            // "third" was written to the first slot
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(24 + 1);
+            file.put('X');
+        }
+        REQUIRE( std::filesystem::file_size(path) == size );
+        REQUIRE( SnapshotFile(path).load() == "second" );
+    }
+
+    std::filesystem::remove_all(directory);
+}
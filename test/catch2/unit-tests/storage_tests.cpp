@@ -2,6 +2,7 @@
 // SPDX-FileCopyrightText: 2023-present Benno Waldhauer
 // SPDX-License-Identifier: MIT
 
+#include <thread>
 #include <catch2/catch_all.hpp>
 #include <bw/webthing/event.hpp>
 #include <bw/webthing/storage.hpp>
@@ -222,3 +223,165 @@ TEMPLATE_TEST_CASE( "RingBufferImpl elements can be removed", "[storage]",
     REQUIRE( storage.size() == 4 );
     REQUIRE( storage.get(3) == "h" );
 }
+
+TEMPLATE_TEST_CASE( "RingBufferImpl can limit the accounted bytes of stored elements", "[storage]",
+    SimpleRingBuffer<std::string>, FlexibleRingBuffer<std::string> )
+{
+    StorageConfig config;
+    config.max_bytes = 3 * sizeof(std::string) + 300;
+    TestType storage(config);
+
+    storage.add(std::string(100, 'a'));
+    storage.add(std::string(100, 'b'));
+    storage.add(std::string(100, 'c'));
+    REQUIRE( storage.size() == 3 );
+    REQUIRE( storage.bytes() == 3 * sizeof(std::string) + 300 );
+
+    // evicts as many of the oldest elements as necessary
+    storage.add(std::string(150, 'd'));
+    REQUIRE( storage.size() == 2 );
+    REQUIRE( storage.get(0) == std::string(100, 'c') );
+    REQUIRE( storage.get(1) == std::string(150, 'd') );
+    REQUIRE( storage.bytes() == 2 * sizeof(std::string) + 250 );
+
+    storage.add("e");
+    storage.add("f");
+    REQUIRE( storage.size() == 4 );
+    REQUIRE( storage.get(0) == std::string(100, 'c') );
+    REQUIRE( storage.get(3) == "f" );
+
+    // the latest element is kept regardless of its size
+    storage.add(std::string(1000, 'g'));
+    REQUIRE( storage.size() == 1 );
+    REQUIRE( storage.get(0) == std::string(1000, 'g') );
+
+    for(int i = 0; i < 10; i++)
+        storage.add(std::to_string(i));
+    REQUIRE( storage.size() == 10 );
+    REQUIRE( storage.bytes() == 10 * sizeof(std::string) + 10 );
+
+    std::vector<std::string> elements;
+    for(auto const& element : storage)
+        elements.push_back(element);
+    REQUIRE( elements == std::vector<std::string>{"0", "1", "2", "3", "4", "5", "6", "7", "8", "9"} );
+}
+
+TEMPLATE_TEST_CASE( "RingBufferImpl evicts elements older than max age", "[storage]",
+    SimpleRingBuffer<std::string>, FlexibleRingBuffer<std::string> )
+{
+    StorageConfig config;
+    config.max_size = 3;
+    config.max_age = std::chrono::milliseconds(100);
+    TestType storage(config);
+
+    storage.add("first");
+    storage.add("second");
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    REQUIRE( storage.size() == 2 );
+
+    // on insert
+    storage.add("third");
+    REQUIRE( storage.size() == 1 );
+    REQUIRE( storage.get(0) == "third" );
+
+    storage.add("fourth");
+    storage.add("fifth");
+    storage.add("sixth");
+    REQUIRE( storage.size() == 3 );
+    REQUIRE( storage.get(0) == "fourth" );
+
+    // when not adding elements
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    storage.evict_expired();
+    REQUIRE( storage.size() == 0 );
+
+    storage.add("seventh");
+    REQUIRE( storage.size() == 1 );
+    REQUIRE( storage.get(0) == "seventh" );
+}
+
+TEST_CASE( "FlexibleRingBuffer accounts bytes of removed elements", "[storage]" )
+{
+    StorageConfig config;
+    config.max_bytes = 1000 * sizeof(std::string);
+    FlexibleRingBuffer<std::string> storage(config);
+
+    for(int i = 0; i < 10; i++)
+        storage.add(std::string(i, 'x'));
+    REQUIRE( storage.bytes() == 10 * sizeof(std::string) + 45 );
+
+    storage.remove_if([](const std::string& element){ return element.size() % 2 == 0; });
+    REQUIRE( storage.size() == 5 );
+    REQUIRE( storage.get(0) == "x" );
+    REQUIRE( storage.get(4) == std::string(9, 'x') );
+    REQUIRE( storage.bytes() == 5 * sizeof(std::string) + 25 );
+}
+
+TEST_CASE( "Events and actions are accounted by their payload sizes", "[storage]" )
+{
+    auto small_event = std::make_shared<Event>(nullptr, "event", 42);
+    auto large_event = std::make_shared<Event>(nullptr, "event", json{{"payload", std::string(10000, 'x')}});
+    REQUIRE( storage_size(large_event) > storage_size(small_event) + 10000 );
+
+    StorageConfig config;
+    config.max_bytes = 2 * storage_size(large_event);
+    SimpleRingBuffer<std::shared_ptr<Event>> events(config);
+    for(int i = 0; i < 10; i++)
+        events.add(large_event);
+    REQUIRE( events.size() == 2 );
+    REQUIRE( large_event.use_count() == 3 );
+}
+
+#ifdef WT_WITH_PMR
+
+// Counts the bytes allocated from upstream, which are not released yet
+struct CountingResource : public std::pmr::memory_resource
+{
+    size_t bytes = 0;
+
+    void* do_allocate(size_t size, size_t alignment)
+    {
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, size_t size, size_t alignment)
+    {
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept
+    {
+        return this == &other;
+    }
+};
+
+TEST_CASE( "Storages allocate from the memory resource of their config", "[storage]" )
+{
+    CountingResource resource;
+    StorageConfig config;
+    config.max_size = 10;
+    config.max_age = std::chrono::hours(1);
+    config.memory_resource = &resource;
+
+    {
+        SimpleRingBuffer<int> simple(config);
+        REQUIRE( resource.bytes >= 10 * sizeof(int) );
+        for(int i = 0; i < 20; i++)
+            simple.add(i);
+        REQUIRE( simple.get(0) == 10 );
+
+        // assigned storages keep the resource of their config
+        FlexibleRingBuffer<int> flexible;
+        auto before = resource.bytes;
+        flexible = {config};
+        for(int i = 0; i < 20; i++)
+            flexible.add(i);
+        REQUIRE( flexible.size() == 10 );
+        REQUIRE( resource.bytes > before );
+    }
+    REQUIRE( resource.bytes == 0 );
+}
+
+#endif
@@ -2,6 +2,9 @@
 // SPDX-FileCopyrightText: 2023-present Benno Waldhauer
 // SPDX-License-Identifier: MIT
 
+#include <atomic>
+#include <filesystem>
+#include <thread>
 #include <catch2/catch_all.hpp>
 #include <bw/webthing/action.hpp>
 #include <bw/webthing/event.hpp>
@@ -9,6 +12,22 @@
 
 using namespace bw::webthing;
 
+namespace {
+
+// Directory removed with its journals at the end of a test
+struct JournalDirectory
+{
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("webthing-journal-" + generate_uuid());
+
+    ~JournalDirectory()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+};
+
+}
+
 TEST_CASE( "Webthing thing context is configurable", "[context][thing]" )
 {
     auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
@@ -18,6 +37,23 @@ TEST_CASE( "Webthing thing context is configurable", "[context][thing]" )
     REQUIRE( sut->get_context() == "https://some.custom/context" );
 }
 
+TEST_CASE( "A thing tells when its description changed", "[thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+    auto generation = sut->get_description_generation();
+
+    auto notify = [sut](json message){ sut->property_notify(message); };
+    sut->add_property(std::make_shared<Property<int>>(notify, "brightness", std::make_shared<Value<int>>(50)));
+    REQUIRE( sut->get_description_generation() > generation );
+    generation = sut->get_description_generation();
+
+    sut->set_property("brightness", 42);
+    REQUIRE( sut->get_description_generation() == generation );
+
+    sut->add_available_event("overheated");
+    REQUIRE( sut->get_description_generation() > generation );
+}
+
 TEST_CASE( "Webthing thing validates description of available events", "[event][thing]" )
 {
     auto types = std::vector<std::string>{"test-type"};
@@ -68,6 +104,56 @@ TEST_CASE( "Webthing thing validates description of available actions", "[action
     ActionError, Catch::Matchers::Message("Action metadata must be encoded as json object."));
 }
 
+TEST_CASE( "A thing applies the timeout of an action type to its actions", "[action][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing", std::vector<std::string>{"test-type"}, "");
+    auto supplier = [](auto input){ return std::make_shared<Action>(generate_uuid(), ActionBehavior(), "action", input); };
+
+    sut->add_available_action("timed-action", {{"title", "Timed Action"}, {"timeout", 1500}}, supplier);
+    sut->add_available_action("untimed-action", {{"title", "Untimed Action"}}, supplier);
+    REQUIRE( sut->perform_action("timed-action")->get_timeout() == std::chrono::milliseconds(1500) );
+    REQUIRE_FALSE( sut->perform_action("untimed-action")->get_timeout() );
+
+    // the timeout is no part of the published metadata
+    REQUIRE( sut->as_thing_description()["actions"]["timed-action"]["title"] == "Timed Action" );
+    REQUIRE_FALSE( sut->as_thing_description()["actions"]["timed-action"].contains("timeout") );
+
+    SECTION( "The deadline is scheduled when an action is created" )
+    {
+        auto scheduler = std::make_shared<Scheduler>();
+        auto now = Scheduler::Clock::now();
+        Scheduler::set_current(scheduler.get());
+        auto timed_out = sut->perform_action("timed-action");
+        auto completed = sut->perform_action("timed-action");
+        Scheduler::set_current(nullptr);
+        REQUIRE( scheduler->size() == 2 );
+
+        // the timer of a completed action is canceled
+        completed->start();
+        REQUIRE( completed->get_status() == "completed" );
+        REQUIRE( scheduler->size() == 1 );
+
+        scheduler->advance(now + std::chrono::milliseconds(1600));
+        REQUIRE( timed_out->get_status() == "timedout" );
+        REQUIRE( scheduler->size() == 0 );
+    }
+
+    SECTION( "The deadline is scheduled on the scheduler of the thing" )
+    {
+        auto scheduler = std::make_shared<Scheduler>();
+        sut->set_scheduler(scheduler);
+        auto timed_out = sut->perform_action("timed-action");
+        REQUIRE( scheduler->size() == 1 );
+
+        scheduler->advance(Scheduler::Clock::now() + std::chrono::milliseconds(1600));
+        REQUIRE( timed_out->get_status() == "timedout" );
+    }
+
+    for(auto invalid_timeout : {json(-1), json(0), json(1.5), json("1s")})
+        REQUIRE_THROWS_MATCHES(sut->add_available_action("invalid-action", {{"timeout", invalid_timeout}}, supplier),
+            ActionError, Catch::Matchers::Message("Action timeout must be a positive number of milliseconds."));
+}
+
 TEST_CASE( "Webthing things performes actions", "[action][thing]" )
 {
     struct TestThing : public Thing
@@ -194,4 +280,343 @@ TEST_CASE( "A thing validates the action input before execution", "[action][thin
     }
 }
 
-#endif
\ No newline at end of file
+#endif
+TEST_CASE( "A thing sets multiple properties at once", "[property][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+
+    std::vector<std::string> forwarded;
+    auto notify = [sut](json message){ sut->property_notify(message); };
+    auto on = std::make_shared<Value<bool>>(false, [&](auto){ forwarded.push_back("on"); });
+    auto brightness = std::make_shared<Value<int>>(10, [&](auto){ forwarded.push_back("brightness"); });
+    auto level = std::make_shared<Value<double>>(0.5);
+    auto status = std::make_shared<Value<std::string>>("ok");
+    sut->add_property(std::make_shared<Property<bool>>(notify, "on", on));
+    sut->add_property(std::make_shared<Property<int>>(notify, "brightness", brightness));
+    sut->add_property(std::make_shared<Property<double>>(notify, "level", level));
+    sut->add_property(std::make_shared<Property<std::string>>(notify, "status", status, json{{"readOnly", true}}));
+
+    std::vector<json> messages;
+    sut->add_message_observer([&](auto topic, auto message){
+        REQUIRE( topic == "uri::test.id/properties" );
+        messages.push_back(message);
+    });
+
+    SECTION( "All properties are set and notified in a single message" )
+    {
+        sut->set_properties({{"on", true}, {"brightness", 42}, {"level", 1}});
+
+        REQUIRE( *on->get() == true );
+        REQUIRE( *brightness->get() == 42 );
+        REQUIRE( *level->get() == 1.0 );
+        REQUIRE( forwarded == std::vector<std::string>{"on", "brightness"} );
+        REQUIRE( messages.size() == 1 );
+        REQUIRE( messages[0] == json{{"messageType", "propertyStatus"}, {"data", {{"on", true}, {"brightness", 42}, {"level", 1.0}}}} );
+    }
+
+    SECTION( "Unchanged properties are not notified" )
+    {
+        sut->set_properties({{"on", false}, {"brightness", 11}});
+        REQUIRE( messages.size() == 1 );
+        REQUIRE( messages[0]["data"] == json{{"brightness", 11}} );
+
+        sut->set_properties({{"on", false}});
+        REQUIRE( messages.size() == 1 );
+    }
+
+    SECTION( "No property is set if any value is invalid" )
+    {
+        REQUIRE_THROWS_MATCHES( sut->set_properties({{"on", true}, {"brightness", "bright"}}),
+            PropertyError, Catch::Matchers::Message("Property value type not matching") );
+        REQUIRE_THROWS_MATCHES( sut->set_properties({{"on", true}, {"status", "failed"}}),
+            PropertyError, Catch::Matchers::Message("Read-only property") );
+        REQUIRE_THROWS_MATCHES( sut->set_properties({{"on", true}, {"unknown", 1}}),
+            PropertyError, Catch::Matchers::Message("Unknown property: unknown") );
+
+        REQUIRE( *on->get() == false );
+        REQUIRE( *status->get() == "ok" );
+        REQUIRE( forwarded.empty() );
+        REQUIRE( messages.empty() );
+    }
+
+    SECTION( "Single property changes are still notified on their own" )
+    {
+        sut->set_property("brightness", 12);
+        sut->set_property("on", true);
+        REQUIRE( messages.size() == 2 );
+    }
+}
+
+TEST_CASE( "A thing captures consistent snapshots of its property values", "[property][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+    auto notify = [sut](json message){ sut->property_notify(message); };
+    auto pressure = std::make_shared<Value<int>>(0);
+    auto temperature = std::make_shared<Value<int>>(0);
+    sut->add_property(std::make_shared<Property<int>>(notify, "temperature", temperature));
+    sut->add_property(std::make_shared<Property<int>>(notify, "pressure", pressure));
+
+    std::vector<json> messages;
+    sut->add_message_observer([&](auto topic, auto message){ messages.push_back(message); });
+
+    auto snapshot = sut->get_property_snapshot();
+    REQUIRE( snapshot->values() == json{{"pressure", 0}, {"temperature", 0}} );
+    REQUIRE( sut->get_properties() == snapshot->values() );
+
+    SECTION( "A snapshot is not modified by later changes" )
+    {
+        pressure->notify_of_external_update(1);
+        REQUIRE( snapshot->values()["pressure"] == 0 );
+        REQUIRE( sut->get_property_snapshot()->values()["pressure"] == 1 );
+        REQUIRE( sut->get_property_snapshot()->generation == snapshot->generation + 1 );
+
+        // unchanged values are shared
+        REQUIRE( sut->get_property_snapshot()->slots[1] == snapshot->slots[1] );
+        REQUIRE( sut->get_property_snapshot()->names == snapshot->names );
+    }
+
+    SECTION( "Changes of properties not notifying them are captured" )
+    {
+        auto level = std::make_shared<Value<int>>(0);
+        sut->add_property(std::make_shared<Property<int>>(nullptr, "level", level));
+        level->notify_of_external_update(3);
+
+        REQUIRE( sut->get_property_snapshot()->values() == json{{"level", 3}, {"pressure", 0}, {"temperature", 0}} );
+        REQUIRE( messages.empty() );
+    }
+
+    SECTION( "Grouped updates are captured and notified at once" )
+    {
+        sut->update_properties([&]{
+            pressure->notify_of_external_update(1);
+            temperature->notify_of_external_update(2);
+            REQUIRE( sut->get_property_snapshot() == snapshot );
+        });
+
+        REQUIRE( sut->get_property_snapshot()->values() == json{{"pressure", 1}, {"temperature", 2}} );
+        REQUIRE( sut->get_property_snapshot()->generation == snapshot->generation + 1 );
+        REQUIRE( messages.size() == 1 );
+        REQUIRE( messages[0]["data"] == json{{"pressure", 1}, {"temperature", 2}} );
+    }
+
+    SECTION( "Grouped updates are never observed partially" )
+    {
+        std::atomic<bool> running = true;
+        std::thread device([&]{
+            for(int i = 1; running; i++)
+                sut->update_properties([&]{
+                    pressure->notify_of_external_update(i);
+                    temperature->notify_of_external_update(i);
+                });
+        });
+
+        for(int i = 0; i < 1000; i++)
+        {
+            auto values = sut->get_property_snapshot()->values();
+            REQUIRE( values["pressure"] == values["temperature"] );
+        }
+
+        running = false;
+        device.join();
+    }
+}
+
+TEST_CASE( "A thing sets multiple properties without waiting for their forwarders", "[property][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+    auto notify = [sut](json message){ sut->property_notify(message); };
+
+    std::vector<ForwardCallback> pending_forwards;
+    auto brightness = std::make_shared<Value<int>>(0, [&](const int&, ForwardCallback done){
+        pending_forwards.push_back(done);
+    }, std::chrono::milliseconds(100));
+    std::vector<std::function<void()>> executed_tasks;
+    auto on = std::make_shared<Value<bool>>(false, [&](const bool& v){
+        if(!v)
+            throw std::runtime_error("cannot switch off");
+    });
+    sut->add_property(std::make_shared<Property<int>>(notify, "brightness", brightness));
+    sut->add_property(std::make_shared<Property<bool>>(notify, "on", on));
+
+    std::vector<json> messages;
+    sut->add_message_observer([&](auto topic, auto message){ messages.push_back(message); });
+
+    std::optional<std::exception_ptr> result;
+    auto done = [&](std::exception_ptr error){ result = error; };
+    auto executor = [&](std::function<void()> task){ executed_tasks.push_back(task); };
+
+    SECTION( "Values are set at once when all were forwarded" )
+    {
+        sut->set_properties_async({{"brightness", 42}, {"on", true}}, done, executor);
+        REQUIRE( pending_forwards.size() == 1 );
+        REQUIRE( executed_tasks.size() == 1 );
+
+        executed_tasks.front()();
+        REQUIRE( !result );
+        REQUIRE( *on->get() == false );
+
+        pending_forwards.front()(nullptr);
+        REQUIRE( result );
+        REQUIRE( *result == nullptr );
+        REQUIRE( sut->get_properties() == json{{"brightness", 42}, {"on", true}} );
+        REQUIRE( messages.size() == 1 );
+    }
+
+    SECTION( "Values forwarded successfully are set even if others failed" )
+    {
+        sut->set_properties_async({{"brightness", 42}, {"on", true}}, done);
+        sut->set_properties_async({{"on", false}}, done);
+        REQUIRE( *result != nullptr );
+
+        result = std::nullopt;
+        pending_forwards.front()(nullptr);
+        REQUIRE( *result == nullptr );
+        REQUIRE( sut->get_properties() == json{{"brightness", 42}, {"on", true}} );
+    }
+
+    SECTION( "Discarded values are not set when forwarded afterwards" )
+    {
+        auto discard = sut->set_properties_async({{"brightness", 42}}, done);
+        discard();
+        pending_forwards.front()(nullptr);
+        REQUIRE( !result );
+        REQUIRE( *brightness->get() == 0 );
+        REQUIRE( messages.empty() );
+    }
+
+    SECTION( "Invalid values are rejected immediately" )
+    {
+        REQUIRE_THROWS_AS( sut->set_properties_async({{"brightness", "bright"}}, done), PropertyError );
+        REQUIRE( pending_forwards.empty() );
+        REQUIRE( !result );
+    }
+}
+
+TEST_CASE( "A thing fetches outdated lazy property values", "[property][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+    auto notify = [sut](json message){ sut->property_notify(message); };
+
+    int reads = 0;
+    auto level = std::make_shared<LazyValue<int>>([&]{ return ++reads; }, std::chrono::hours(1));
+    sut->add_property(std::make_shared<Property<int>>(notify, "level", level));
+    sut->add_property(std::make_shared<Property<bool>>(notify, "on", std::make_shared<Value<bool>>(true)));
+
+    REQUIRE( sut->get_properties() == json{{"level", nullptr}, {"on", true}} );
+    REQUIRE( reads == 0 );
+
+    std::vector<std::function<void()>> tasks;
+    std::optional<std::exception_ptr> result;
+    auto refresh = [&]{
+        sut->refresh_properties_async([&](std::exception_ptr error){ result = error; },
+            [&](std::function<void()> task){ tasks.push_back(task); });
+    };
+
+    refresh();
+    REQUIRE( tasks.size() == 1 );
+    REQUIRE( !result );
+
+    tasks.front()();
+    REQUIRE( *result == nullptr );
+    REQUIRE( sut->get_properties() == json{{"level", 1}, {"on", true}} );
+
+    // fresh values are not fetched again
+    refresh();
+    REQUIRE( tasks.size() == 1 );
+    REQUIRE( reads == 1 );
+
+    // a fetch scheduled for a destroyed value is skipped
+    auto pressure = std::make_shared<LazyValue<int>>([&]{ return ++reads; }, std::chrono::hours(1));
+    pressure->refresh_async([](std::exception_ptr){}, [&](std::function<void()> task){ tasks.push_back(task); });
+    pressure.reset();
+    tasks.back()();
+    REQUIRE( reads == 1 );
+}
+
+TEST_CASE( "A thing restores events and actions from journals", "[event][action][thing]" )
+{
+    JournalDirectory directory;
+    auto make_test_thing = [&directory]{
+        auto thing = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+        thing->configure_event_journal({(directory.path / "events").string()});
+        thing->configure_action_journal({(directory.path / "actions").string()});
+        thing->add_available_event("overheated", {{"type", "number"}});
+        thing->add_available_action("fade", {{"title", "Fade"}}, [thing = thing.get()](auto input){
+            return std::make_shared<Action>(generate_uuid(), make_action_behavior(thing), "fade", input);
+        });
+        return thing;
+    };
+
+    std::string completed_id, removed_id, pending_id;
+    {
+        auto thing = make_test_thing();
+        thing->add_event(std::make_shared<Event>(thing.get(), "overheated", 102));
+        thing->add_event(std::make_shared<Event>(thing.get(), "overheated", 104));
+
+        auto completed = thing->perform_action("fade", json{{"brightness", 50}});
+        completed->start();
+        completed_id = completed->get_id();
+        removed_id = thing->perform_action("fade")->get_id();
+        REQUIRE( thing->remove_action("fade", removed_id) );
+        pending_id = thing->perform_action("fade")->get_id();
+    }
+
+    auto thing = make_test_thing();
+    auto events = thing->get_event_descriptions();
+    REQUIRE( events.size() == 2 );
+    REQUIRE( events[0]["overheated"]["data"] == 102 );
+    REQUIRE( events[1]["overheated"]["data"] == 104 );
+
+    REQUIRE( thing->get_action_descriptions().size() == 2 );
+    auto completed = thing->get_action("fade", completed_id);
+    REQUIRE( completed );
+    REQUIRE( completed->get_status() == "completed" );
+    REQUIRE( completed->get_input() == json{{"brightness", 50}} );
+    REQUIRE( completed->get_time_completed() );
+    REQUIRE_FALSE( thing->get_action("fade", removed_id) );
+    // actions interrupted by the restart are not performed again
+    REQUIRE( thing->get_action("fade", pending_id)->get_status() == "cancelled" );
+}
+
+TEST_CASE( "A thing restores property values without forwarding them", "[property][thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+
+    std::vector<std::string> forwarded;
+    auto notify = [sut](json message){ sut->property_notify(message); };
+    auto on = std::make_shared<Value<bool>>(false, [&](auto){ forwarded.push_back("on"); });
+    auto brightness = std::make_shared<Value<int>>(10, [&](auto){ forwarded.push_back("brightness"); });
+    sut->add_property(std::make_shared<Property<bool>>(notify, "on", on));
+    sut->add_property(std::make_shared<Property<int>>(notify, "brightness", brightness));
+
+    std::vector<json> messages;
+    sut->add_message_observer([&](auto, auto message){ messages.push_back(message); });
+
+    sut->restore_property_values({{"brightness", 42}, {"on", "not a bool"}, {"unknown", 1}});
+    REQUIRE( *brightness->get() == 42 );
+    REQUIRE( *on->get() == false );
+    REQUIRE( forwarded.empty() );
+    REQUIRE( messages.size() == 1 );
+    REQUIRE( sut->get_property_snapshot()->values()["brightness"] == 42 );
+}
+
+TEST_CASE( "Message observers of a thing can be removed", "[thing]" )
+{
+    auto sut = std::make_shared<Thing>("uri::test.id", "my-test-thing");
+    auto notify = [sut](json message){ sut->property_notify(message); };
+    auto level = std::make_shared<Value<int>>(0);
+    sut->add_property(std::make_shared<Property<int>>(notify, "level", level));
+
+    int first = 0, second = 0;
+    auto first_id = sut->add_message_observer([&](auto, auto){ first++; });
+    auto second_id = sut->add_message_observer([&](auto, auto){ second++; });
+    REQUIRE( first_id != second_id );
+
+    level->notify_of_external_update(1);
+    REQUIRE( sut->remove_message_observer(first_id) );
+    REQUIRE_FALSE( sut->remove_message_observer(first_id) );
+    level->notify_of_external_update(2);
+
+    REQUIRE( first == 1 );
+    REQUIRE( second == 2 );
+}
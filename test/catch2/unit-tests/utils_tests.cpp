@@ -2,6 +2,7 @@
 // SPDX-FileCopyrightText: 2023-present Benno Waldhauer
 // SPDX-License-Identifier: MIT
 
+#include <thread>
 #include <catch2/catch_all.hpp>
 #include <bw/webthing/utils.hpp>
 
@@ -149,4 +150,29 @@ TEST_CASE( "Utils offer a helper for timestamps", "[time]" )
 
     REQUIRE(ts_fixed_first == ts_fixed_second);
     REQUIRE(ts_fixed_first == "1985-08-26T11:11:11.1111+00:02");
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Utils offer a shared_ptr replaced concurrently", "[atomic]" )
+{
+    AtomicSharedPtr<const int> ptr = std::make_shared<const int>(0);
+    auto first = ptr.load();
+
+    std::thread writer([&]{
+        for(int i = 1; i <= 1000; i++)
+            ptr.store(std::make_shared<const int>(i));
+    });
+    int last = 0;
+    for(int i = 0; i < 1000; i++)
+    {
+        int current = *ptr.load();
+        REQUIRE( current >= last );
+        last = current;
+    }
+    writer.join();
+
+    REQUIRE( *first == 0 );
+    REQUIRE( *ptr.load() == 1000 );
+
+    AtomicSharedPtr<const int> copy = ptr;
+    REQUIRE( copy.load() == ptr.load() );
+}
@@ -4,6 +4,7 @@
 
 #include <catch2/catch_all.hpp>
 #include <bw/webthing/value.hpp>
+#include <thread>
 
 using namespace bw::webthing;
 
@@ -93,4 +94,144 @@ TEST_CASE( "Values only notify their observers when they have changed", "[value]
     REQUIRE( value.get() == "val-c" );
     REQUIRE( value_observer.last_value == "val-c" );
     REQUIRE( value_observer.changed_counter == 3 );
-}
\ No newline at end of file
+}
+TEST_CASE( "Values can be forwarded asynchronously", "[value]" )
+{
+    std::vector<ForwardCallback> pending_forwards;
+    Value<int> value(0, [&](const int& v, ForwardCallback done){
+        pending_forwards.push_back(done);
+    }, std::chrono::milliseconds(10));
+
+    REQUIRE( value.forwards_async() );
+    REQUIRE( value.get_forward_timeout() == std::chrono::milliseconds(10) );
+
+    SECTION( "The value is set once it was forwarded" )
+    {
+        std::optional<std::exception_ptr> result;
+        value.set_async(42, [&](std::exception_ptr error){ result = error; });
+        REQUIRE( *value.get() == 0 );
+        REQUIRE( !result );
+
+        pending_forwards.front()(nullptr);
+        REQUIRE( *value.get() == 42 );
+        REQUIRE( result );
+        REQUIRE( *result == nullptr );
+    }
+
+    SECTION( "The value is not set if forwarding failed" )
+    {
+        std::optional<std::exception_ptr> result;
+        value.set_async(42, [&](std::exception_ptr error){ result = error; });
+        pending_forwards.front()(std::make_exception_ptr(std::runtime_error("device offline")));
+        REQUIRE( *value.get() == 0 );
+        REQUIRE( *result != nullptr );
+    }
+
+    SECTION( "Setting the value waits until the forward timeout" )
+    {
+        REQUIRE_THROWS_AS( value.set(42), ForwardTimeoutError );
+        REQUIRE( *value.get() == 0 );
+    }
+
+    SECTION( "A shared value may be destroyed before it was forwarded" )
+    {
+        auto shared = std::make_shared<Value<int>>(0, [&](const int& v, ForwardCallback done){
+            pending_forwards.push_back(done);
+        }, std::chrono::milliseconds(10));
+
+        std::optional<std::exception_ptr> result;
+        shared->set_async(42, [&](std::exception_ptr error){ result = error; });
+        shared.reset();
+
+        pending_forwards.front()(nullptr);
+        REQUIRE( result );
+        REQUIRE( *result == nullptr );
+    }
+}
+
+TEST_CASE( "Synchronous value forwarders can be used asynchronously", "[value]" )
+{
+    Value<int> value(0, [&](const int& v){
+        if(v < 0)
+            throw std::runtime_error("negative value");
+    });
+
+    REQUIRE_FALSE( value.forwards_async() );
+    REQUIRE( value.get_forward_timeout() == DEFAULT_FORWARD_TIMEOUT );
+
+    std::optional<std::exception_ptr> result;
+    value.set_async(-1, [&](std::exception_ptr error){ result = error; });
+    REQUIRE( *result != nullptr );
+    REQUIRE( *value.get() == 0 );
+
+    value.set_async(1, [&](std::exception_ptr error){ result = error; });
+    REQUIRE( *result == nullptr );
+    REQUIRE( *value.get() == 1 );
+}
+
+TEST_CASE( "Lazy values are fetched on demand and cached", "[value]" )
+{
+    int reads = 0;
+    bool device_available = true;
+    auto lazy_value = std::make_shared<LazyValue<int>>([&]{
+        if(!device_available)
+            throw std::runtime_error("device offline");
+        return ++reads;
+    }, std::chrono::milliseconds(50));
+    auto& value = *lazy_value;
+
+    std::vector<std::function<void()>> tasks;
+    auto executor = [&](std::function<void()> task){ tasks.push_back(task); };
+    std::vector<std::exception_ptr> results;
+    auto done = [&](std::exception_ptr error){ results.push_back(error); };
+
+    REQUIRE( value.is_stale() );
+    REQUIRE( !value.get() );
+
+    SECTION( "Concurrent reads share a single fetch" )
+    {
+        value.refresh_async(done, executor);
+        value.refresh_async(done, executor);
+        REQUIRE( tasks.size() == 1 );
+        REQUIRE( results.empty() );
+
+        tasks.front()();
+        REQUIRE( results == std::vector<std::exception_ptr>{nullptr, nullptr} );
+        REQUIRE( *value.get() == 1 );
+        REQUIRE_FALSE( value.is_stale() );
+    }
+
+    SECTION( "Fresh values are not fetched again" )
+    {
+        value.refresh_async(done, nullptr);
+        value.refresh_async(done, nullptr);
+        REQUIRE( reads == 1 );
+        REQUIRE( results.size() == 2 );
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        REQUIRE( value.is_stale() );
+        value.refresh_async(done, nullptr);
+        REQUIRE( *value.get() == 2 );
+    }
+
+    SECTION( "Failed fetches keep the value outdated" )
+    {
+        device_available = false;
+        value.refresh_async(done, nullptr);
+        REQUIRE( results.size() == 1 );
+        REQUIRE( results.front() != nullptr );
+        REQUIRE( value.is_stale() );
+    }
+
+    SECTION( "Waiting reads fail when the value is destroyed before it was fetched" )
+    {
+        value.refresh_async(done, executor);
+        lazy_value.reset();
+        REQUIRE( results.size() == 1 );
+        REQUIRE( results.front() != nullptr );
+
+        tasks.front()();
+        REQUIRE( results.size() == 1 );
+        REQUIRE( reads == 0 );
+    }
+}
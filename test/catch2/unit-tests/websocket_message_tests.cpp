@@ -0,0 +1,93 @@
+// Webthing-CPP
+// SPDX-FileCopyrightText: 2023-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <catch2/catch_all.hpp>
+#include <bw/webthing/websocket_message.hpp>
+
+using namespace bw::webthing;
+
+TEST_CASE( "WebSocketMessageParser parses message type and data entries", "[websocket_message]" )
+{
+    auto message = WebSocketMessageParser::parse(
+        R"({"messageType":"setProperty","data":{"on":true,"brightness":42,"level":0.5,"name":"lamp","unknown":null}})");
+
+    REQUIRE( message );
+    REQUIRE( message->is_valid() );
+    REQUIRE( *message->message_type == "setProperty" );
+    REQUIRE( message->data.size() == 5 );
+    REQUIRE( message->data[0].first == "on" );
+    REQUIRE( message->data[0].second == true );
+    REQUIRE( message->data[1].first == "brightness" );
+    REQUIRE( message->data[1].second.is_number_integer() );
+    REQUIRE( message->data[1].second == 42 );
+    REQUIRE( message->data[2].first == "level" );
+    REQUIRE( message->data[2].second.is_number_float() );
+    REQUIRE( message->data[2].second == 0.5 );
+    REQUIRE( message->data[3].first == "name" );
+    REQUIRE( message->data[3].second == "lamp" );
+    REQUIRE( message->data[4].first == "unknown" );
+    REQUIRE( message->data[4].second.is_null() );
+}
+
+TEST_CASE( "WebSocketMessageParser builds json only for nested values", "[websocket_message]" )
+{
+    auto message = WebSocketMessageParser::parse(
+        R"({"data":{"fade":{"input":{"level":50,"steps":[1,[2,3],{"x":4}]}},"toggle":{}},"messageType":"requestAction"})");
+
+    REQUIRE( message );
+    REQUIRE( message->is_valid() );
+    REQUIRE( *message->message_type == "requestAction" );
+    REQUIRE( message->data.size() == 2 );
+    REQUIRE( message->data[0].first == "fade" );
+    REQUIRE( message->data[0].second == json::parse(R"({"input":{"level":50,"steps":[1,[2,3],{"x":4}]}})") );
+    REQUIRE( message->data[1].first == "toggle" );
+    REQUIRE( message->data[1].second == json::object() );
+}
+
+TEST_CASE( "WebSocketMessageParser ignores values outside of data", "[websocket_message]" )
+{
+    auto message = WebSocketMessageParser::parse(
+        R"({"other":{"messageType":"x","data":{"a":1}},"messageType":"addEventSubscription","list":[1,{"data":2}],"data":{"e":{}}})");
+
+    REQUIRE( message );
+    REQUIRE( *message->message_type == "addEventSubscription" );
+    REQUIRE( message->data.size() == 1 );
+    REQUIRE( message->data[0].first == "e" );
+}
+
+TEST_CASE( "WebSocketMessageParser detects invalid messages", "[websocket_message]" )
+{
+    REQUIRE_FALSE( WebSocketMessageParser::parse("{\"messageType\":") );
+    REQUIRE_FALSE( WebSocketMessageParser::parse("no json") );
+
+    REQUIRE_FALSE( WebSocketMessageParser::parse(R"({"data":{}})")->is_valid() );
+    REQUIRE_FALSE( WebSocketMessageParser::parse(R"({"messageType":"setProperty"})")->is_valid() );
+    REQUIRE_FALSE( WebSocketMessageParser::parse(R"({"messageType":1,"data":{}})")->is_valid() );
+    REQUIRE_FALSE( WebSocketMessageParser::parse(R"(["messageType","data"])")->is_valid() );
+    REQUIRE_FALSE( WebSocketMessageParser::parse("42")->is_valid() );
+
+    auto message = WebSocketMessageParser::parse(R"({"messageType":"setProperty","data":[1,2]})");
+    REQUIRE( message->is_valid() );
+    REQUIRE( message->data.empty() );
+}
+
+TEST_CASE( "WebSocketMessageParser parses binary messages", "[websocket_message]" )
+{
+    json j = {{"messageType", "requestAction"}, {"data", {{"fade", {{"input", {{"level", 50}}}}}}}};
+
+    for(auto format : {ContentFormat::cbor, ContentFormat::msgpack})
+    {
+        auto message = WebSocketMessageParser::parse(encode(j, format), format);
+        REQUIRE( message );
+        REQUIRE( message->is_valid() );
+        REQUIRE( *message->message_type == "requestAction" );
+        REQUIRE( message->data.size() == 1 );
+        REQUIRE( message->data[0].first == "fade" );
+        REQUIRE( message->data[0].second == json{{"input", {{"level", 50}}}} );
+    }
+
+    REQUIRE( WebSocketMessageParser::parse(j.dump(), ContentFormat::json)->is_valid() );
+    REQUIRE_FALSE( WebSocketMessageParser::parse("\xff", ContentFormat::cbor) );
+    REQUIRE_FALSE( WebSocketMessageParser::parse(encode(json::array(), ContentFormat::cbor), ContentFormat::cbor)->is_valid() );
+}
@@ -303,4 +303,34 @@ TEST_CASE( "It offers an easy api for action linkage as well as action execution
         }
 
     }
-}
\ No newline at end of file
+}
+
+#ifdef WT_WITH_PMR
+
+TEST_CASE( "Things allocate storages and records from their memory resource", "[thing]" )
+{
+    std::pmr::unsynchronized_pool_resource resource;
+    std::shared_ptr<Event> event;
+    {
+        auto thing = make_thing();
+        thing->configure_event_storage({10});
+        thing->set_memory_resource(&resource);
+        link_event(thing, "overheated");
+        link_action(thing, "fade");
+
+        event = emit_event(thing, "overheated", 42);
+        auto action = thing->perform_action("fade");
+        REQUIRE( action );
+        REQUIRE( thing->get_event_descriptions().size() == 1 );
+
+        for(int i = 0; i < 100; i++)
+            emit_event(thing, "overheated", i);
+        REQUIRE( thing->get_event_descriptions().size() == 10 );
+    }
+
+    // records keep their pool alive while they outlive the thing
+    REQUIRE( event->get_data() == 42 );
+    event.reset();
+}
+
+#endif